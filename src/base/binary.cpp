@@ -0,0 +1,96 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "binary.h"
+
+void BinaryWriter::WriteBytes(const void* data, size_t size) {
+  buffer_.append(static_cast<const char*>(data), size);
+}
+
+void BinaryWriter::WriteString(const std::wstring& str) {
+  Write(static_cast<UINT32>(str.size()));
+  WriteBytes(str.data(), str.size() * sizeof(wchar_t));
+}
+
+const std::string& BinaryWriter::buffer() const {
+  return buffer_;
+}
+
+size_t BinaryWriter::size() const {
+  return buffer_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BinaryReader::BinaryReader(const BYTE* data, size_t size)
+    : data_(data), size_(size), position_(0), failed_(false) {
+}
+
+bool BinaryReader::ReadBytes(void* data, size_t size) {
+  if (failed_ || size > size_ - position_) {
+    failed_ = true;
+    return false;
+  }
+
+  memcpy(data, data_ + position_, size);
+  position_ += size;
+  return true;
+}
+
+bool BinaryReader::ReadString(std::wstring& str) {
+  UINT32 length = 0;
+  if (!Read(length))
+    return false;
+
+  if (failed_ || length > (size_ - position_) / sizeof(wchar_t)) {
+    failed_ = true;
+    return false;
+  }
+
+  str.assign(reinterpret_cast<const wchar_t*>(data_ + position_), length);
+  position_ += length * sizeof(wchar_t);
+  return true;
+}
+
+bool BinaryReader::Skip(size_t size) {
+  if (failed_ || size > size_ - position_) {
+    failed_ = true;
+    return false;
+  }
+
+  position_ += size;
+  return true;
+}
+
+bool BinaryReader::eof() const {
+  return position_ == size_;
+}
+
+bool BinaryReader::failed() const {
+  return failed_;
+}
+
+size_t BinaryReader::position() const {
+  return position_;
+}
+
+size_t BinaryReader::remaining() const {
+  return size_ - position_;
+}
@@ -0,0 +1,72 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_BINARY_H
+#define TAIGA_BASE_BINARY_H
+
+#include <string>
+#include <windows.h>
+
+// Serializes plain values and strings into a flat byte buffer. Values are
+// written in native byte order, so the output is only meant to be read back on
+// the same platform.
+class BinaryWriter {
+public:
+  template <typename T>
+  void Write(const T& value) {
+    buffer_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  void WriteBytes(const void* data, size_t size);
+  void WriteString(const std::wstring& str);
+
+  const std::string& buffer() const;
+  size_t size() const;
+
+private:
+  std::string buffer_;
+};
+
+// Reads values written by BinaryWriter. Every read is bounds-checked; once a
+// read fails, the reader stays in a failed state and all subsequent reads fail.
+class BinaryReader {
+public:
+  BinaryReader(const BYTE* data, size_t size);
+
+  template <typename T>
+  bool Read(T& value) {
+    return ReadBytes(&value, sizeof(T));
+  }
+
+  bool ReadBytes(void* data, size_t size);
+  bool ReadString(std::wstring& str);
+  bool Skip(size_t size);
+
+  bool eof() const;
+  bool failed() const;
+  size_t position() const;
+  size_t remaining() const;
+
+private:
+  const BYTE* data_;
+  size_t size_;
+  size_t position_;
+  bool failed_;
+};
+
+#endif  // TAIGA_BASE_BINARY_H
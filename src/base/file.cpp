@@ -23,8 +23,6 @@
 #include "string.h"
 #include "win/win_registry.h"
 
-#define MAKEQWORD(a, b) ((QWORD)(((QWORD)((DWORD)(a))) << 32 | ((DWORD)(b))))
-
 ////////////////////////////////////////////////////////////////////////////////
 
 HANDLE OpenFileForGenericRead(const std::wstring& path) {
@@ -356,6 +354,93 @@ bool SaveToFile(LPCVOID data, DWORD length, const string_t& path,
   return result != FALSE;
 }
 
+bool AppendToFile(LPCVOID data, DWORD length, const string_t& path) {
+  // Make sure the path is available
+  CreateFolder(GetPathOnly(path));
+
+  // Writes always go to the end of the file, regardless of the file pointer
+  BOOL result = FALSE;
+  HANDLE file_handle = ::CreateFile(path.c_str(), FILE_APPEND_DATA, 0, nullptr,
+                                    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle != INVALID_HANDLE_VALUE) {
+    DWORD bytes_written = 0;
+    result = ::WriteFile(file_handle, data, length, &bytes_written, nullptr);
+    ::CloseHandle(file_handle);
+  }
+
+  return result != FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+FileMapping::FileMapping()
+    : file_handle_(INVALID_HANDLE_VALUE),
+      mapping_handle_(nullptr),
+      data_(nullptr),
+      size_(0) {
+}
+
+FileMapping::~FileMapping() {
+  Close();
+}
+
+bool FileMapping::Open(const std::wstring& path) {
+  Close();
+
+  file_handle_ = OpenFileForGenericRead(path);
+  if (file_handle_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+  if (!::GetFileSizeEx(file_handle_, &file_size) ||
+      file_size.QuadPart == 0 ||
+      file_size.QuadPart > static_cast<LONGLONG>(SIZE_MAX)) {
+    Close();
+    return false;
+  }
+
+  mapping_handle_ = ::CreateFileMapping(file_handle_, nullptr, PAGE_READONLY,
+                                        0, 0, nullptr);
+  if (!mapping_handle_) {
+    Close();
+    return false;
+  }
+
+  data_ = static_cast<const BYTE*>(
+      ::MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    Close();
+    return false;
+  }
+
+  size_ = static_cast<size_t>(file_size.QuadPart);
+  return true;
+}
+
+void FileMapping::Close() {
+  if (data_) {
+    ::UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_handle_) {
+    ::CloseHandle(mapping_handle_);
+    mapping_handle_ = nullptr;
+  }
+  if (file_handle_ != INVALID_HANDLE_VALUE) {
+    ::CloseHandle(file_handle_);
+    file_handle_ = INVALID_HANDLE_VALUE;
+  }
+  size_ = 0;
+}
+
+const BYTE* FileMapping::data() const {
+  return data_;
+}
+
+size_t FileMapping::size() const {
+  return size_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 std::wstring ToSizeString(QWORD qwSize) {
@@ -20,11 +20,19 @@
 #define TAIGA_BASE_FILE_H
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <windows.h>
 
 #include "types.h"
 
+class BinaryReader;
+class BinaryWriter;
+class SearchDirectory;
+
+HANDLE OpenFileForGenericRead(const std::wstring& path);
+HANDLE OpenFileForGenericWrite(const std::wstring& path);
+
 unsigned long GetFileAge(const std::wstring& path);
 QWORD GetFileSize(const std::wstring& path);
 QWORD GetFolderSize(const std::wstring& path, bool recursive);
@@ -53,9 +61,66 @@ int PopulateFolders(std::vector<std::wstring>& folder_list, const std::wstring&
 
 bool ReadFromFile(const std::wstring& path, std::string& output);
 bool SaveToFile(LPCVOID data, DWORD length, const std::wstring& path, bool take_backup = false);
+bool AppendToFile(LPCVOID data, DWORD length, const std::wstring& path);
 
 std::wstring ToSizeString(QWORD qwSize);
 
+// Maps a file into memory for reading
+class FileMapping {
+public:
+  FileMapping();
+  ~FileMapping();
+
+  bool Open(const std::wstring& path);
+  void Close();
+
+  const BYTE* data() const;
+  size_t size() const;
+
+private:
+  HANDLE file_handle_;
+  HANDLE mapping_handle_;
+  const BYTE* data_;
+  size_t size_;
+};
+
+// Keeps directory listings between searches. A listing remains valid for as
+// long as the last write time of its directory is unchanged, which happens
+// whenever an entry is added, removed or renamed.
+class DirectoryCache {
+public:
+  class Entry {
+  public:
+    std::wstring name;
+    bool is_directory;
+    QWORD size;
+  };
+
+  class Listing {
+  public:
+    QWORD write_time;
+    std::vector<Entry> entries;
+  };
+
+  DirectoryCache();
+
+  void Clear();
+  const Listing* Find(const std::wstring& path) const;
+  void Set(const std::wstring& path, const Listing& listing);
+
+  bool Read(BinaryReader& reader);
+  void Write(BinaryWriter& writer) const;
+
+  bool modified() const;
+  void set_modified(bool modified);
+
+private:
+  void Remove(const std::wstring& key);
+
+  std::unordered_map<std::wstring, Listing> listings_;
+  bool modified_;
+};
+
 class FileSearchHelper {
 public:
   FileSearchHelper();
@@ -65,16 +130,38 @@ public:
 
   virtual bool OnDirectory(const std::wstring& root, const std::wstring& name) = 0;
   virtual bool OnFile(const std::wstring& root, const std::wstring& name) = 0;
-
+  // Called with the full paths of the next batch of files, in the order that
+  // OnFile will be called for them
+  virtual void OnFiles(const std::vector<std::wstring>& paths);
+  // Files that are below the minimum size are checked again when a cached
+  // listing is used, if they might still grow into a match. Called on worker
+  // threads.
+  virtual bool IsCandidateFile(const std::wstring& name) const;
+
+  // Listings are taken from the cache while their directories are unchanged,
+  // and the cache is updated with the directories that had to be read. In
+  // cache-only mode, the disk is not accessed at all.
+  void set_cache_only(bool cache_only);
+  void set_directory_cache(DirectoryCache* directory_cache);
+  // By default, directories are read as the search reaches them, so that a
+  // search that stops at the first match reads no further. Searches that visit
+  // everything can read the whole tree in parallel first instead.
+  void set_read_whole_tree(bool read_whole_tree);
   void set_skip_directories(bool skip_directories);
   void set_skip_files(bool skip_files);
   void set_skip_subdirectories(bool skip_subdirectories);
 
 protected:
+  bool cache_only_;
+  DirectoryCache* directory_cache_;
   ULONGLONG minimum_file_size_;
+  bool read_whole_tree_;
   bool skip_directories_;
   bool skip_files_;
   bool skip_subdirectories_;
+
+private:
+  bool SearchTree(std::vector<SearchDirectory>& directories);
 };
 
 #endif  // TAIGA_BASE_FILE_H
\ No newline at end of file
@@ -16,12 +16,188 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "binary.h"
 #include "file.h"
+#include "foreach.h"
 #include "log.h"
 #include "string.h"
+#include "win/win_thread.h"
+
+// Number of files that are handed to OnFiles at a time
+const size_t kFileBatchSize = 1024;
+
+class SearchEntry {
+public:
+  std::wstring name;
+  bool is_directory;
+  size_t directory;  // Index of the subdirectory, if it is read
+};
+
+class SearchDirectory {
+public:
+  std::wstring path;
+  std::vector<SearchEntry> entries;
+  DirectoryCache::Listing listing;  // Set if the directory was read from disk
+  bool fresh;
+  bool readable;
+};
+
+static bool GetAttributes(const std::wstring& path, QWORD& write_time,
+                          QWORD& size) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesEx(GetExtendedLengthPath(path).c_str(),
+                           GetFileExInfoStandard, &data))
+    return false;
+
+  write_time = MAKEQWORD(data.ftLastWriteTime.dwHighDateTime,
+                         data.ftLastWriteTime.dwLowDateTime);
+  size = MAKEQWORD(data.nFileSizeHigh, data.nFileSizeLow);
+  return true;
+}
+
+static bool ReadDirectory(const std::wstring& root,
+                          DirectoryCache::Listing& listing) {
+  std::wstring path = AddTrailingSlash(GetExtendedLengthPath(root)) + L"*";
+
+  // The write time is taken first, so that any change that is made while the
+  // directory is being read invalidates the listing next time
+  QWORD size = 0;
+  listing.write_time = 0;
+  GetAttributes(root, listing.write_time, size);
+
+  WIN32_FIND_DATA find_data;
+  HANDLE handle = FindFirstFile(path.c_str(), &find_data);
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    LOG(LevelError, Logger::FormatError(GetLastError()));
+    LOG(LevelError, L"Path: " + path);
+    SetLastError(ERROR_SUCCESS);
+    return false;
+  }
+
+  do {
+    DirectoryCache::Entry entry;
+    entry.is_directory = IsDirectory(find_data);
+    if (entry.is_directory && !IsValidDirectory(find_data))
+      continue;
+    entry.name = find_data.cFileName;
+    entry.size = MAKEQWORD(find_data.nFileSizeHigh, find_data.nFileSizeLow);
+    listing.entries.push_back(entry);
+  } while (FindNextFile(handle, &find_data));
+
+  FindClose(handle);
+
+  return true;
+}
+
+static bool IsListingValid(const FileSearchHelper& helper,
+                           const std::wstring& root,
+                           const DirectoryCache::Listing& listing,
+                           ULONGLONG minimum_file_size) {
+  QWORD write_time = 0, size = 0;
+  if (!GetAttributes(root, write_time, size) ||
+      write_time != listing.write_time)
+    return false;
+
+  // A file that is still growing (e.g. being downloaded) does not change the
+  // write time of its directory, so files that were too small are checked
+  // again. Files that are renamed when they are complete change it anyway.
+  foreach_c_(entry, listing.entries) {
+    if (!entry->is_directory && entry->size < minimum_file_size &&
+        helper.IsCandidateFile(entry->name)) {
+      if (!GetAttributes(AddTrailingSlash(root) + entry->name,
+                         write_time, size) ||
+          size != entry->size)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+static void FilterListing(const std::wstring& root,
+                          const DirectoryCache::Listing& listing,
+                          bool skip_files, ULONGLONG minimum_file_size,
+                          std::vector<SearchEntry>& entries) {
+  foreach_c_(it, listing.entries) {
+    if (!it->is_directory) {
+      if (skip_files)
+        continue;
+      if (it->size < minimum_file_size) {
+        LOG(LevelDebug,
+            L"File is ignored because its size does not meet the threshold.");
+        LOG(LevelDebug, L"Path: " + AddTrailingSlash(root) + it->name);
+        continue;
+      }
+    }
+    SearchEntry entry;
+    entry.name = it->name;
+    entry.is_directory = it->is_directory;
+    entry.directory = 0;
+    entries.push_back(entry);
+  }
+}
+
+// Reads the given range of directories in parallel. Listings are taken from
+// the cache while they are valid, and the cache is updated afterwards, as it is
+// not modified while it is being read by the workers.
+static void ReadDirectories(const FileSearchHelper& helper,
+                            std::vector<SearchDirectory>& directories,
+                            size_t begin, size_t end,
+                            DirectoryCache* directory_cache, bool cache_only,
+                            bool skip_files, ULONGLONG minimum_file_size) {
+  win::ParallelFor(end - begin, [&](size_t index, size_t worker) {
+    auto& directory = directories[begin + index];
+    const DirectoryCache::Listing* listing = nullptr;
+    if (directory_cache) {
+      listing = directory_cache->Find(directory.path);
+      if (listing && !cache_only &&
+          !IsListingValid(helper, directory.path, *listing,
+                          minimum_file_size))
+        listing = nullptr;
+    }
+    directory.fresh = !listing && !cache_only;
+    if (directory.fresh) {
+      directory.readable = ReadDirectory(directory.path, directory.listing);
+      listing = &directory.listing;
+    } else {
+      directory.readable = listing != nullptr;
+    }
+    if (directory.readable)
+      FilterListing(directory.path, *listing, skip_files, minimum_file_size,
+                    directory.entries);
+  });
+
+  for (size_t i = begin; i < end; i++) {
+    auto& directory = directories[i];
+    if (directory.fresh && directory.readable && directory_cache)
+      directory_cache->Set(directory.path, directory.listing);
+    directory.listing.entries.clear();
+  }
+}
+
+// Appends the subdirectories of a directory that has been read
+static void AddSubdirectories(std::vector<SearchDirectory>& directories,
+                              size_t parent) {
+  for (size_t i = 0; i < directories[parent].entries.size(); i++) {
+    const SearchDirectory& directory = directories[parent];
+    if (directory.entries[i].is_directory) {
+      SearchDirectory subdirectory;
+      subdirectory.path = AddTrailingSlash(directory.path) +
+                          directory.entries[i].name;
+      directories[parent].entries[i].directory = directories.size();
+      directories.push_back(subdirectory);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
 FileSearchHelper::FileSearchHelper()
-    : minimum_file_size_(0),
+    : cache_only_(false),
+      directory_cache_(nullptr),
+      minimum_file_size_(0),
+      read_whole_tree_(false),
       skip_directories_(false),
       skip_files_(false),
       skip_subdirectories_(false) {
@@ -33,45 +209,142 @@ bool FileSearchHelper::Search(const std::wstring& root) {
   if (skip_directories_ && skip_files_)
     return false;
 
-  std::wstring path = AddTrailingSlash(GetExtendedLengthPath(root)) + L"*";
-  bool result = false;
+  std::vector<SearchDirectory> directories(1);
+  directories.front().path = root;
+  ReadDirectories(*this, directories, 0, 1, directory_cache_, cache_only_,
+                  skip_files_, minimum_file_size_);
+  if (!directories.front().readable)
+    return false;
 
-  WIN32_FIND_DATA find_data;
-  HANDLE handle = FindFirstFile(path.c_str(), &find_data);
+  if (read_whole_tree_)
+    return SearchTree(directories);
 
-  do {
-    if (handle == INVALID_HANDLE_VALUE) {
-      LOG(LevelError, Logger::FormatError(GetLastError()));
-      LOG(LevelError, L"Path: " + path);
-      SetLastError(ERROR_SUCCESS);
-      return false;
+  // Directories are read as the search reaches them, so that nothing more is
+  // read once a match is found. The subdirectories of a directory are read in
+  // parallel before it is visited.
+  auto read_subdirectories = [&](size_t parent) {
+    if (skip_subdirectories_)
+      return;
+    size_t begin = directories.size();
+    AddSubdirectories(directories, parent);
+    ReadDirectories(*this, directories, begin, directories.size(),
+                    directory_cache_, cache_only_, skip_files_,
+                    minimum_file_size_);
+  };
+  read_subdirectories(0);
+
+  std::vector<std::pair<size_t, size_t>> stack(1, std::make_pair(0, 0));
+  while (!stack.empty()) {
+    size_t directory_index = stack.back().first;
+    size_t entry_index = stack.back().second;
+    if (entry_index == directories[directory_index].entries.size()) {
+      std::vector<SearchEntry>().swap(directories[directory_index].entries);
+      stack.pop_back();
+      continue;
     }
+    stack.back().second++;
+
+    // Files of a directory are handed to OnFiles before they are visited
+    if (entry_index == 0 && !skip_files_) {
+      const auto& directory = directories[directory_index];
+      std::vector<std::wstring> paths;
+      foreach_c_(entry, directory.entries)
+        if (!entry->is_directory)
+          paths.push_back(AddTrailingSlash(directory.path) + entry->name);
+      if (!paths.empty())
+        OnFiles(paths);
+    }
+
+    const auto& directory = directories[directory_index];
+    const auto& entry = directory.entries[entry_index];
 
     // Directory
-    if (IsDirectory(find_data)) {
-      if (IsValidDirectory(find_data)) {
-        if (!skip_directories_)
-          result = OnDirectory(root, find_data.cFileName);
-        if (!skip_subdirectories_ && !result)
-          result = Search(AddTrailingSlash(root) + find_data.cFileName);
+    if (entry.is_directory) {
+      if (!skip_directories_ && OnDirectory(directory.path, entry.name))
+        return true;
+      size_t subdirectory = entry.directory;
+      if (!skip_subdirectories_ && directories[subdirectory].readable) {
+        read_subdirectories(subdirectory);
+        stack.push_back(std::make_pair(subdirectory, 0));
       }
 
     // File
-    } else if (!skip_files_) {
-      if (find_data.nFileSizeLow < minimum_file_size_) {
-        LOG(LevelDebug,
-            L"File is ignored because its size does not meet the threshold.");
-        LOG(LevelDebug,
-            L"Path: " + AddTrailingSlash(root) + find_data.cFileName);
-        continue;
+    } else {
+      if (OnFile(directory.path, entry.name))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+bool FileSearchHelper::SearchTree(std::vector<SearchDirectory>& directories) {
+  // Read the whole tree first, one level at a time. Directories of a level are
+  // read in parallel, and each worker picks the next one as soon as it is done.
+  size_t level_begin = 0;
+  while (!skip_subdirectories_ && level_begin < directories.size()) {
+    size_t level_end = directories.size();
+    for (size_t i = level_begin; i < level_end; i++)
+      AddSubdirectories(directories, i);
+    ReadDirectories(*this, directories, level_end, directories.size(),
+                    directory_cache_, cache_only_, skip_files_,
+                    minimum_file_size_);
+    level_begin = level_end;
+  }
+
+  // Entries are then visited in the same depth-first order as a recursive
+  // search would, so that the first match is still the one that is returned
+  std::vector<std::pair<size_t, size_t>> visits;
+  std::vector<std::pair<size_t, size_t>> stack(1, std::make_pair(0, 0));
+  while (!stack.empty()) {
+    auto& position = stack.back();
+    const auto& directory = directories[position.first];
+    if (position.second == directory.entries.size()) {
+      stack.pop_back();
+      continue;
+    }
+    const auto& entry = directory.entries[position.second];
+    visits.push_back(position);
+    position.second++;
+    if (entry.is_directory && !skip_subdirectories_ &&
+        directories[entry.directory].readable)
+      stack.push_back(std::make_pair(entry.directory, 0));
+  }
+
+  size_t next_batch = 0;
+  for (size_t i = 0; i < visits.size(); i++) {
+    const auto& directory = directories[visits[i].first];
+    const auto& entry = directory.entries[visits[i].second];
+    bool result = false;
+
+    // Directory
+    if (entry.is_directory) {
+      if (!skip_directories_)
+        result = OnDirectory(directory.path, entry.name);
+
+    // File
+    } else {
+      if (i >= next_batch) {
+        std::vector<std::wstring> paths;
+        for (next_batch = i; next_batch < visits.size() &&
+                             paths.size() < kFileBatchSize; next_batch++) {
+          const auto& visit = visits[next_batch];
+          const auto& next_directory = directories[visit.first];
+          const auto& next_entry = next_directory.entries[visit.second];
+          if (!next_entry.is_directory)
+            paths.push_back(AddTrailingSlash(next_directory.path) +
+                            next_entry.name);
+        }
+        OnFiles(paths);
       }
-      result = OnFile(root, find_data.cFileName);
+      result = OnFile(directory.path, entry.name);
     }
 
-  } while (!result && FindNextFile(handle, &find_data));
+    if (result)
+      return true;
+  }
 
-  FindClose(handle);
-  return result;
+  return false;
 }
 
 bool FileSearchHelper::OnDirectory(const std::wstring& root,
@@ -84,6 +357,25 @@ bool FileSearchHelper::OnFile(const std::wstring& root,
   return false;
 }
 
+void FileSearchHelper::OnFiles(const std::vector<std::wstring>& paths) {
+}
+
+bool FileSearchHelper::IsCandidateFile(const std::wstring& name) const {
+  return true;
+}
+
+void FileSearchHelper::set_cache_only(bool cache_only) {
+  cache_only_ = cache_only;
+}
+
+void FileSearchHelper::set_directory_cache(DirectoryCache* directory_cache) {
+  directory_cache_ = directory_cache;
+}
+
+void FileSearchHelper::set_read_whole_tree(bool read_whole_tree) {
+  read_whole_tree_ = read_whole_tree;
+}
+
 void FileSearchHelper::set_skip_directories(bool skip_directories) {
   skip_directories_ = skip_directories;
 }
@@ -94,4 +386,145 @@ void FileSearchHelper::set_skip_files(bool skip_files) {
 
 void FileSearchHelper::set_skip_subdirectories(bool skip_subdirectories) {
   skip_subdirectories_ = skip_subdirectories;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::wstring GetListingKey(const std::wstring& path) {
+  // Paths are compared the way that the file system would
+  std::wstring key = path;
+  while (!key.empty() &&
+         (key[key.size() - 1] == L'\\' || key[key.size() - 1] == L'/'))
+    key.resize(key.size() - 1);
+  ToLower(key);
+  return key;
+}
+
+DirectoryCache::DirectoryCache()
+    : modified_(false) {
+}
+
+void DirectoryCache::Clear() {
+  if (!listings_.empty())
+    modified_ = true;
+  listings_.clear();
+}
+
+const DirectoryCache::Listing* DirectoryCache::Find(
+    const std::wstring& path) const {
+  auto it = listings_.find(GetListingKey(path));
+  return it != listings_.end() ? &it->second : nullptr;
+}
+
+void DirectoryCache::Set(const std::wstring& path, const Listing& listing) {
+  std::wstring key = GetListingKey(path);
+
+  // Subdirectories that are gone are removed along with their own listings
+  auto it = listings_.find(key);
+  if (it != listings_.end()) {
+    foreach_c_(entry, it->second.entries) {
+      if (!entry->is_directory)
+        continue;
+      bool found = false;
+      foreach_c_(new_entry, listing.entries) {
+        if (new_entry->is_directory && IsEqual(new_entry->name, entry->name)) {
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        Remove(key + L"\\" + GetListingKey(entry->name));
+    }
+  }
+
+  listings_[key] = listing;
+  modified_ = true;
+}
+
+void DirectoryCache::Remove(const std::wstring& key) {
+  auto it = listings_.find(key);
+  if (it == listings_.end())
+    return;
+
+  std::vector<std::wstring> subdirectories;
+  foreach_c_(entry, it->second.entries)
+    if (entry->is_directory)
+      subdirectories.push_back(key + L"\\" + GetListingKey(entry->name));
+
+  listings_.erase(it);
+  modified_ = true;
+
+  foreach_c_(subdirectory, subdirectories)
+    Remove(*subdirectory);
+}
+
+// Smallest serialized entry: name length, is_directory and size
+static const size_t kMinEntrySize = sizeof(UINT32) + sizeof(BYTE) +
+                                    sizeof(QWORD);
+
+bool DirectoryCache::Read(BinaryReader& reader) {
+  listings_.clear();
+
+  UINT32 count = 0;
+  if (!reader.Read(count))
+    return false;
+
+  bool failed = false;
+
+  for (UINT32 i = 0; i < count; ++i) {
+    std::wstring key;
+    Listing listing;
+    UINT32 entry_count = 0;
+    if (!reader.ReadString(key) || !reader.Read(listing.write_time) ||
+        !reader.Read(entry_count))
+      break;
+    // A corrupt count must not make us allocate more entries than the
+    // remaining data could possibly hold
+    if (entry_count > reader.remaining() / kMinEntrySize) {
+      failed = true;
+      break;
+    }
+    listing.entries.resize(entry_count);
+    foreach_(entry, listing.entries) {
+      BYTE is_directory = 0;
+      if (!reader.ReadString(entry->name) || !reader.Read(is_directory) ||
+          !reader.Read(entry->size))
+        break;
+      entry->is_directory = is_directory != 0;
+    }
+    if (reader.failed())
+      break;
+    listings_[key] = listing;
+  }
+
+  if (reader.failed())
+    failed = true;
+  if (failed)
+    listings_.clear();
+
+  modified_ = failed;
+  return !failed;
+}
+
+void DirectoryCache::Write(BinaryWriter& writer) const {
+  writer.Write(static_cast<UINT32>(listings_.size()));
+
+  foreach_c_(it, listings_) {
+    writer.WriteString(it->first);
+    writer.Write(it->second.write_time);
+    writer.Write(static_cast<UINT32>(it->second.entries.size()));
+    foreach_c_(entry, it->second.entries) {
+      writer.WriteString(entry->name);
+      writer.Write(static_cast<BYTE>(entry->is_directory ? 1 : 0));
+      writer.Write(entry->size);
+    }
+  }
+}
+
+bool DirectoryCache::modified() const {
+  return modified_;
+}
+
+void DirectoryCache::set_modified(bool modified) {
+  modified_ = modified;
 }
\ No newline at end of file
@@ -16,12 +16,102 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <windows.h>
-
 #include <zlib/zlib.h>
 
 #include "gzip.h"
 
+GzipStream::GzipStream()
+    : finished_(false), raw_(false), stream_(nullptr) {
+}
+
+GzipStream::~GzipStream() {
+  Reset();
+}
+
+bool GzipStream::Initialize(int window_bits) {
+  Reset();
+
+  stream_ = new z_stream;
+  stream_->zalloc = Z_NULL;
+  stream_->zfree = Z_NULL;
+  stream_->opaque = Z_NULL;
+  stream_->next_in = Z_NULL;
+  stream_->avail_in = 0;
+
+  if (inflateInit2(stream_, window_bits) != Z_OK) {
+    delete stream_;
+    stream_ = nullptr;
+    return false;
+  }
+
+  raw_ = window_bits < 0;
+  return true;
+}
+
+void GzipStream::Reset() {
+  if (stream_) {
+    inflateEnd(stream_);
+    delete stream_;
+    stream_ = nullptr;
+  }
+
+  finished_ = false;
+  raw_ = false;
+}
+
+bool GzipStream::Uncompress(const char* data, size_t size,
+                            std::string& output) {
+  // Both gzip and zlib headers are detected automatically
+  if (!stream_ && !Initialize(MAX_WBITS + 32))
+    return false;
+
+  // Anything after the end of the stream is ignored
+  if (finished_)
+    return true;
+
+  uLong total_in = stream_->total_in;
+  size_t output_size = output.size();
+  stream_->next_in = (Bytef*)data;
+  stream_->avail_in = static_cast<uInt>(size);
+
+  char buffer[16384];
+
+  do {
+    stream_->next_out = (Bytef*)buffer;
+    stream_->avail_out = sizeof(buffer);
+    int status = inflate(stream_, Z_NO_FLUSH);
+
+    // Some servers send raw deflate data without a zlib header. The input is
+    // decoded again from the start, so output of this call is discarded.
+    if (status == Z_DATA_ERROR && !raw_ && total_in == 0) {
+      if (!Initialize(-MAX_WBITS))
+        return false;
+      output.resize(output_size);
+      return Uncompress(data, size, output);
+    }
+
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+      return false;
+
+    output.append(buffer, sizeof(buffer) - stream_->avail_out);
+
+    if (status == Z_STREAM_END) {
+      finished_ = true;
+      break;
+    }
+    if (status == Z_BUF_ERROR)
+      break;  // Needs more input
+  } while (stream_->avail_in > 0 || stream_->avail_out == 0);
+
+  return true;
+}
+
+bool GzipStream::finished() const {
+  return finished_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool UncompressGzippedFile(const std::string& file, std::string& output) {
   gzFile gzfile = gzopen(file.c_str(), "rb");
 
@@ -45,35 +135,10 @@ bool UncompressGzippedFile(const std::string& file, std::string& output) {
 }
 
 bool UncompressGzippedString(const std::string& input, std::string& output) {
-  z_stream stream;
-  stream.zalloc = Z_NULL;
-  stream.zfree = Z_NULL;
-  stream.opaque = NULL;
-  stream.total_out = 0;
-  stream.next_in = (BYTE*)&input[0];
-  stream.avail_in = input.length();
-
-  if (inflateInit2(&stream, MAX_WBITS + 32) != Z_OK)
-    return false;
-
-  size_t buffer_length = input.length() * 2;
-  char* buffer = (char*)GlobalAlloc(GMEM_ZEROINIT, buffer_length);
+  GzipStream stream;
 
-  size_t total_length = 0;
-  int status = Z_OK;
-
-  do {
-    stream.next_out = (BYTE*)buffer;
-    stream.avail_out = buffer_length;
-    status = inflate(&stream, Z_SYNC_FLUSH);
-    if (status == Z_OK || status == Z_STREAM_END) {
-      output.append(buffer, stream.total_out - total_length);
-      total_length = stream.total_out;
-    }
-  } while (status == Z_OK);
-
-  GlobalFree(buffer);
-  inflateEnd(&stream);
+  if (!stream.Uncompress(input.data(), input.size(), output))
+    return false;
 
-  return status == Z_STREAM_END;
+  return stream.finished();
 }
\ No newline at end of file
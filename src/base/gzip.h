@@ -21,6 +21,28 @@
 
 #include <string>
 
+struct z_stream_s;
+
+// Uncompresses gzip or deflate data piece by piece, as it arrives, so that the
+// compressed input never has to be kept in memory as a whole
+class GzipStream {
+public:
+  GzipStream();
+  ~GzipStream();
+
+  void Reset();
+  bool Uncompress(const char* data, size_t size, std::string& output);
+
+  bool finished() const;
+
+private:
+  bool Initialize(int window_bits);
+
+  bool finished_;
+  bool raw_;
+  z_stream_s* stream_;
+};
+
 bool UncompressGzippedFile(const std::string& file, std::string& output);
 bool UncompressGzippedString(const std::string& input, std::string& output);
 
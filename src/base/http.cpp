@@ -33,7 +33,7 @@ Request::Request()
 }
 
 Response::Response()
-    : code(0), parameter(0) {
+    : body_converted_(false), code(0), parameter(0) {
 }
 
 void Request::Clear() {
@@ -46,7 +46,18 @@ void Request::Clear() {
 void Response::Clear() {
   code = 0;
   header.clear();
-  body.clear();
+  data.clear();
+  body_.clear();
+  body_converted_ = false;
+}
+
+const std::wstring& Response::body() const {
+  if (!body_converted_) {
+    body_ = StrToWstr(data);
+    body_converted_ = true;
+  }
+
+  return body_;
 }
 
 Client::Client()
@@ -58,6 +69,7 @@ Client::Client()
       content_length_(0),
       current_length_(0),
       curl_handle_(nullptr),
+      download_file_(INVALID_HANDLE_VALUE),
       header_list_(nullptr),
       secure_transaction_(false),
       user_agent_(L"Mozilla/5.0") {
@@ -79,7 +91,7 @@ void Client::Cleanup(bool reuse) {
     if (reuse) {
       curl_easy_reset(curl_handle_);
     } else {
-      curl_easy_cleanup(curl_handle_);
+      engine_.ReleaseHandle(curl_handle_);
       curl_handle_ = nullptr;
     }
   }
@@ -87,10 +99,9 @@ void Client::Cleanup(bool reuse) {
     curl_slist_free_all(header_list_);
     header_list_ = nullptr;
   }
-  if (GetThreadHandle() &&
-      GetThreadId() != GetCurrentThreadId()) {
-    CloseThreadHandle();
-  }
+
+  // Discard incomplete downloads
+  CloseDownloadFile(false);
 
   // Clear request and response
   if (!reuse)
@@ -98,8 +109,9 @@ void Client::Cleanup(bool reuse) {
   response_.Clear();
 
   // Clear buffers
+  decode_buffer_.clear();
+  gzip_stream_.Reset();
   optional_data_.clear();
-  write_buffer_.clear();
 
   // Reset variables
   busy_ = false;
@@ -169,7 +181,14 @@ void Client::set_user_agent(const std::wstring& user_agent) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// The engine is defined after CurlGlobal, so that it is destroyed before
+// libcurl is cleaned up
 CurlGlobal Client::curl_global_;
+Engine Client::engine_;
+
+Engine& Client::engine() {
+  return engine_;
+}
 
 CurlGlobal::CurlGlobal()
     : initialized_(false) {
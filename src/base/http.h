@@ -19,7 +19,7 @@
 #ifndef TAIGA_BASE_HTTP_H
 #define TAIGA_BASE_HTTP_H
 
-// Each client will have its own thread
+// Transfers run on a shared I/O thread, instead of the calling thread
 #define TAIGA_HTTP_MULTITHREADED
 
 #ifdef _DEBUG
@@ -40,9 +40,11 @@
 
 #include <curl/curl.h>
 
+#include "gzip.h"
 #include "map.h"
 #include "url.h"
 #include "win/win_thread.h"
+#include "win/win_window.h"
 
 namespace base {
 namespace http {
@@ -51,6 +53,7 @@ typedef base::multimap<std::wstring, std::wstring> header_t;
 
 enum ContentEncoding {
   kContentEncodingNone,
+  kContentEncodingDeflate,
   kContentEncodingGzip
 };
 
@@ -80,13 +83,20 @@ public:
 
   void Clear();
 
+  // The body is converted from UTF-8 data on first access
+  const std::wstring& body() const;
+
   unsigned int code;
 
   header_t header;
-  std::wstring body;
+  std::string data;
 
   std::wstring uid;
   LPARAM parameter;
+
+private:
+  mutable std::wstring body_;
+  mutable bool body_converted_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -102,8 +112,59 @@ private:
   bool initialized_;
 };
 
-class Client : public win::Thread {
+class Client;
+
+// Runs the transfers of all clients on a single I/O thread, using the curl
+// multi interface. Easy handles are pooled, and connections are kept alive
+// between transfers to the same host. Completed transfers are handed back to
+// the thread that created the engine's window, which must run a message loop.
+class Engine : public win::Thread {
+public:
+  Engine();
+  ~Engine();
+
+  // I/O thread
+  DWORD ThreadProc();
+
+  // Main thread
+  CURL* AcquireHandle();
+  void ReleaseHandle(CURL* handle);
+  bool Add(Client& client);
+  void DispatchCompletions();
+  void Shutdown();
+
+private:
+  class Completion {
+  public:
+    Client* client;
+    CURLcode code;
+  };
+
+  class Window : public win::Window {
+  private:
+    void PreRegisterClass(WNDCLASSEX& wc);
+    void PreCreate(CREATESTRUCT& cs);
+    LRESULT WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+  };
+
+  bool Start();
+
+  win::CriticalSection critical_section_;
+  std::vector<Completion> completions_;
+  std::vector<CURL*> idle_handles_;
+  CURLM* multi_handle_;
+  std::vector<Client*> pending_clients_;
+  bool stopping_;
+  HANDLE wake_event_;
+  Window window_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class Client {
 public:
+  friend class Engine;
+
   Client();
   virtual ~Client();
 
@@ -128,13 +189,16 @@ public:
   void set_referer(const std::wstring& referer);
   void set_user_agent(const std::wstring& user_agent);
 
+  // Return true to take the data instead of having it added to the response.
+  // Called on the I/O thread, with uncompressed data.
+  virtual bool OnDataAvailable(const char* data, size_t size) { return false; }
   virtual void OnError(CURLcode error_code) {}
   virtual bool OnHeadersAvailable() { return false; }
   virtual bool OnProgress() { return false; }
   virtual void OnReadComplete() {}
   virtual bool OnRedirect(const std::wstring& address) { return false; }
 
-  DWORD ThreadProc();
+  static Engine& engine();
 
 protected:
   Request request_;
@@ -143,7 +207,6 @@ protected:
   ContentEncoding content_encoding_;
   curl_off_t content_length_;
   curl_off_t current_length_;
-  std::string write_buffer_;
 
   bool allow_reuse_;
   bool auto_redirect_;
@@ -161,21 +224,30 @@ private:
   static int DebugCallback(CURL*, curl_infotype, char*, size_t, void*);
   static int XferInfoFunction(void*, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
   int ProgressFunction(curl_off_t, curl_off_t);
+  bool WriteData(const char* data, size_t size);
+
+  bool OpenDownloadFile();
+  bool CloseDownloadFile(bool keep);
 
   bool Initialize();
   bool SetRequestOptions();
   bool SendRequest();
   bool Perform();
+  bool OnTransferComplete(CURLcode code);
 
   void BuildRequestHeader();
   bool GetResponseHeader(const std::wstring& header);
   bool ParseResponseHeader();
 
   static CurlGlobal curl_global_;
+  static Engine engine_;
   CURL* curl_handle_;
 
   bool busy_;
   bool cancel_;
+  std::string decode_buffer_;
+  HANDLE download_file_;
+  GzipStream gzip_stream_;
   curl_slist* header_list_;
   std::string optional_data_;
 };
@@ -51,11 +51,47 @@ size_t Client::WriteFunction(char* ptr, size_t size, size_t nmemb,
 
   size_t data_size = size * nmemb;
 
-  reinterpret_cast<std::string*>(userdata)->append(ptr, data_size);
+  auto client = reinterpret_cast<Client*>(userdata);
+
+  if (!client->WriteData(ptr, data_size))
+    return 0;  // Abort
 
   return data_size;
 }
 
+bool Client::WriteData(const char* data, size_t size) {
+  // Compressed data is inflated as it arrives
+  if (content_encoding_ != kContentEncodingNone) {
+    decode_buffer_.clear();
+    if (!gzip_stream_.Uncompress(data, size, decode_buffer_)) {
+      LOG(LevelError, L"Could not uncompress data. ID: " + request_.uid);
+      return false;
+    }
+    data = decode_buffer_.data();
+    size = decode_buffer_.size();
+    if (!size)
+      return true;
+  }
+
+  // Downloads are written straight to the file
+  if (!download_path_.empty()) {
+    if (download_file_ == INVALID_HANDLE_VALUE && !OpenDownloadFile())
+      return false;
+    DWORD bytes_written = 0;
+    if (!::WriteFile(download_file_, data, static_cast<DWORD>(size),
+                     &bytes_written, nullptr)) {
+      LOG(LevelError, L"Could not write to file: " + download_path_);
+      return false;
+    }
+    return true;
+  }
+
+  if (!OnDataAvailable(data, size))
+    response_.data.append(data, size);
+
+  return true;
+}
+
 int Client::ProgressFunction(curl_off_t dltotal, curl_off_t dlnow) {
   if (cancel_)
     return 1;  // Abort
@@ -82,7 +118,7 @@ int Client::DebugCallback(CURL* curl, curl_infotype infotype, char* data,
   if (infotype == CURLINFO_DATA_IN || infotype == CURLINFO_DATA_OUT) {
     if (client) {
       auto client_ = reinterpret_cast<Client*>(client);
-      if (client_->content_encoding_ == kContentEncodingGzip)
+      if (client_->content_encoding_ != kContentEncodingNone)
         return 0;
     }
   }
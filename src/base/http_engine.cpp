@@ -0,0 +1,249 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "foreach.h"
+#include "http.h"
+#include "log.h"
+#include "string.h"
+
+#define WM_HTTPCALLBACK (WM_APP + 0x33)
+
+namespace base {
+namespace http {
+
+// Same limits as HttpManager applies, for transfers that are started directly
+const long kMaxConnections = 10;
+const long kMaxHostConnections = 6;
+// Number of idle connections that are kept alive for later transfers
+const long kMaxCachedConnections = 20;
+// Number of easy handles that are kept for later transfers
+const size_t kMaxIdleHandles = 16;
+// How long the I/O thread waits for socket activity before it checks for new
+// transfers again
+const int kPollInterval = 50;  // milliseconds
+
+Engine::Engine()
+    : multi_handle_(nullptr),
+      stopping_(false),
+      wake_event_(nullptr) {
+}
+
+Engine::~Engine() {
+  Shutdown();
+
+  foreach_(it, idle_handles_)
+    curl_easy_cleanup(*it);
+  idle_handles_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CURL* Engine::AcquireHandle() {
+  if (idle_handles_.empty())
+    return curl_easy_init();
+
+  CURL* handle = idle_handles_.back();
+  idle_handles_.pop_back();
+  return handle;
+}
+
+void Engine::ReleaseHandle(CURL* handle) {
+  if (idle_handles_.size() < kMaxIdleHandles) {
+    curl_easy_reset(handle);
+    idle_handles_.push_back(handle);
+  } else {
+    curl_easy_cleanup(handle);
+  }
+}
+
+bool Engine::Add(Client& client) {
+  if (!Start())
+    return false;
+
+  curl_easy_setopt(client.curl_handle_, CURLOPT_PRIVATE, &client);
+
+  {
+    win::Lock lock(critical_section_);
+    pending_clients_.push_back(&client);
+  }
+
+  SetEvent(wake_event_);
+  return true;
+}
+
+void Engine::DispatchCompletions() {
+  std::vector<Completion> completions;
+  {
+    win::Lock lock(critical_section_);
+    completions.swap(completions_);
+  }
+
+  foreach_(it, completions)
+    it->client->OnTransferComplete(it->code);
+}
+
+bool Engine::Start() {
+  if (GetThreadHandle())
+    return true;
+  if (stopping_)
+    return false;
+
+  if (!window_.GetWindowHandle() && !window_.Create()) {
+    LOG(LevelError, L"Could not create the HTTP engine window.");
+    return false;
+  }
+
+  multi_handle_ = curl_multi_init();
+  if (!multi_handle_)
+    return false;
+  curl_multi_setopt(multi_handle_, CURLMOPT_MAXCONNECTS,
+                    kMaxCachedConnections);
+  curl_multi_setopt(multi_handle_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    kMaxConnections);
+  curl_multi_setopt(multi_handle_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    kMaxHostConnections);
+
+  wake_event_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+  if (!wake_event_ || !CreateThread(nullptr, 0, 0)) {
+    LOG(LevelError, L"Could not start the HTTP engine.");
+    curl_multi_cleanup(multi_handle_);
+    multi_handle_ = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+void Engine::Shutdown() {
+  if (!GetThreadHandle())
+    return;
+
+  // Transfers that are still running are abandoned
+  {
+    win::Lock lock(critical_section_);
+    stopping_ = true;
+  }
+  SetEvent(wake_event_);
+  WaitForSingleObject(GetThreadHandle(), INFINITE);
+  CloseThreadHandle();
+
+  curl_multi_cleanup(multi_handle_);
+  multi_handle_ = nullptr;
+  CloseHandle(wake_event_);
+  wake_event_ = nullptr;
+  window_.Destroy();
+
+  pending_clients_.clear();
+  completions_.clear();
+  stopping_ = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DWORD Engine::ThreadProc() {
+  std::vector<Client*> clients;
+  std::vector<CURL*> active_handles;
+
+  while (true) {
+    // Pick up new transfers
+    {
+      win::Lock lock(critical_section_);
+      if (stopping_)
+        break;
+      clients.swap(pending_clients_);
+    }
+    foreach_(it, clients) {
+      curl_multi_add_handle(multi_handle_, (*it)->curl_handle_);
+      active_handles.push_back((*it)->curl_handle_);
+    }
+    clients.clear();
+
+    int running_handles = 0;
+    while (curl_multi_perform(multi_handle_, &running_handles) ==
+           CURLM_CALL_MULTI_PERFORM)
+      continue;
+
+    // Hand completed transfers over to the main thread
+    bool completed = false;
+    int queued_messages = 0;
+    while (CURLMsg* message = curl_multi_info_read(multi_handle_,
+                                                   &queued_messages)) {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+      CURL* handle = message->easy_handle;
+      Completion completion;
+      completion.code = message->data.result;
+      char* client = nullptr;
+      curl_easy_getinfo(handle, CURLINFO_PRIVATE, &client);
+      completion.client = reinterpret_cast<Client*>(client);
+      curl_multi_remove_handle(multi_handle_, handle);
+      active_handles.erase(std::find(active_handles.begin(),
+                                     active_handles.end(), handle));
+      win::Lock lock(critical_section_);
+      completions_.push_back(completion);
+      completed = true;
+    }
+    if (completed)
+      window_.PostMessage(WM_HTTPCALLBACK);
+
+    // Wait for socket activity, or for new transfers while there are none
+    if (active_handles.empty()) {
+      WaitForSingleObject(wake_event_, INFINITE);
+    } else {
+      int numfds = 0;
+      curl_multi_wait(multi_handle_, nullptr, 0, kPollInterval, &numfds);
+      // There is nothing to wait on while a host name is being resolved
+      if (!numfds)
+        WaitForSingleObject(wake_event_, 10);
+    }
+  }
+
+  foreach_(it, active_handles)
+    curl_multi_remove_handle(multi_handle_, *it);
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Engine::Window::PreRegisterClass(WNDCLASSEX& wc) {
+  wc.lpszClassName = L"TaigaHttpW";
+}
+
+void Engine::Window::PreCreate(CREATESTRUCT& cs) {
+  // Message-only window
+  cs.hwndParent = HWND_MESSAGE;
+  cs.lpszName = L"Taiga HTTP";
+  cs.style = WS_POPUP;
+}
+
+LRESULT Engine::Window::WindowProc(HWND hwnd, UINT uMsg,
+                                   WPARAM wParam, LPARAM lParam) {
+  if (uMsg == WM_HTTPCALLBACK) {
+    Client::engine().DispatchCompletions();
+    return TRUE;
+  }
+
+  return WindowProcDefault(hwnd, uMsg, wParam, lParam);
+}
+
+}  // namespace http
+}  // namespace base
\ No newline at end of file
@@ -19,7 +19,6 @@
 #include "file.h"
 #include "foreach.h"
 #include "http.h"
-#include "gzip.h"
 #include "log.h"
 #include "string.h"
 #include "url.h"
@@ -63,7 +62,7 @@ bool Client::Initialize() {
     return false;
 
   if (!curl_handle_)
-    curl_handle_ = curl_easy_init();
+    curl_handle_ = engine_.AcquireHandle();
 
   return curl_handle_ != nullptr;
 }
@@ -90,7 +89,7 @@ bool Client::SetRequestOptions() {
   TAIGA_CURL_SET_OPTION(CURLOPT_HEADERDATA, this);
 
   TAIGA_CURL_SET_OPTION(CURLOPT_WRITEFUNCTION, WriteFunction);
-  TAIGA_CURL_SET_OPTION(CURLOPT_WRITEDATA, &write_buffer_);
+  TAIGA_CURL_SET_OPTION(CURLOPT_WRITEDATA, this);
 
   TAIGA_CURL_SET_OPTION(CURLOPT_NOPROGRESS, FALSE);
   TAIGA_CURL_SET_OPTION(CURLOPT_XFERINFOFUNCTION, XferInfoFunction);
@@ -99,6 +98,9 @@ bool Client::SetRequestOptions() {
   //////////////////////////////////////////////////////////////////////////////
   // Network options
 
+  // Transfers run on another thread, where signals can't be used for timeouts
+  TAIGA_CURL_SET_OPTION(CURLOPT_NOSIGNAL, TRUE);
+
   // Set URL
   std::wstring url = request_.url.Build();
   TAIGA_CURL_SET_OPTION(CURLOPT_URL, WstrToStr(url).c_str());
@@ -172,29 +174,25 @@ bool Client::SetRequestOptions() {
 
 bool Client::SendRequest() {
 #ifdef TAIGA_HTTP_MULTITHREADED
-  return CreateThread(nullptr, 0, 0);
+  return engine_.Add(*this);
 #else
   return Perform();
 #endif
 }
 
 bool Client::Perform() {
-  CURLcode code = curl_easy_perform(curl_handle_);
+  return OnTransferComplete(curl_easy_perform(curl_handle_));
+}
 
+bool Client::OnTransferComplete(CURLcode code) {
   if (code == CURLE_OK) {
-    if (!write_buffer_.empty()) {
-      if (content_encoding_ == kContentEncodingGzip) {
-        std::string compressed;
-        std::swap(write_buffer_, compressed);
-        UncompressGzippedString(compressed, write_buffer_);
-      }
-      response_.body = StrToWstr(write_buffer_);
+    // An empty response still leaves an empty file behind
+    if (!download_path_.empty()) {
+      if (download_file_ == INVALID_HANDLE_VALUE)
+        OpenDownloadFile();
+      CloseDownloadFile(true);
     }
 
-    if (!download_path_.empty())
-      SaveToFile((LPCVOID)&write_buffer_.front(), write_buffer_.size(),
-                 download_path_);
-
     OnReadComplete();
 
   } else if (code != CURLE_ABORTED_BY_CALLBACK) {
@@ -206,8 +204,43 @@ bool Client::Perform() {
   return code == CURLE_OK;
 }
 
-DWORD Client::ThreadProc() {
-  return Perform();
+////////////////////////////////////////////////////////////////////////////////
+
+// Data is written to a temporary file first, so that a failed download does
+// not replace a previous copy
+bool Client::OpenDownloadFile() {
+  std::wstring path = download_path_ + L".part";
+  download_file_ = OpenFileForGenericWrite(path);
+
+  if (download_file_ == INVALID_HANDLE_VALUE) {
+    LOG(LevelError, L"Could not create file: " + path);
+    return false;
+  }
+
+  return true;
+}
+
+bool Client::CloseDownloadFile(bool keep) {
+  if (download_file_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  ::CloseHandle(download_file_);
+  download_file_ = INVALID_HANDLE_VALUE;
+
+  std::wstring path = download_path_ + L".part";
+  if (!keep) {
+    ::DeleteFile(path.c_str());
+    return false;
+  }
+
+  if (!MoveFileEx(path.c_str(), download_path_.c_str(),
+                  MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    LOG(LevelError, L"Could not move file: " + path);
+    ::DeleteFile(path.c_str());
+    return false;
+  }
+
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -61,6 +61,8 @@ bool Client::ParseResponseHeader() {
     if (IsEqual(name, L"Content-Encoding")) {
       if (InStr(value, L"gzip") > -1) {
         content_encoding_ = kContentEncodingGzip;
+      } else if (InStr(value, L"deflate") > -1) {
+        content_encoding_ = kContentEncodingDeflate;
       } else {
         content_encoding_ = kContentEncodingNone;
       }
@@ -78,6 +80,7 @@ bool Client::ParseResponseHeader() {
   // Redirection
   if (!location.host.empty() && auto_redirect_) {
     content_encoding_ = kContentEncodingNone;
+    gzip_stream_.Reset();
     content_length_ = 0;
     current_length_ = 0;
     request_.url.host = location.host;
@@ -16,9 +16,6 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <iostream>
-#include <fstream>
-
 #include "foreach.h"
 #include "log.h"
 #include "string.h"
@@ -35,55 +32,160 @@ const char* SeverityLevels[] = {
   "Debug"
 };
 
+// Number of lines that can be waiting to be written
+const size_t kLogQueueCapacity = 4096;
+// The writer wakes up this often, or as soon as an error is logged or the
+// queue is half full
+const DWORD kLogFlushInterval = 500;  // milliseconds
+// The output file is renamed with a ".1" suffix, replacing the previous one,
+// once it grows beyond this size
+const QWORD kLogMaxFileSize = 4 * 1024 * 1024;
+
+enum LoggerStates {
+  kLoggerIdle,
+  kLoggerRunning,
+  kLoggerStopping,
+  kLoggerStopped
+};
+
 class Logger Logger;
 
+////////////////////////////////////////////////////////////////////////////////
+
+LogQueue::LogQueue(size_t capacity)
+    : slots_(capacity),
+      mask_(static_cast<LONG>(capacity - 1)),
+      pop_position_(0),
+      push_position_(0) {
+  for (size_t i = 0; i < slots_.size(); i++)
+    slots_[i].sequence = static_cast<LONG>(i);
+}
+
+bool LogQueue::Push(std::string& text) {
+  // Each slot carries the position that it can be written at next. A producer
+  // claims a slot by advancing the push position, fills it, then publishes it
+  // to the consumer by advancing the slot's sequence.
+  LONG position = push_position_;
+  Slot* slot = nullptr;
+  while (true) {
+    slot = &slots_[position & mask_];
+    LONG difference = static_cast<LONG>(
+        static_cast<ULONG>(slot->sequence) - static_cast<ULONG>(position));
+    if (difference == 0) {
+      LONG previous = InterlockedCompareExchange(&push_position_,
+                                                 position + 1, position);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (difference < 0) {
+      return false;  // Full
+    } else {
+      position = push_position_;
+    }
+  }
+
+  slot->text.swap(text);
+  InterlockedExchange(&slot->sequence, position + 1);
+  return true;
+}
+
+bool LogQueue::Pop(std::string& output) {
+  Slot& slot = slots_[pop_position_ & mask_];
+  if (slot.sequence != pop_position_ + 1)
+    return false;  // Empty, or the next slot is not published yet
+
+  output.append(slot.text);
+  std::string().swap(slot.text);
+  InterlockedExchange(&slot.sequence, pop_position_ + mask_ + 1);
+  pop_position_++;
+  return true;
+}
+
+size_t LogQueue::capacity() const {
+  return slots_.size();
+}
+
+size_t LogQueue::size() const {
+  // Only an estimate, as both positions can move while they are being read
+  return static_cast<size_t>(
+      static_cast<ULONG>(push_position_) - static_cast<ULONG>(pop_position_));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 Logger::Logger()
-    : severity_level_(LevelDebug) {
+    : dropped_count_(0),
+      file_handle_(INVALID_HANDLE_VALUE),
+      file_size_(0),
+      queue_(kLogQueueCapacity),
+      severity_level_(LevelDebug),
+      state_(kLoggerIdle),
+      wake_event_(nullptr) {
+}
+
+Logger::~Logger() {
+  Shutdown();
+}
+
+bool Logger::IsEnabled(int severity_level) const {
+  return severity_level <= severity_level_;
 }
 
 void Logger::Log(int severity_level, const std::wstring& file, int line,
                  const std::wstring& function, std::wstring text) {
-  win::Lock lock(critical_section_);
+  if (!IsEnabled(severity_level))
+    return;
+
+  Trim(text, L" \r\n");
 
-  if (severity_level <= severity_level_) {
-    Trim(text, L" \r\n");
-
-    std::string output_text;
-
-    output_text += WstrToStr(std::wstring(GetDate()) + L" " + GetTime() + L" ");
-    output_text += "[" + std::string(SeverityLevels[severity_level]) + "] ";
-    output_text += WstrToStr(GetFileName(file) + L":" + ToWstr(line) + L" " + function + L" | ");
-
-    std::string padding(output_text.length(), ' ');
-    std::vector<std::wstring> lines;
-    Split(text, L"\r\n", lines);
-    foreach_(it, lines) {
-      Trim(*it);
-      if (!it->empty()) {
-        if (it != lines.begin())
-          output_text += padding;
-        output_text += WstrToStr(*it + L"\r\n");
-      }
+  std::string output_text;
+
+  output_text += WstrToStr(std::wstring(GetDate()) + L" " + GetTime() + L" ");
+  output_text += "[" + std::string(SeverityLevels[severity_level]) + "] ";
+  output_text += WstrToStr(GetFileName(file) + L":" + ToWstr(line) + L" " + function + L" | ");
+
+  std::string padding(output_text.length(), ' ');
+  std::vector<std::wstring> lines;
+  Split(text, L"\r\n", lines);
+  foreach_(it, lines) {
+    Trim(*it);
+    if (!it->empty()) {
+      if (it != lines.begin())
+        output_text += padding;
+      output_text += WstrToStr(*it + L"\r\n");
     }
+  }
 
 #ifdef _DEBUG
-    OutputDebugStringA(output_text.c_str());
+  OutputDebugStringA(output_text.c_str());
 #endif
 
-    if (!output_path_.empty()) {
-      std::ofstream stream;
-      stream.open(output_path_, std::ofstream::app |
-                                std::ios::binary |
-                                std::ofstream::out);
-      if (stream.is_open()) {
-        stream.write(output_text.c_str(), output_text.size());
-        stream.close();
-      }
-    }
+  if (output_path_.empty())
+    return;
+  if (state_ == kLoggerIdle)
+    StartWriter();
+
+  if (state_ == kLoggerStopped) {
+    // Without a writer thread, lines are written directly
+    win::Lock lock(critical_section_);
+    Write(output_text);
+    return;
+  }
+
+  if (!queue_.Push(output_text)) {
+    InterlockedIncrement(&dropped_count_);
+    return;
+  }
+
+  if (severity_level <= LevelError || queue_.size() >= queue_.capacity() / 2) {
+    win::Lock lock(critical_section_);
+    if (wake_event_)
+      SetEvent(wake_event_);
   }
 }
 
 void Logger::SetOutputPath(const std::wstring& path) {
+  win::Lock lock(critical_section_);
   output_path_ = path;
 }
 
@@ -91,6 +193,112 @@ void Logger::SetSeverityLevel(int severity_level) {
   severity_level_ = severity_level;
 }
 
+void Logger::Shutdown() {
+  {
+    win::Lock lock(critical_section_);
+    if (state_ != kLoggerRunning) {
+      if (state_ == kLoggerIdle)
+        state_ = kLoggerStopped;
+      return;
+    }
+    state_ = kLoggerStopping;
+    // The writer drains the queue before it exits
+    SetEvent(wake_event_);
+  }
+
+  WaitForSingleObject(GetThreadHandle(), INFINITE);
+  CloseThreadHandle();
+
+  win::Lock lock(critical_section_);
+  CloseHandle(wake_event_);
+  wake_event_ = nullptr;
+  state_ = kLoggerStopped;
+}
+
+void Logger::StartWriter() {
+  win::Lock lock(critical_section_);
+
+  if (state_ != kLoggerIdle)
+    return;
+
+  wake_event_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  if (wake_event_ && CreateThread(nullptr, 0, 0)) {
+    state_ = kLoggerRunning;
+  } else {
+    state_ = kLoggerStopped;
+  }
+}
+
+DWORD Logger::ThreadProc() {
+  std::string output;
+
+  while (true) {
+    bool stopping = state_ == kLoggerStopping;
+
+    while (queue_.Pop(output))
+      continue;
+
+    int dropped_count = InterlockedExchange(&dropped_count_, 0);
+    if (dropped_count > 0)
+      output += WstrToStr(std::wstring(GetDate()) + L" " + GetTime() +
+                          L" [Warning] " + ToWstr(dropped_count) +
+                          L" log messages were dropped\r\n");
+
+    if (!output.empty()) {
+      Write(output);
+      output.clear();
+    }
+
+    if (stopping)
+      break;
+
+    WaitForSingleObject(wake_event_, kLogFlushInterval);
+  }
+
+  if (file_handle_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_handle_);
+    file_handle_ = INVALID_HANDLE_VALUE;
+  }
+
+  return 0;
+}
+
+void Logger::Write(const std::string& output) {
+  std::wstring output_path;
+  {
+    win::Lock lock(critical_section_);
+    output_path = output_path_;
+  }
+
+  // The file is kept open between writes, and reopened if the path changes
+  if (file_handle_ != INVALID_HANDLE_VALUE &&
+      (file_path_ != output_path ||
+       file_size_ + output.size() > kLogMaxFileSize)) {
+    CloseHandle(file_handle_);
+    file_handle_ = INVALID_HANDLE_VALUE;
+    if (file_path_ == output_path)
+      MoveFileEx(file_path_.c_str(), (file_path_ + L".1").c_str(),
+                 MOVEFILE_REPLACE_EXISTING);
+  }
+
+  if (file_handle_ == INVALID_HANDLE_VALUE) {
+    file_path_ = output_path;
+    file_handle_ = CreateFile(file_path_.c_str(), FILE_APPEND_DATA,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle_ == INVALID_HANDLE_VALUE)
+      return;
+    LARGE_INTEGER file_size;
+    file_size_ = GetFileSizeEx(file_handle_, &file_size) ?
+        static_cast<QWORD>(file_size.QuadPart) : 0;
+  }
+
+  DWORD bytes_written = 0;
+  WriteFile(file_handle_, output.data(), static_cast<DWORD>(output.size()),
+            &bytes_written, nullptr);
+  file_size_ += bytes_written;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 std::wstring Logger::FormatError(DWORD error, LPCWSTR source) {
@@ -20,7 +20,9 @@
 #define TAIGA_BASE_LOG_H
 
 #include <string>
+#include <vector>
 
+#include "types.h"
 #include "win/win_thread.h"
 
 enum SeverityLevels {
@@ -34,29 +36,77 @@ enum SeverityLevels {
   LevelDebug
 };
 
-class Logger {
+// Bounded queue of formatted lines that any number of threads can push to
+// without locking, and a single thread pops from. Capacity must be a power of
+// two.
+class LogQueue {
+public:
+  LogQueue(size_t capacity);
+  ~LogQueue() {}
+
+  bool Push(std::string& text);
+  bool Pop(std::string& output);
+
+  size_t capacity() const;
+  size_t size() const;
+
+private:
+  class Slot {
+  public:
+    volatile LONG sequence;
+    std::string text;
+  };
+
+  std::vector<Slot> slots_;
+  LONG mask_;
+  volatile LONG pop_position_;
+  volatile LONG push_position_;
+};
+
+// Lines are formatted on the calling thread and queued, and a background
+// thread appends them to the output file in batches. When the queue is full,
+// lines are dropped instead of blocking the caller, and the number of dropped
+// lines is written in their place. After Shutdown, lines are written directly.
+class Logger : public win::Thread {
 public:
   Logger();
-  virtual ~Logger() {}
+  ~Logger();
 
+  DWORD ThreadProc();
+
+  bool IsEnabled(int severity_level) const;
   void Log(int severity_level, const std::wstring& file, int line,
            const std::wstring& function, std::wstring text);
   void SetOutputPath(const std::wstring& path);
   void SetSeverityLevel(int severity_level);
+  void Shutdown();
 
   static std::wstring FormatError(DWORD error, LPCWSTR source = nullptr);
 
 private:
+  void StartWriter();
+  void Write(const std::string& output);
+
   win::CriticalSection critical_section_;
+  volatile LONG dropped_count_;
+  HANDLE file_handle_;
+  std::wstring file_path_;
+  QWORD file_size_;
   std::wstring output_path_;
+  LogQueue queue_;
   int severity_level_;
+  volatile LONG state_;
+  HANDLE wake_event_;
 };
 
 extern class Logger Logger;
 
 #ifndef LOG
 #define LOG(level, text) \
-  Logger.Log(level, __FILEW__, __LINE__, __FUNCTIONW__, text)
+  do { \
+    if (Logger.IsEnabled(level)) \
+      Logger.Log(level, __FILEW__, __LINE__, __FUNCTIONW__, text); \
+  } while (false)
 #endif
 
 #endif  // TAIGA_BASE_LOG_H
\ No newline at end of file
@@ -20,7 +20,6 @@
 #include <functional>
 #include <iomanip>
 #include <locale>
-#include <map>
 #include <sstream>
 
 #include "string.h"
@@ -763,49 +762,65 @@ void ReadStringFromResource(LPCWSTR name, LPCWSTR type, wstring& output) {
 // included in the table. Note that characters in the table are listed by their
 // precedence.
 
-const wstring kCommonCharTable = L",_ .-+;&|~";
+const wchar_t kCommonCharTable[] = L",_ .-+;&|~";
+const size_t kCommonCharCount =
+    sizeof(kCommonCharTable) / sizeof(*kCommonCharTable) - 1;
 
 int GetCommonCharIndex(wchar_t c) {
-  for (size_t i = 0; i < kCommonCharTable.size(); i++)
-    if (kCommonCharTable.at(i) == c)
+  for (size_t i = 0; i < kCommonCharCount; i++)
+    if (kCommonCharTable[i] == c)
       return i;
 
   return -1;
 }
 
-wchar_t GetMostCommonCharacter(wstring str) {
-  Trim(str);
+wchar_t GetMostCommonCharacter(const wstring& str) {
+  // Leading and trailing spaces are not taken into account
+  size_t index_begin = str.find_first_not_of(L' ');
+  if (index_begin == wstring::npos)
+    return L'\0';
+  size_t index_end = str.find_last_not_of(L' ') + 1;
 
-  std::map<wchar_t, int> frequency;
+  int frequency[kCommonCharCount] = {0};
 
-  for (auto it = str.begin(); it != str.end(); ++it) {
-    if (IsAlphanumeric(*it))
+  for (size_t i = index_begin; i < index_end; i++) {
+    if (IsAlphanumeric(str[i]))
       continue;
-    if (GetCommonCharIndex(*it) == -1)
+    int index = GetCommonCharIndex(str[i]);
+    if (index == -1)
       continue;
 
-    frequency[*it] += 1;
+    frequency[index] += 1;
   }
 
+  // Characters are compared in ascending order of their values
+  wchar_t characters[kCommonCharCount];
+  std::copy(kCommonCharTable, kCommonCharTable + kCommonCharCount, characters);
+  std::sort(characters, characters + kCommonCharCount);
+
   wchar_t most_common_char = L'\0';
 
-  for (auto it = frequency.begin(); it != frequency.end(); ++it) {
+  for (size_t i = 0; i < kCommonCharCount; i++) {
+    int index = GetCommonCharIndex(characters[i]);
+    if (frequency[index] == 0)
+      continue;
+
     if (most_common_char == L'\0') {
-      most_common_char = it->first;
+      most_common_char = characters[i];
       continue;
     }
 
-    int character_distance = GetCommonCharIndex(it->first) -
-                             GetCommonCharIndex(most_common_char);
+    int character_distance = index - GetCommonCharIndex(most_common_char);
     if (character_distance < 0) {
-      most_common_char = it->first;
+      most_common_char = characters[i];
       continue;
     }
 
-    float frequency_ratio = static_cast<float>(it->second) /
-                            static_cast<float>(frequency[most_common_char]);
+    float frequency_ratio =
+        static_cast<float>(frequency[index]) /
+        static_cast<float>(frequency[GetCommonCharIndex(most_common_char)]);
     if (frequency_ratio / character_distance > 0.8f) {
-      most_common_char = it->first;
+      most_common_char = characters[i];
     }
   }
 
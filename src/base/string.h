@@ -104,6 +104,6 @@ std::wstring PadChar(std::wstring str, const wchar_t ch, const size_t len);
 std::wstring PushString(const std::wstring& str1, const std::wstring& str2);
 void ReadStringFromResource(LPCWSTR name, LPCWSTR type, std::wstring& output);
 
-wchar_t GetMostCommonCharacter(std::wstring str);
+wchar_t GetMostCommonCharacter(const std::wstring& str);
 
 #endif  // TAIGA_BASE_STRING_H
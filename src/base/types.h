@@ -54,5 +54,6 @@ typedef base::http::Response HttpResponse;
 
 // 64-bit integral data type (quadword)
 typedef unsigned __int64 QWORD, *LPQWORD;
+#define MAKEQWORD(a, b) ((QWORD)(((QWORD)((DWORD)(a))) << 32 | ((DWORD)(b))))
 
 #endif  // TAIGA_BASE_TYPES_H
\ No newline at end of file
@@ -16,6 +16,11 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <unordered_map>
+
+#include <zlib/zlib.h>
+
+#include "base/binary.h"
 #include "base/file.h"
 #include "base/foreach.h"
 #include "base/log.h"
@@ -40,9 +45,35 @@ anime::Database AnimeDatabase;
 
 namespace anime {
 
+Database::Database()
+    : journal_size_(0), list_size_(0), items_version_(0), version_(0) {
+}
+
+unsigned int Database::GetVersion() const {
+  return version_;
+}
+
+unsigned int Database::GetItemsVersion() const {
+  return items_version_;
+}
+
 bool Database::LoadDatabase() {
+  version_++;
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeBinary);
+  std::wstring xml_path = taiga::GetPath(taiga::kPathDatabaseAnime);
+
+  // XML is imported only if the binary database does not exist yet, or fails
+  // validation
+  bool result = ReadDatabaseFile(path) || ImportDatabase(xml_path);
+
+  RebuildIdIndex();
+
+  return result;
+}
+
+bool Database::ImportDatabase(const std::wstring& path) {
   xml_document document;
-  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
   unsigned int options = pugi::parse_default & ~pugi::parse_eol;
   xml_parse_result parse_result = document.load_file(path.c_str(), options);
 
@@ -113,6 +144,14 @@ bool Database::SaveDatabase() {
   if (items.empty())
     return false;
 
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeBinary);
+  return WriteDatabaseFile(path);
+}
+
+bool Database::ExportDatabase(const std::wstring& path) {
+  if (items.empty())
+    return false;
+
   xml_document document;
 
   xml_node meta_node = document.append_child(L"meta");
@@ -121,7 +160,6 @@ bool Database::SaveDatabase() {
   xml_node database_node = document.append_child(L"database");
   WriteDatabaseNode(database_node);
 
-  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
   return XmlWriteDocumentToFile(document, path);
 }
 
@@ -177,6 +215,326 @@ void Database::WriteDatabaseNode(xml_node& database_node) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Binary database layout, with offsets relative to the start of the file:
+//
+//   DatabaseHeader
+//   DatabaseRecord[item_count]    Fixed-size item records
+//   UINT32[list_size]             Lists, each stored as a count and string IDs
+//   DatabaseString[string_count]  Offset and length of each string
+//   wchar_t[]                     String data, without terminators
+//
+// Strings are deduplicated. String 0 is always the empty string, and list 0 is
+// always the empty list. Bump the version whenever the layout changes.
+
+static const UINT32 kDatabaseMagic = 0x42444754;  // "TGDB"
+static const UINT32 kDatabaseVersion = 1;
+
+struct DatabaseHeader {
+  UINT32 magic;
+  UINT32 version;
+  UINT32 item_count;
+  UINT32 list_size;
+  UINT32 string_count;
+  UINT32 records_offset;
+  UINT32 lists_offset;
+  UINT32 strings_offset;
+  UINT32 string_data_offset;
+  UINT32 string_data_size;
+};
+
+struct DatabaseRecord {
+  INT64 modified;
+  INT32 id;
+  UINT32 ids[sync::kLastService + 1];
+  UINT32 source;
+  UINT32 slug;
+  UINT32 title;
+  UINT32 english;
+  UINT32 synonyms;
+  INT32 type;
+  INT32 status;
+  INT32 episode_count;
+  INT32 episode_length;
+  UINT32 date_start;
+  UINT32 date_end;
+  UINT32 image;
+  UINT32 genres;
+  UINT32 producers;
+  UINT32 score;
+  UINT32 popularity;
+  UINT32 synopsis;
+};
+
+struct DatabaseString {
+  UINT32 offset;
+  UINT32 length;
+};
+
+static UINT32 PackDate(const Date& date) {
+  return (date.year << 16) | (date.month << 8) | date.day;
+}
+
+static Date UnpackDate(UINT32 value) {
+  return Date(static_cast<unsigned short>(value >> 16),
+              static_cast<unsigned short>((value >> 8) & 0xFF),
+              static_cast<unsigned short>(value & 0xFF));
+}
+
+// Provides bounds-checked access to a mapped database file. Nothing is copied
+// out of the mapping until a string or a list is requested. Invalid references
+// put the reader into a failed state, and read as empty values.
+class DatabaseFileReader {
+public:
+  DatabaseFileReader(const BYTE* data, size_t size)
+      : data_(data), size_(size), header_(nullptr), failed_(false) {}
+
+  bool Validate() {
+    if (size_ < sizeof(DatabaseHeader))
+      return false;
+    header_ = reinterpret_cast<const DatabaseHeader*>(data_);
+    if (header_->magic != kDatabaseMagic ||
+        header_->version != kDatabaseVersion)
+      return false;
+    return IsInRange(header_->records_offset, header_->item_count,
+                     sizeof(DatabaseRecord)) &&
+           IsInRange(header_->lists_offset, header_->list_size,
+                     sizeof(UINT32)) &&
+           IsInRange(header_->strings_offset, header_->string_count,
+                     sizeof(DatabaseString)) &&
+           IsInRange(header_->string_data_offset, header_->string_data_size,
+                     sizeof(wchar_t)) &&
+           header_->list_size > 0 && header_->string_count > 0;
+  }
+
+  UINT32 item_count() const {
+    return header_->item_count;
+  }
+
+  const DatabaseRecord& record(UINT32 index) const {
+    return reinterpret_cast<const DatabaseRecord*>(
+        data_ + header_->records_offset)[index];
+  }
+
+  const std::wstring& ReadString(UINT32 index) {
+    ReadString(index, str_);
+    return str_;
+  }
+
+  const std::vector<std::wstring>& ReadList(UINT32 offset) {
+    const UINT32* lists = reinterpret_cast<const UINT32*>(
+        data_ + header_->lists_offset);
+    list_.clear();
+    if (offset >= header_->list_size ||
+        lists[offset] > header_->list_size - offset - 1) {
+      failed_ = true;
+      return list_;
+    }
+    list_.resize(lists[offset]);
+    for (UINT32 i = 0; i < lists[offset]; ++i)
+      ReadString(lists[offset + 1 + i], list_[i]);
+    return list_;
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+private:
+  bool IsInRange(UINT32 offset, UINT32 count, size_t element_size) const {
+    return offset <= size_ &&
+           count <= (size_ - offset) / element_size;
+  }
+
+  void ReadString(UINT32 index, std::wstring& str) {
+    str.clear();
+    if (index >= header_->string_count) {
+      failed_ = true;
+      return;
+    }
+    const DatabaseString& entry = reinterpret_cast<const DatabaseString*>(
+        data_ + header_->strings_offset)[index];
+    if (entry.offset > header_->string_data_size ||
+        entry.length > header_->string_data_size - entry.offset) {
+      failed_ = true;
+      return;
+    }
+    const wchar_t* string_data = reinterpret_cast<const wchar_t*>(
+        data_ + header_->string_data_offset);
+    str.assign(string_data + entry.offset, entry.length);
+  }
+
+  const BYTE* data_;
+  size_t size_;
+  const DatabaseHeader* header_;
+  bool failed_;
+  std::wstring str_;
+  std::vector<std::wstring> list_;
+};
+
+bool Database::ReadDatabaseFile(const std::wstring& path) {
+  FileMapping file;
+  if (!file.Open(path))
+    return false;
+
+  DatabaseFileReader reader(file.data(), file.size());
+  if (!reader.Validate()) {
+    LOG(LevelWarning, L"Invalid database file: " + path);
+    return false;
+  }
+
+  for (UINT32 i = 0; i < reader.item_count() && !reader.failed(); ++i) {
+    const DatabaseRecord& record = reader.record(i);
+
+    Item& item = items[record.id];  // Creates the item if it doesn't exist
+
+    for (int service = 0; service <= sync::kLastService; service++)
+      if (record.ids[service])
+        item.SetId(reader.ReadString(record.ids[service]), service);
+
+    item.SetSource(record.source);
+    item.SetSlug(reader.ReadString(record.slug));
+
+    item.SetTitle(reader.ReadString(record.title));
+    item.SetEnglishTitle(reader.ReadString(record.english));
+    item.SetSynonyms(reader.ReadList(record.synonyms));
+    item.SetType(record.type);
+    item.SetAiringStatus(record.status);
+    item.SetEpisodeCount(record.episode_count);
+    item.SetEpisodeLength(record.episode_length);
+    item.SetDateStart(UnpackDate(record.date_start));
+    item.SetDateEnd(UnpackDate(record.date_end));
+    item.SetImageUrl(reader.ReadString(record.image));
+    item.SetGenres(reader.ReadList(record.genres));
+    item.SetProducers(reader.ReadList(record.producers));
+    item.SetScore(reader.ReadString(record.score));
+    item.SetPopularity(reader.ReadString(record.popularity));
+    item.SetSynopsis(reader.ReadString(record.synopsis));
+    item.SetLastModified(static_cast<time_t>(record.modified));
+  }
+
+  if (reader.failed()) {
+    LOG(LevelError, L"Database file is corrupt: " + path);
+    items.clear();
+    RebuildIdIndex();
+    return false;
+  }
+
+  return true;
+}
+
+// Builds the string table and the lists of a database file
+class DatabaseFileWriter {
+public:
+  DatabaseFileWriter() {
+    AddString(EmptyString());
+    lists_.push_back(0);
+  }
+
+  UINT32 AddString(const std::wstring& str) {
+    auto it = string_ids_.find(str);
+    if (it != string_ids_.end())
+      return it->second;
+
+    DatabaseString entry;
+    entry.offset = static_cast<UINT32>(string_data_.size());
+    entry.length = static_cast<UINT32>(str.size());
+    strings_.push_back(entry);
+    string_data_.append(str);
+
+    UINT32 id = static_cast<UINT32>(strings_.size() - 1);
+    string_ids_.insert(std::make_pair(str, id));
+    return id;
+  }
+
+  UINT32 AddList(const std::vector<std::wstring>& list) {
+    if (list.empty())
+      return 0;
+
+    UINT32 offset = static_cast<UINT32>(lists_.size());
+    lists_.push_back(static_cast<UINT32>(list.size()));
+    foreach_c_(it, list)
+      lists_.push_back(AddString(*it));
+    return offset;
+  }
+
+  void AddRecord(const DatabaseRecord& record) {
+    records_.push_back(record);
+  }
+
+  void Write(BinaryWriter& writer) const {
+    DatabaseHeader header;
+    header.magic = kDatabaseMagic;
+    header.version = kDatabaseVersion;
+    header.item_count = static_cast<UINT32>(records_.size());
+    header.list_size = static_cast<UINT32>(lists_.size());
+    header.string_count = static_cast<UINT32>(strings_.size());
+    header.string_data_size = static_cast<UINT32>(string_data_.size());
+    header.records_offset = sizeof(DatabaseHeader);
+    header.lists_offset = header.records_offset +
+        header.item_count * sizeof(DatabaseRecord);
+    header.strings_offset = header.lists_offset +
+        header.list_size * sizeof(UINT32);
+    header.string_data_offset = header.strings_offset +
+        header.string_count * sizeof(DatabaseString);
+
+    writer.Write(header);
+    if (!records_.empty())
+      writer.WriteBytes(&records_.front(), records_.size() * sizeof(DatabaseRecord));
+    writer.WriteBytes(&lists_.front(), lists_.size() * sizeof(UINT32));
+    writer.WriteBytes(&strings_.front(), strings_.size() * sizeof(DatabaseString));
+    writer.WriteBytes(string_data_.data(), string_data_.size() * sizeof(wchar_t));
+  }
+
+private:
+  std::vector<DatabaseRecord> records_;
+  std::vector<UINT32> lists_;
+  std::vector<DatabaseString> strings_;
+  std::wstring string_data_;
+  std::unordered_map<std::wstring, UINT32> string_ids_;
+};
+
+bool Database::WriteDatabaseFile(const std::wstring& path) {
+  DatabaseFileWriter file;
+
+  foreach_(it, items) {
+    const Item& item = it->second;
+
+    DatabaseRecord record = {0};
+
+    record.modified = static_cast<INT64>(item.GetLastModified());
+    record.id = it->first;
+    for (int service = 0; service <= sync::kLastService; service++)
+      record.ids[service] = file.AddString(item.GetId(service));
+    record.source = item.GetSource();
+    record.slug = file.AddString(item.GetSlug());
+    record.title = file.AddString(item.GetTitle());
+    record.english = file.AddString(item.GetEnglishTitle());
+    record.synonyms = file.AddList(item.GetSynonyms());
+    record.type = item.GetType();
+    record.status = item.GetAiringStatus();
+    record.episode_count = item.GetEpisodeCount();
+    record.episode_length = item.GetEpisodeLength();
+    record.date_start = PackDate(item.GetDateStart());
+    record.date_end = PackDate(item.GetDateEnd());
+    record.image = file.AddString(item.GetImageUrl());
+    record.genres = file.AddList(item.GetGenres());
+    record.producers = file.AddList(item.GetProducers());
+    record.score = file.AddString(item.GetScore());
+    record.popularity = file.AddString(item.GetPopularity());
+    record.synopsis = file.AddString(item.GetSynopsis());
+
+    file.AddRecord(record);
+  }
+
+  BinaryWriter writer;
+  file.Write(writer);
+
+  return SaveToFile(writer.buffer().data(), static_cast<DWORD>(writer.size()),
+                    path);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 Item* Database::FindItem(int id) {
   if (id > ID_UNKNOWN) {
     auto it = items.find(id);
@@ -188,11 +546,22 @@ Item* Database::FindItem(int id) {
 }
 
 Item* Database::FindItem(const std::wstring& id, enum_t service) {
-  if (!id.empty())
-    foreach_(it, items)
-      if (id == it->second.GetId(service))
-        return &it->second;
+  if (id.empty())
+    return nullptr;
+
+  if (service < id_index_.size()) {
+    auto it = id_index_[service].find(id);
+    if (it != id_index_[service].end()) {
+      // Entries are left behind when items are removed or replaced, so they
+      // must be verified before use
+      auto anime_item = FindItem(it->second);
+      if (anime_item && anime_item->GetId(service) == id)
+        return anime_item;
+    }
+  }
 
+  // The index is rebuilt whenever items are loaded or removed, and kept up to
+  // date by Item::SetId otherwise, so a miss means that there is no such item
   return nullptr;
 }
 
@@ -222,9 +591,47 @@ Item* Database::FindSequel(int anime_id) {
   return FindItem(sequel_id);
 }
 
+void Database::RebuildIdIndex() {
+  // The index is rebuilt wherever items are loaded, replaced or removed
+  items_version_++;
+
+  id_index_.clear();
+  id_index_.resize(sync::kLastService + 1);
+
+  foreach_(it, items)
+    for (enum_t service = sync::kTaiga; service <= sync::kLastService; service++)
+      if (!it->second.GetId(service).empty())
+        id_index_[service][it->second.GetId(service)] = it->first;
+}
+
+void Database::UpdateIdIndex(const Item& item, enum_t service,
+                             const std::wstring& previous_id) {
+  // Items that are not in the database (e.g. those that are parsed from a
+  // service response before being merged) are not indexed
+  int anime_id = item.GetId();
+  if (FindItem(anime_id) != &item)
+    return;
+
+  if (service >= id_index_.size())
+    id_index_.resize(service + 1);
+  auto& index = id_index_[service];
+
+  if (!previous_id.empty()) {
+    auto it = index.find(previous_id);
+    if (it != index.end() && it->second == anime_id)
+      index.erase(it);
+  }
+
+  const std::wstring& id = item.GetId(service);
+  if (!id.empty())
+    index[id] = anime_id;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void Database::ClearInvalidItems() {
+  version_++;
+
   for (auto it = items.begin(); it != items.end(); ) {
     if (!it->second.GetId() || it->first != it->second.GetId()) {
       LOG(LevelDebug, L"ID: " + ToWstr(it->first));
@@ -233,9 +640,13 @@ void Database::ClearInvalidItems() {
       ++it;
     }
   }
+
+  RebuildIdIndex();
 }
 
 int Database::UpdateItem(const Item& new_item) {
+  version_++;
+
   Item* item = nullptr;
 
   for (enum_t i = sync::kTaiga; i <= sync::kLastService; i++) {
@@ -264,6 +675,7 @@ int Database::UpdateItem(const Item& new_item) {
     // Add a new item
     item = &items[id];
     item->SetId(ToWstr(id), sync::kTaiga);
+    items_version_++;
   }
 
   // Update series information if new information is, well, new.
@@ -391,10 +803,40 @@ bool Database::LoadList() {
     ReadListInCompatibilityMode(document);
   }
 
+  list_size_ = GetFileSize(path);
+  journal_size_ = 0;
+
+  // Changes that were made after the list was last saved are recovered from the
+  // journal. The list is saved right away, so that a partially written entry at
+  // the end of the journal cannot hide the entries that are appended later.
+  std::wstring journal_path = taiga::GetPath(taiga::kPathUserLibraryJournal);
+  if (FileExists(journal_path)) {
+    int entry_count = ReplayJournal(journal_path);
+    if (entry_count > 0)
+      LOG(LevelWarning, L"Recovered " + ToWstr(entry_count) +
+                        L" entries from the library journal");
+    SaveList();
+  }
+
+  RebuildIdIndex();
+
   return true;
 }
 
 bool Database::SaveList(bool include_database) {
+  std::wstring path = taiga::GetPath(taiga::kPathUserLibrary);
+  if (!ExportList(path, include_database))
+    return false;
+
+  // The list is now up to date, and the journal can be discarded
+  list_size_ = GetFileSize(path);
+  journal_size_ = 0;
+  ::DeleteFile(taiga::GetPath(taiga::kPathUserLibraryJournal).c_str());
+
+  return true;
+}
+
+bool Database::ExportList(const std::wstring& path, bool include_database) {
   if (items.empty())
     return false;
 
@@ -427,10 +869,190 @@ bool Database::SaveList(bool include_database) {
     }
   }
 
-  std::wstring path = taiga::GetPath(taiga::kPathUserLibrary);
   return XmlWriteDocumentToFile(document, path);
 }
 
+bool Database::SaveListEntry(int anime_id) {
+  std::wstring path = taiga::GetPath(taiga::kPathUserLibraryJournal);
+  size_t entry_size = AppendToJournal(path, anime_id);
+  if (!entry_size)
+    return SaveList();
+  journal_size_ += entry_size;
+
+  // Compacting once the journal outgrows the list keeps both the amortized cost
+  // of an update and the time it takes to replay the journal bounded
+  if (journal_size_ > list_size_)
+    return SaveList();
+
+  return true;
+}
+
+bool Database::CompactList() {
+  if (!journal_size_)
+    return true;
+
+  return SaveList();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Journal layout:
+//
+//   UINT32 magic, UINT32 version
+//   Entries, each stored as UINT32 size, UINT32 CRC-32 and the entry itself
+//
+// An entry holds the full user information of an item, so that replaying it
+// does not depend on any previous entry for the same item. Entries that fail
+// the checksum are assumed to be partially written, and end the replay.
+
+static const UINT32 kJournalMagic = 0x4E4A4754;  // "TGJN"
+static const UINT32 kJournalVersion = 1;
+
+enum JournalEntryType {
+  kJournalEntryUpdate = 1,
+  kJournalEntryDelete
+};
+
+// Returns false if the journal does not start with a valid header, which is
+// the case for a new journal, or one that was left empty or with a partial
+// header by an interrupted append.
+static bool HasValidJournalHeader(const std::wstring& path) {
+  FileMapping file;
+  if (!file.Open(path))
+    return GetFileSize(path) >= sizeof(kJournalMagic) + sizeof(kJournalVersion);
+
+  BinaryReader reader(file.data(), file.size());
+  UINT32 magic = 0, version = 0;
+  return reader.Read(magic) && magic == kJournalMagic &&
+         reader.Read(version) && version == kJournalVersion;
+}
+
+size_t Database::AppendToJournal(const std::wstring& path, int anime_id) {
+  auto anime_item = FindItem(anime_id);
+  if (!anime_item)
+    return 0;
+
+  BinaryWriter entry;
+  entry.Write(static_cast<INT32>(anime_id));
+  if (anime_item->IsInList()) {
+    entry.Write(static_cast<BYTE>(kJournalEntryUpdate));
+    entry.Write(static_cast<INT32>(anime_item->GetMyLastWatchedEpisode(false)));
+    entry.Write(static_cast<INT32>(anime_item->GetMyScore(false)));
+    entry.Write(static_cast<INT32>(anime_item->GetMyStatus(false)));
+    entry.Write(static_cast<INT32>(anime_item->GetMyRewatching(false)));
+    entry.Write(static_cast<INT32>(anime_item->GetMyRewatchingEp()));
+    entry.Write(PackDate(anime_item->GetMyDateStart(false)));
+    entry.Write(PackDate(anime_item->GetMyDateEnd(false)));
+    entry.WriteString(anime_item->GetMyTags(false));
+    entry.WriteString(anime_item->GetMyLastUpdated());
+  } else {
+    entry.Write(static_cast<BYTE>(kJournalEntryDelete));
+  }
+
+  // Appending to a journal without a valid header would only add entries that
+  // are rejected along with the rest of the journal on replay
+  BinaryWriter writer;
+  if (!HasValidJournalHeader(path)) {
+    if (FileExists(path)) {
+      LOG(LevelWarning, L"Recreating library journal: " + path);
+      ::DeleteFile(path.c_str());
+    }
+    writer.Write(kJournalMagic);
+    writer.Write(kJournalVersion);
+  }
+  writer.Write(static_cast<UINT32>(entry.size()));
+  writer.Write(static_cast<UINT32>(crc32(0L,
+      reinterpret_cast<const Bytef*>(entry.buffer().data()),
+      static_cast<uInt>(entry.size()))));
+  writer.WriteBytes(entry.buffer().data(), entry.size());
+
+  if (!AppendToFile(writer.buffer().data(), static_cast<DWORD>(writer.size()),
+                    path)) {
+    LOG(LevelError, L"Could not append to library journal: " + path);
+    return 0;
+  }
+
+  return writer.size();
+}
+
+int Database::ReplayJournal(const std::wstring& path) {
+  FileMapping file;
+  if (!file.Open(path))
+    return 0;
+
+  BinaryReader reader(file.data(), file.size());
+
+  UINT32 magic = 0, version = 0;
+  if (!reader.Read(magic) || magic != kJournalMagic ||
+      !reader.Read(version) || version != kJournalVersion) {
+    LOG(LevelError, L"Invalid library journal: " + path);
+    return 0;
+  }
+
+  int entry_count = 0;
+
+  while (!reader.eof()) {
+    UINT32 entry_size = 0, checksum = 0;
+    if (!reader.Read(entry_size) || !reader.Read(checksum) ||
+        entry_size > file.size() - reader.position())
+      break;
+
+    const BYTE* entry_data = file.data() + reader.position();
+    if (checksum != crc32(0L, entry_data, entry_size))
+      break;
+    reader.Skip(entry_size);
+
+    BinaryReader entry(entry_data, entry_size);
+    INT32 anime_id = 0;
+    BYTE type = 0;
+    if (!entry.Read(anime_id) || !entry.Read(type))
+      break;
+
+    auto anime_item = FindItem(anime_id);
+    if (!anime_item)
+      continue;
+
+    if (type == kJournalEntryDelete) {
+      anime_item->RemoveFromUserList();
+    } else if (type == kJournalEntryUpdate) {
+      INT32 progress = 0, score = 0, status = 0;
+      INT32 rewatching = 0, rewatching_ep = 0;
+      UINT32 date_start = 0, date_end = 0;
+      std::wstring tags, last_updated;
+      entry.Read(progress);
+      entry.Read(score);
+      entry.Read(status);
+      entry.Read(rewatching);
+      entry.Read(rewatching_ep);
+      entry.Read(date_start);
+      entry.Read(date_end);
+      entry.ReadString(tags);
+      entry.ReadString(last_updated);
+      if (entry.failed())
+        break;
+
+      if (!anime_item->IsInList())
+        anime_item->AddtoUserList();
+      anime_item->SetMyLastWatchedEpisode(progress);
+      anime_item->SetMyScore(score);
+      anime_item->SetMyStatus(status);
+      anime_item->SetMyRewatching(rewatching);
+      anime_item->SetMyRewatchingEp(rewatching_ep);
+      anime_item->SetMyDateStart(UnpackDate(date_start));
+      anime_item->SetMyDateEnd(UnpackDate(date_end));
+      anime_item->SetMyTags(tags);
+      anime_item->SetMyLastUpdated(last_updated);
+    }
+
+    entry_count++;
+  }
+
+  if (!reader.eof())
+    LOG(LevelWarning, L"Library journal ends with a partial entry: " + path);
+
+  return entry_count;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int Database::GetItemCount(int status, bool check_history) {
@@ -467,6 +1089,7 @@ void Database::AddToList(int anime_id, int status) {
   if (!anime_item)
     return;
 
+  version_++;
   anime_item->AddtoUserList();
 
   HistoryItem history_item;
@@ -479,12 +1102,14 @@ void Database::AddToList(int anime_id, int status) {
   history_item.mode = taiga::kHttpServiceAddLibraryEntry;
   History.queue.Add(history_item);
 
-  SaveList();
+  SaveListEntry(anime_id);
 
   ui::OnLibraryEntryAdd(anime_id);
 }
 
 void Database::ClearUserData() {
+  version_++;
+
   ui::DlgAnimeList.SetCurrentId(ID_UNKNOWN);
 
   foreach_(it, items)
@@ -499,6 +1124,7 @@ bool Database::DeleteListItem(int anime_id) {
   if (!anime_item->IsInList())
     return false;
 
+  version_++;
   anime_item->RemoveFromUserList();
 
   ui::ChangeStatusText(L"Item deleted. (" + anime_item->GetTitle() + L")");
@@ -513,6 +1139,8 @@ void Database::UpdateItem(const HistoryItem& history_item) {
   if (!anime_item)
     return;
 
+  version_++;
+
   // Edit episode
   if (history_item.episode) {
     anime_item->SetMyLastWatchedEpisode(*history_item.episode);
@@ -545,10 +1173,7 @@ void Database::UpdateItem(const HistoryItem& history_item) {
     DeleteListItem(anime_item->GetId());
   }
 
-  SaveList();
-
-  History.queue.Remove();
-  History.queue.Check(false);
+  SaveListEntry(history_item.anime_id);
 
   ui::OnLibraryEntryChange(history_item.anime_id);
 }
@@ -20,6 +20,8 @@
 #define TAIGA_LIBRARY_ANIME_DB_H
 
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #include "library/anime_item.h"
 
@@ -33,19 +35,51 @@ namespace anime {
 
 class Database {
 public:
+  Database();
+
   bool LoadDatabase();
   bool SaveDatabase();
 
+  // The database is stored in a binary format that is mapped into memory on
+  // load. XML is only imported when the binary file is missing or invalid
+  // (e.g. on the first run after an upgrade), and exported on request.
+  bool ReadDatabaseFile(const std::wstring& path);
+  bool WriteDatabaseFile(const std::wstring& path);
+  bool ImportDatabase(const std::wstring& path);
+  bool ExportDatabase(const std::wstring& path);
+
   Item* FindItem(int id);
   Item* FindItem(const std::wstring& id, enum_t service);
   Item* FindSequel(int anime_id);
 
+  // Items are indexed by their IDs on each service. The index is kept up to
+  // date by Item::SetId, and must be rebuilt if items are loaded, replaced as a
+  // whole or removed. Lookups trust the index and do not fall back to a scan.
+  void RebuildIdIndex();
+  void UpdateIdIndex(const Item& item, enum_t service, const std::wstring& previous_id);
+
   void ClearInvalidItems();
   int UpdateItem(const Item& item);
 
+  // Incremented whenever items are loaded, added to or removed from the list,
+  // or updated, so that results derived from them can be invalidated.
+  unsigned int GetVersion() const;
+  // Incremented whenever items are added to or removed from the database, so
+  // that indexes of all items can tell when they are incomplete.
+  unsigned int GetItemsVersion() const;
+
 public:
   bool LoadList();
   bool SaveList(bool include_database = false);
+  bool ExportList(const std::wstring& path, bool include_database = false);
+
+  // Changes to individual entries are appended to a journal, rather than
+  // rewriting the whole list. The journal is replayed on load, and compacted
+  // into the list by SaveList.
+  bool SaveListEntry(int anime_id);
+  bool CompactList();
+  size_t AppendToJournal(const std::wstring& path, int anime_id);
+  int ReplayJournal(const std::wstring& path);
 
   int GetItemCount(int status, bool check_history = true);
 
@@ -58,6 +92,14 @@ public:
   std::map<int, Item> items;
 
 private:
+  // Mapped as <service, <service ID, anime ID>>
+  std::vector<std::unordered_map<std::wstring, int>> id_index_;
+
+  QWORD journal_size_;
+  QWORD list_size_;
+  unsigned int items_version_;
+  unsigned int version_;
+
   void ReadDatabaseNode(pugi::xml_node& database_node);
   void WriteDatabaseNode(pugi::xml_node& database_node);
 
@@ -177,7 +177,14 @@ void Item::SetId(const std::wstring& id, enum_t service) {
   if (metadata_.uid.size() < static_cast<size_t>(service) + 1)
     metadata_.uid.resize(service + 1);
 
+  if (metadata_.uid.at(service) == id)
+    return;
+
+  std::wstring previous_id = metadata_.uid.at(service);
   metadata_.uid.at(service) = id;
+
+  if (database_)
+    database_->UpdateIdIndex(*this, service, previous_id);
 }
 
 void Item::SetSlug(const std::wstring& slug) {
@@ -336,40 +343,52 @@ int Item::GetMyLastWatchedEpisode(bool check_queue) const {
   if (!my_info_.get())
     return 0;
 
-  HistoryItem* history_item = check_queue ?
-      SearchHistory(kQueueSearchEpisode) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->episode)
+      return *values->episode;
+  }
 
-  return history_item ? *history_item->episode : my_info_->watched_episodes;
+  return my_info_->watched_episodes;
 }
 
 int Item::GetMyScore(bool check_queue) const {
   if (!my_info_.get())
     return 0;
 
-  HistoryItem* history_item = check_queue ?
-      SearchHistory(kQueueSearchScore) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->score)
+      return *values->score;
+  }
 
-  return history_item ? *history_item->score : my_info_->score;
+  return my_info_->score;
 }
 
 int Item::GetMyStatus(bool check_queue) const {
   if (!my_info_.get())
     return kNotInList;
 
-  HistoryItem* history_item = check_queue ?
-      SearchHistory(kQueueSearchStatus) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->status)
+      return *values->status;
+  }
 
-  return history_item ? *history_item->status : my_info_->status;
+  return my_info_->status;
 }
 
 int Item::GetMyRewatching(bool check_queue) const {
   if (!my_info_.get())
     return FALSE;
 
-  HistoryItem* history_item = check_queue ?
-    SearchHistory(kQueueSearchRewatching) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->enable_rewatching)
+      return *values->enable_rewatching;
+  }
 
-  return history_item ? *history_item->enable_rewatching : my_info_->rewatching;
+  return my_info_->rewatching;
 }
 
 int Item::GetMyRewatchingEp() const {
@@ -383,20 +402,26 @@ const Date& Item::GetMyDateStart(bool check_queue) const {
   if (!my_info_.get())
     return EmptyDate();
 
-  HistoryItem* history_item = check_queue ?
-      SearchHistory(kQueueSearchDateStart) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->date_start)
+      return *values->date_start;
+  }
 
-  return history_item ? *history_item->date_start : my_info_->date_start;
+  return my_info_->date_start;
 }
 
 const Date& Item::GetMyDateEnd(bool check_queue) const {
   if (!my_info_.get())
     return EmptyDate();
 
-  HistoryItem* history_item = check_queue ?
-      SearchHistory(kQueueSearchDateEnd) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->date_finish)
+      return *values->date_finish;
+  }
 
-  return history_item ? *history_item->date_finish : my_info_->date_finish;
+  return my_info_->date_finish;
 }
 
 const std::wstring& Item::GetMyLastUpdated() const {
@@ -410,10 +435,13 @@ const std::wstring& Item::GetMyTags(bool check_queue) const {
   if (!my_info_.get())
     return EmptyString();
 
-  HistoryItem* history_item = check_queue ?
-    SearchHistory(kQueueSearchTags) : nullptr;
+  if (check_queue) {
+    const AnimeValues* values = SearchHistory();
+    if (values && values->tags)
+      return *values->tags;
+  }
 
-  return history_item ? *history_item->tags : my_info_->tags;
+  return my_info_->tags;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -620,8 +648,8 @@ void Item::RemoveFromUserList() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-HistoryItem* Item::SearchHistory(int search_mode) const {
-  return History.queue.FindItem(GetId(), search_mode);
+const AnimeValues* Item::SearchHistory() const {
+  return History.queue.FindPendingValues(GetId());
 }
 
 }  // namespace anime
\ No newline at end of file
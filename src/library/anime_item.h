@@ -31,8 +31,8 @@ class Database;
 class Episode;
 class Item;
 }
+class AnimeValues;
 class Date;
-class HistoryItem;
 
 namespace anime {
 
@@ -144,7 +144,7 @@ public:
 
 private:
   // Helper function
-  HistoryItem* SearchHistory(int search_mode) const;
+  const AnimeValues* SearchHistory() const;
 
   // Series information, stored in db\anime.xml
   library::Metadata metadata_;
@@ -658,7 +658,8 @@ void DecrementEpisode(int anime_id) {
   auto history_item = History.queue.FindItem(anime_item->GetId(),
                                              kQueueSearchEpisode);
 
-  if (history_item && *history_item->episode == watched &&
+  if (history_item && !history_item->sending &&
+      *history_item->episode == watched &&
       watched > anime_item->GetMyLastWatchedEpisode(false)) {
     history_item->enabled = false;
     History.queue.RemoveDisabled();
@@ -16,6 +16,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <limits>
+#include <unordered_set>
+
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
@@ -34,10 +37,37 @@
 class ConfirmationQueue ConfirmationQueue;
 class History History;
 
+// Number of requests that can be in progress at the same time
+const size_t kMaxSimultaneousRequests = 4;
+// Temporary failures are retried after a delay (in seconds) that is doubled
+// after each attempt
+const int kMaxRetryCount = 5;
+const time_t kRetryDelay = 5;
+
+void AnimeValues::Merge(const AnimeValues& values) {
+  if (values.episode)
+    episode = *values.episode;
+  if (values.status)
+    status = *values.status;
+  if (values.score)
+    score = *values.score;
+  if (values.date_start)
+    date_start = *values.date_start;
+  if (values.date_finish)
+    date_finish = *values.date_finish;
+  if (values.enable_rewatching)
+    enable_rewatching = *values.enable_rewatching;
+  if (values.tags)
+    tags = *values.tags;
+}
+
 HistoryItem::HistoryItem()
     : anime_id(anime::ID_UNKNOWN),
       enabled(true),
-      mode(0) {
+      mode(0),
+      retry_count(0),
+      retry_time(0),
+      sending(false) {
 }
 
 HistoryQueue::HistoryQueue()
@@ -46,7 +76,7 @@ HistoryQueue::HistoryQueue()
       updating(false) {
 }
 
-void HistoryQueue::Add(HistoryItem& item, bool save) {
+void HistoryQueue::Add(HistoryItem& item, bool save, bool update_values) {
   auto anime = AnimeDatabase.FindItem(item.anime_id);
 
   // Add to user list
@@ -91,36 +121,35 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
       break;
   }
 
-  // Edit previous item with the same ID...
+  // Edit previous item with the same ID, unless it is being sent...
   bool add_new_item = true;
-  if (!History.queue.updating) {
-    foreach_r_(it, items) {
-      if (it->anime_id == item.anime_id && it->enabled) {
-        if (it->mode != taiga::kHttpServiceAddLibraryEntry &&
-            it->mode != taiga::kHttpServiceDeleteLibraryEntry) {
-          if (!item.episode || (!it->episode && it == items.rbegin())) {
-            if (item.episode)
-              it->episode = *item.episode;
-            if (item.score)
-              it->score = *item.score;
-            if (item.status)
-              it->status = *item.status;
-            if (item.enable_rewatching)
-              it->enable_rewatching = *item.enable_rewatching;
-            if (item.tags)
-              it->tags = *item.tags;
-            if (item.date_start)
-              it->date_start = *item.date_start;
-            if (item.date_finish)
-              it->date_finish = *item.date_finish;
-            add_new_item = false;
-          }
-          if (!add_new_item) {
-            it->mode = taiga::kHttpServiceUpdateLibraryEntry;
-            it->time = (std::wstring)GetDate() + L" " + GetTime();
-          }
-          break;
+  foreach_r_(it, items) {
+    if (it->anime_id == item.anime_id && it->enabled) {
+      if (!it->sending &&
+          it->mode != taiga::kHttpServiceAddLibraryEntry &&
+          it->mode != taiga::kHttpServiceDeleteLibraryEntry) {
+        if (!item.episode || (!it->episode && it == items.rbegin())) {
+          if (item.episode)
+            it->episode = *item.episode;
+          if (item.score)
+            it->score = *item.score;
+          if (item.status)
+            it->status = *item.status;
+          if (item.enable_rewatching)
+            it->enable_rewatching = *item.enable_rewatching;
+          if (item.tags)
+            it->tags = *item.tags;
+          if (item.date_start)
+            it->date_start = *item.date_start;
+          if (item.date_finish)
+            it->date_finish = *item.date_finish;
+          add_new_item = false;
         }
+        if (!add_new_item) {
+          it->mode = taiga::kHttpServiceUpdateLibraryEntry;
+          it->time = (std::wstring)GetDate() + L" " + GetTime();
+        }
+        break;
       }
     }
   }
@@ -131,6 +160,9 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
     items.push_back(item);
   }
 
+  if (update_values)
+    UpdatePendingValues(item.anime_id);
+
   if (anime && save) {
     // Save
     history->Save();
@@ -158,45 +190,20 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
 }
 
 void HistoryQueue::Check(bool automatic) {
-  // Check
-  if (items.empty()) {
-    return;
-  }
-  if (!items[index].enabled) {
-    LOG(LevelDebug, L"Item is disabled, removing...");
-    Remove(index, true, true, false);
-    Check();
-    return;
-  }
-  if (!Taiga.logged_in) {
-    items[index].reason = L"Not logged in";
-    return;
-  }
-  if (automatic && !Settings.GetBool(taiga::kApp_Option_EnableSync)) {
-    items[index].reason = L"Synchronization is disabled";
-    return;
-  }
-
-  // Compare ID with anime list
-  auto anime_item = AnimeDatabase.FindItem(items[index].anime_id);
-  if (!anime_item) {
-    LOG(LevelWarning, L"Item not found in list, removing... ID: " +
-                      ToWstr(items[index].anime_id));
-    Remove(index, true, true, false);
-    Check();
-    return;
+  // Items that have failed before are given another chance
+  foreach_(it, items) {
+    if (!it->sending) {
+      it->retry_count = 0;
+      it->retry_time = 0;
+    }
   }
 
-  // Update
-  History.queue.updating = true;
-  ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
-  AnimeValues* anime_values = static_cast<AnimeValues*>(&items[index]);
-  sync::UpdateLibraryEntry(*anime_values, items[index].anime_id,
-      static_cast<taiga::HttpClientMode>(items[index].mode));
+  Send(automatic);
 }
 
 void HistoryQueue::Clear(bool save) {
   items.clear();
+  pending_values_.clear();
   index = 0;
 
   ui::OnHistoryChange();
@@ -205,6 +212,48 @@ void HistoryQueue::Clear(bool save) {
     history->Save();
 }
 
+std::vector<int> HistoryQueue::Dispatch(time_t now) {
+  std::vector<int> anime_ids;
+
+  // Only one request can be in progress for each anime, so that updates to
+  // the same entry are received in the order they were queued
+  std::unordered_set<int> busy_ids;
+  foreach_c_(it, items)
+    if (it->sending)
+      busy_ids.insert(it->anime_id);
+  size_t request_count = busy_ids.size();
+
+  for (size_t i = 0; i < items.size(); i++) {
+    if (request_count >= kMaxSimultaneousRequests)
+      break;
+
+    auto& item = items[i];
+    if (!item.enabled || busy_ids.count(item.anime_id))
+      continue;
+    busy_ids.insert(item.anime_id);
+    if (item.retry_time > now)
+      continue;
+
+    // Consecutive updates to the same entry are sent with a single request
+    item.sending = true;
+    if (item.mode == taiga::kHttpServiceUpdateLibraryEntry) {
+      for (size_t j = i + 1; j < items.size(); j++) {
+        auto& next_item = items[j];
+        if (next_item.anime_id != item.anime_id || !next_item.enabled)
+          continue;
+        if (next_item.mode != taiga::kHttpServiceUpdateLibraryEntry)
+          break;
+        next_item.sending = true;
+      }
+    }
+
+    anime_ids.push_back(item.anime_id);
+    request_count++;
+  }
+
+  return anime_ids;
+}
+
 HistoryItem* HistoryQueue::FindItem(int anime_id, int search_mode) {
   for (auto it = items.rbegin(); it != items.rend(); ++it) {
     if (it->anime_id == anime_id && it->enabled) {
@@ -252,6 +301,11 @@ HistoryItem* HistoryQueue::FindItem(int anime_id, int search_mode) {
   return nullptr;
 }
 
+const AnimeValues* HistoryQueue::FindPendingValues(int anime_id) const {
+  auto it = pending_values_.find(anime_id);
+  return it != pending_values_.end() ? &it->second : nullptr;
+}
+
 HistoryItem* HistoryQueue::GetCurrentItem() {
   if (!items.empty())
     return &items.at(index);
@@ -269,6 +323,32 @@ int HistoryQueue::GetItemCount() {
   return count;
 }
 
+void HistoryQueue::RebuildPendingValues() {
+  pending_values_.clear();
+
+  foreach_c_(it, items)
+    if (it->enabled)
+      pending_values_[it->anime_id].Merge(*it);
+}
+
+void HistoryQueue::UpdatePendingValues(int anime_id) {
+  AnimeValues values;
+  bool found = false;
+
+  foreach_c_(it, items) {
+    if (it->anime_id == anime_id && it->enabled) {
+      values.Merge(*it);
+      found = true;
+    }
+  }
+
+  if (found) {
+    pending_values_[anime_id] = values;
+  } else {
+    pending_values_.erase(anime_id);
+  }
+}
+
 void HistoryQueue::Remove(int index, bool save, bool refresh, bool to_history) {
   if (index == -1)
     index = this->index;
@@ -276,15 +356,12 @@ void HistoryQueue::Remove(int index, bool save, bool refresh, bool to_history) {
   if (index < static_cast<int>(items.size())) {
     auto history_item = items.begin() + index;
 
-    if (to_history && history_item->episode) {
-      history->items.push_back(*history_item);
-      if (history->limit > 0 &&
-          static_cast<int>(history->items.size()) > history->limit) {
-        history->items.erase(history->items.begin());
-      }
-    }
+    if (to_history)
+      history->AddItem(*history_item);
 
+    int anime_id = history_item->anime_id;
     items.erase(history_item);
+    UpdatePendingValues(anime_id);
 
     if (refresh)
       ui::OnHistoryChange();
@@ -305,6 +382,9 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
     }
   }
 
+  if (needs_refresh)
+    RebuildPendingValues();
+
   if (refresh && needs_refresh)
     ui::OnHistoryChange();
 
@@ -312,6 +392,139 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
     history->Save();
 }
 
+void HistoryQueue::RetryDelayedItems() {
+  time_t now = time(nullptr);
+
+  foreach_c_(it, items) {
+    if (!it->sending && it->retry_time > 0 && it->retry_time <= now) {
+      Send(true);
+      return;
+    }
+  }
+}
+
+void HistoryQueue::Send(bool automatic) {
+  // Check
+  if (GetItemCount() < static_cast<int>(items.size())) {
+    LOG(LevelDebug, L"Removing disabled items...");
+    RemoveDisabled();
+  }
+  if (items.empty()) {
+    return;
+  }
+  if (!Taiga.logged_in) {
+    items[index].reason = L"Not logged in";
+    return;
+  }
+  if (automatic && !Settings.GetBool(taiga::kApp_Option_EnableSync)) {
+    items[index].reason = L"Synchronization is disabled";
+    return;
+  }
+
+  auto anime_ids = Dispatch(time(nullptr));
+
+  foreach_c_(anime_id, anime_ids) {
+    // Compare ID with anime list
+    auto anime_item = AnimeDatabase.FindItem(*anime_id);
+    if (!anime_item) {
+      LOG(LevelWarning, L"Item not found in list, removing... ID: " +
+                        ToWstr(*anime_id));
+      TakeSentItems(*anime_id);
+      ui::OnHistoryChange();
+      history->Save();
+      continue;
+    }
+
+    AnimeValues anime_values;
+    int mode = 0;
+    foreach_c_(it, items) {
+      if (it->anime_id == *anime_id && it->sending) {
+        if (!mode)
+          mode = it->mode;
+        anime_values.Merge(*it);
+      }
+    }
+
+    // Update
+    ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
+    if (!sync::UpdateLibraryEntry(anime_values, *anime_id,
+                                  static_cast<taiga::HttpClientMode>(mode))) {
+      OnRequestFailed(*anime_id, L"Authentication is not available", false,
+                      time(nullptr));
+    }
+  }
+
+  UpdateSendingState();
+}
+
+bool HistoryQueue::OnRequestFailed(int anime_id, const std::wstring& reason,
+                                   bool retry, time_t now) {
+  bool retrying = false;
+
+  foreach_(it, items) {
+    if (it->anime_id == anime_id && it->sending) {
+      it->sending = false;
+      it->reason = reason;
+      it->retry_count++;
+      if (retry && it->retry_count <= kMaxRetryCount) {
+        it->retry_time = now + (kRetryDelay << (it->retry_count - 1));
+        retrying = true;
+      } else {
+        // Wait for the next check
+        it->retry_time = (std::numeric_limits<time_t>::max)();
+      }
+    }
+  }
+
+  UpdateSendingState();
+
+  return retrying;
+}
+
+void HistoryQueue::OnRequestSucceeded(int anime_id) {
+  auto sent_items = TakeSentItems(anime_id);
+
+  foreach_c_(it, sent_items) {
+    history->AddItem(*it);
+    AnimeDatabase.UpdateItem(*it);
+  }
+
+  ui::OnHistoryChange();
+  history->Save();
+
+  Send(false);
+}
+
+std::vector<HistoryItem> HistoryQueue::TakeSentItems(int anime_id) {
+  std::vector<HistoryItem> sent_items;
+
+  for (auto it = items.begin(); it != items.end(); ) {
+    if (it->anime_id == anime_id && it->sending) {
+      sent_items.push_back(*it);
+      sent_items.back().sending = false;
+      it = items.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  UpdatePendingValues(anime_id);
+  UpdateSendingState();
+
+  return sent_items;
+}
+
+void HistoryQueue::UpdateSendingState() {
+  updating = false;
+
+  foreach_c_(it, items) {
+    if (it->sending) {
+      updating = true;
+      break;
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 History::History()
@@ -319,6 +532,15 @@ History::History()
   queue.history = this;
 }
 
+void History::AddItem(const HistoryItem& item) {
+  if (!item.episode)
+    return;
+
+  items.push_back(item);
+  if (limit > 0 && static_cast<int>(items.size()) > limit)
+    items.erase(items.begin());
+}
+
 void History::Clear(bool save) {
   items.clear();
 
@@ -330,7 +552,11 @@ void History::Clear(bool save) {
 
 bool History::Load() {
   items.clear();
+
+  // Values of the previous user must not show through if loading fails
   queue.items.clear();
+  queue.index = 0;
+  queue.RebuildPendingValues();
 
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathUserHistory);
@@ -371,8 +597,10 @@ bool History::Load() {
     #undef READ_ATTRIBUTE_DATE
     #undef READ_ATTRIBUTE_STR
     #undef READ_ATTRIBUTE_INT
-    queue.Add(history_item, false);
+    queue.Add(history_item, false, false);
   }
+  // Pending values are built once, rather than for each item that is added
+  queue.RebuildPendingValues();
 
   return true;
 }
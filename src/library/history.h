@@ -21,6 +21,7 @@
 
 #include <string>
 #include <queue>
+#include <unordered_map>
 #include <vector>
 
 #include "base/optional.h"
@@ -39,6 +40,9 @@ enum QueueSearchMode {
 
 class AnimeValues {
 public:
+  // Copies the values that are set, overriding the current ones
+  void Merge(const AnimeValues& values);
+
   Optional<int> episode;
   Optional<int> status;
   Optional<int> score;
@@ -54,8 +58,11 @@ public:
   virtual ~HistoryItem() {}
 
   bool enabled;
+  bool sending;
   int anime_id;
   int mode;
+  int retry_count;
+  time_t retry_time;
   std::wstring reason;
   std::wstring time;
 };
@@ -67,19 +74,36 @@ public:
   HistoryQueue();
   ~HistoryQueue() {}
 
-  void Add(HistoryItem& item, bool save = true);
+  void Add(HistoryItem& item, bool save = true, bool update_values = true);
   void Check(bool automatic = true);
   void Clear(bool save = true);
+  std::vector<int> Dispatch(time_t now);
   HistoryItem* FindItem(int anime_id, int search_mode = 0);
+  const AnimeValues* FindPendingValues(int anime_id) const;
   HistoryItem* GetCurrentItem();
   int GetItemCount();
+  void RebuildPendingValues();
   void Remove(int index = -1, bool save = true, bool refresh = true, bool to_history = true);
   void RemoveDisabled(bool save = true, bool refresh = true);
+  void RetryDelayedItems();
+  void Send(bool automatic = false);
+
+  bool OnRequestFailed(int anime_id, const std::wstring& reason, bool retry, time_t now);
+  void OnRequestSucceeded(int anime_id);
+  std::vector<HistoryItem> TakeSentItems(int anime_id);
 
   size_t index;
   std::vector<HistoryItem> items;
   History* history;
   bool updating;
+
+private:
+  void UpdatePendingValues(int anime_id);
+  void UpdateSendingState();
+
+  // Values of enabled items for each anime, where later items override the
+  // earlier ones. Must be updated whenever items are modified.
+  std::unordered_map<int, AnimeValues> pending_values_;
 };
 
 class History {
@@ -87,6 +111,7 @@ public:
   History();
   ~History() {}
 
+  void AddItem(const HistoryItem& item);
   void Clear(bool save = true);
   bool Load();
   bool Save();
@@ -169,7 +169,7 @@ void Service::UpdateLibraryEntry(Request& request, HttpRequest& http_request) {
 // Response handlers
 
 void Service::AuthenticateUser(Response& response, HttpResponse& http_response) {
-  auth_token_ = http_response.body;
+  auth_token_ = http_response.body();
   Trim(auth_token_, L"\"'");
 }
 
@@ -279,7 +279,7 @@ bool Service::RequestSucceeded(Response& response,
     default: {
       Json::Value root;
       Json::Reader reader;
-      bool parsed = reader.parse(WstrToStr(http_response.body), root);
+      bool parsed = reader.parse(http_response.data, root);
       response.data[L"error"] = name() + L" returned an error: ";
       if (parsed) {
         response.data[L"error"] += StrToWstr(root["error"].asString());
@@ -362,7 +362,7 @@ bool Service::ParseResponseBody(Response& response, HttpResponse& http_response,
                                 Json::Value& root) {
   Json::Reader reader;
 
-  if (reader.parse(WstrToStr(http_response.body), root))
+  if (reader.parse(http_response.data, root))
     return true;
 
   switch (response.type) {
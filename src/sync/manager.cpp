@@ -165,10 +165,16 @@ void Manager::HandleError(Response& response, HttpResponse& http_response) {
       break;
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
-    case kUpdateLibraryEntry:
-      History.queue.updating = false;
-      ui::OnLibraryUpdateFailure(anime_id, response.data[L"error"]);
+    case kUpdateLibraryEntry: {
+      // Connection errors and server-side failures are likely to be temporary
+      bool retry = http_response.code == 0 || http_response.code == 429 ||
+                   http_response.code >= 500;
+      if (!History.queue.OnRequestFailed(anime_id, response.data[L"error"],
+                                         retry, time(nullptr)))
+        ui::OnLibraryUpdateFailure(anime_id, response.data[L"error"]);
+      History.queue.Send();
       break;
+    }
     default:
       ui::ChangeStatusText(response.data[L"error"]);
       break;
@@ -242,13 +248,8 @@ void Manager::HandleResponse(Response& response, HttpResponse& http_response) {
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry: {
-      History.queue.updating = false;
       ui::ClearStatusText();
-
-      auto history_item = History.queue.GetCurrentItem();
-      if (history_item)
-        AnimeDatabase.UpdateItem(*history_item);
-
+      History.queue.OnRequestSucceeded(anime_id);
       break;
     }
   }
@@ -208,12 +208,12 @@ void Service::UpdateLibraryEntry(Request& request, HttpRequest& http_request) {
 
 void Service::AuthenticateUser(Response& response, HttpResponse& http_response) {
   response.data[canonical_name_ + L"-username"] =
-      InStr(http_response.body, L"<username>", L"</username>");
+      InStr(http_response.body(), L"<username>", L"</username>");
 }
 
 void Service::GetLibraryEntries(Response& response, HttpResponse& http_response) {
   xml_document document;
-  xml_parse_result parse_result = document.load(http_response.body.c_str());
+  xml_parse_result parse_result = document.load(http_response.body().c_str());
 
   if (parse_result.status != pugi::status_ok) {
     response.data[L"error"] = L"Could not parse the list";
@@ -300,21 +300,21 @@ void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
   // - Rank
   // - Popularity
   // - Members
-  string_t id = InStr(http_response.body,
+  string_t id = InStr(http_response.body(),
       L"/anime/", L"/");
-  string_t title = InStr(http_response.body,
+  string_t title = InStr(http_response.body(),
       L"class=\"hovertitle\">", L"</a>");
-  string_t genres = InStr(http_response.body,
+  string_t genres = InStr(http_response.body(),
       L"Genres:</span> ", L"<br />");
-  string_t status = InStr(http_response.body,
+  string_t status = InStr(http_response.body(),
       L"Status:</span> ", L"<br />");
-  string_t type = InStr(http_response.body,
+  string_t type = InStr(http_response.body(),
       L"Type:</span> ", L"<br />");
-  string_t episodes = InStr(http_response.body,
+  string_t episodes = InStr(http_response.body(),
       L"Episodes:</span> ", L"<br />");
-  string_t score = InStr(http_response.body,
+  string_t score = InStr(http_response.body(),
       L"Score:</span> ", L"<br />");
-  string_t popularity = InStr(http_response.body,
+  string_t popularity = InStr(http_response.body(),
       L"Popularity:</span> ", L"<br />");
 
   bool title_is_truncated = false;
@@ -352,7 +352,7 @@ void Service::GetMetadataById(Response& response, HttpResponse& http_response) {
 
 void Service::SearchTitle(Response& response, HttpResponse& http_response) {
   xml_document document;
-  xml_parse_result parse_result = document.load(http_response.body.c_str());
+  xml_parse_result parse_result = document.load(http_response.body().c_str());
 
   if (parse_result.status != pugi::status_ok) {
     response.data[L"error"] = L"Could not parse search results";
@@ -430,7 +430,7 @@ bool Service::RequestNeedsAuthentication(RequestType request_type) const {
 bool Service::RequestSucceeded(Response& response,
                                const HttpResponse& http_response) {
   // No content
-  if (http_response.code == 204 || http_response.body.empty()) {
+  if (http_response.code == 204 || http_response.body().empty()) {
     response.data[L"error"] = name() + L" returned an empty response";
     return false;
   }
@@ -446,35 +446,35 @@ bool Service::RequestSucceeded(Response& response,
 
   switch (response.type) {
     case kAddLibraryEntry:
-      if (IsNumeric(http_response.body))
+      if (IsNumeric(http_response.body()))
         return true;
-      if (InStr(http_response.body, L"This anime is already on your list") > -1)
+      if (InStr(http_response.body(), L"This anime is already on your list") > -1)
         return true;
       // TODO: Remove when MAL fixes its API
-      if (InStr(http_response.body, L"<title>201 Created</title>") > -1)
+      if (InStr(http_response.body(), L"<title>201 Created</title>") > -1)
         return true;
       break;
     case kAuthenticateUser:
-      if (InStr(http_response.body, L"<username>") > -1)
+      if (InStr(http_response.body(), L"<username>") > -1)
         return true;
       break;
     case kDeleteLibraryEntry:
-      if (IsEqual(http_response.body, L"Deleted"))
+      if (IsEqual(http_response.body(), L"Deleted"))
         return true;
       break;
     case kGetLibraryEntries:
-      if (InStr(http_response.body, L"<myanimelist>", 0, true) > -1 &&
-          InStr(http_response.body, L"<myinfo>", 0, true) > -1)
+      if (InStr(http_response.body(), L"<myanimelist>", 0, true) > -1 &&
+          InStr(http_response.body(), L"<myinfo>", 0, true) > -1)
         return true;
       break;
     case kGetMetadataById:
-      if (!InStr(http_response.body, L"/anime/", L"/").empty())
+      if (!InStr(http_response.body(), L"/anime/", L"/").empty())
         return true;
       break;
     case kSearchTitle:
       return true;
     case kUpdateLibraryEntry:
-      if (IsEqual(http_response.body, L"Updated"))
+      if (IsEqual(http_response.body(), L"Updated"))
         return true;
       break;
   }
@@ -484,7 +484,7 @@ bool Service::RequestSucceeded(Response& response,
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry: {
-      std::wstring error_message = http_response.body;
+      std::wstring error_message = http_response.body();
       Replace(error_message, L"</div><div>", L"\r\n");
       StripHtmlTags(error_message);
       response.data[L"error"] = error_message;
@@ -110,14 +110,14 @@ void Synchronize() {
   }
 }
 
-void UpdateLibraryEntry(AnimeValues& anime_values, int id,
+bool UpdateLibraryEntry(AnimeValues& anime_values, int id,
                         taiga::HttpClientMode http_client_mode) {
   RequestType request_type = ClientModeToRequestType(http_client_mode);
 
   Request request(request_type);
   SetActiveServiceForRequest(request);
   if (!AddAuthenticationToRequest(request))
-    return;
+    return false;
   AddServiceDataToRequest(request, id);
 
   if (anime_values.episode)
@@ -136,6 +136,7 @@ void UpdateLibraryEntry(AnimeValues& anime_values, int id,
     request.data[L"tags"] = *anime_values.tags;
 
   ServiceManager.MakeRequest(request);
+  return true;
 }
 
 void DownloadImage(int id, const string_t& image_url) {
@@ -16,11 +16,46 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#ifdef _DEBUG
+#include <crtdbg.h>
+#endif
+
+#include <zlib/zlib.h>
+
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/gzip.h"
+#include "base/http.h"
+#include "base/log.h"
 #include "base/string.h"
+#include "base/time.h"
+#include "base/xml.h"
 #include "library/anime_db.h"
+#include "library/anime_episode.h"
+#include "library/history.h"
+#include "sync/sync.h"
 #include "taiga/debug.h"
+#include "taiga/http.h"
+#include "taiga/path.h"
+#include "track/feed.h"
+#include "track/feed_parser.h"
+#include "track/recognition.h"
+#include "track/search.h"
 #include "ui/dlg/dlg_main.h"
 #include "ui/dialog.h"
+#include "win/win_thread.h"
+
+#ifdef TAIGA_BENCHMARKS
+#pragma comment(lib, "ws2_32.lib")
+#endif
 
 namespace debug {
 
@@ -41,10 +76,7 @@ void Tester::Start() {
 }
 
 void Tester::End(std::wstring str, bool display_result) {
-  LARGE_INTEGER li;
-
-  ::QueryPerformanceCounter(&li);
-  double value = double(li.QuadPart - value_) / frequency_;
+  double value = GetElapsed();
 
   if (display_result) {
     str = ToWstr(value, 2) + L"ms | Text: [" + str + L"]";
@@ -52,6 +84,13 @@ void Tester::End(std::wstring str, bool display_result) {
   }
 }
 
+double Tester::GetElapsed() {
+  LARGE_INTEGER li;
+
+  ::QueryPerformanceCounter(&li);
+  return double(li.QuadPart - value_) / frequency_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void Print(std::wstring text) {
@@ -86,4 +125,2156 @@ void Test() {
   test.End(str, 0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef TAIGA_BENCHMARKS
+
+// Replaces the anime database with generated items for the lifetime of the
+// object, so that benchmarks do not depend on (or modify) user data.
+class ScopedAnimeDatabase {
+ public:
+  ScopedAnimeDatabase(int item_count);
+  ~ScopedAnimeDatabase();
+
+ private:
+  void ResetIndexes();
+
+  std::map<int, anime::Item> items_;
+};
+
+static std::wstring GenerateWord() {
+  static const wchar_t* syllables[] = {
+    L"a", L"ka", L"ki", L"ko", L"sa", L"shi", L"su", L"ta", L"chi", L"tsu",
+    L"to", L"na", L"ni", L"no", L"ha", L"hi", L"mi", L"mo", L"ya", L"yu",
+    L"ra", L"ri", L"ro", L"wa", L"gen", L"sei", L"ken", L"dou", L"kai", L"ryuu"
+  };
+  std::wstring word;
+  for (int i = 1 + std::rand() % 3; i >= 0; i--)
+    word += syllables[std::rand() % (sizeof(syllables) / sizeof(*syllables))];
+  return word;
+}
+
+static std::wstring GenerateTitle() {
+  std::wstring title;
+  for (int i = 1 + std::rand() % 4; i >= 0; i--)
+    AppendString(title, GenerateWord(), L" ");
+  title[0] = towupper(title[0]);
+  return title;
+}
+
+ScopedAnimeDatabase::ScopedAnimeDatabase(int item_count) {
+  items_.swap(AnimeDatabase.items);
+  ResetIndexes();
+
+  std::srand(0);
+
+  for (int id = 1; id <= item_count; id++) {
+    auto& item = AnimeDatabase.items[id];
+    item.SetId(ToWstr(id), sync::kTaiga);
+    item.SetTitle(GenerateTitle());
+    std::vector<std::wstring> synonyms;
+    for (int i = std::rand() % 3; i > 0; i--)
+      synonyms.push_back(GenerateTitle());
+    item.SetSynonyms(synonyms);
+    item.SetType(anime::kTv);
+    item.SetEpisodeCount(1 + std::rand() % 26);
+  }
+}
+
+ScopedAnimeDatabase::~ScopedAnimeDatabase() {
+  items_.swap(AnimeDatabase.items);
+  ResetIndexes();
+}
+
+void ScopedAnimeDatabase::ResetIndexes() {
+  AnimeDatabase.RebuildIdIndex();
+  Meow.ClearCleanTitles();
+}
+
+static void Report(const std::wstring& name, const std::wstring& text) {
+  LOG(LevelInformational, L"[" + name + L"] " + text);
+  Print(L"[" + name + L"] " + text + L"\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares the trigram candidate index with scoring every item in a database
+// of 15k titles, using slightly misspelled titles that do not match strictly.
+static void BenchmarkScoreTitle() {
+  const int item_count = 15000;
+  const int query_count = 500;
+
+  ScopedAnimeDatabase database(item_count);
+  RecognitionContext context;
+  context.titles = Meow.GetTitleSnapshot();
+
+  std::vector<std::wstring> queries;
+  for (int i = 0; i < query_count; i++) {
+    std::wstring title = AnimeDatabase.items[1 + std::rand() % item_count].GetTitle();
+    size_t pos = std::rand() % title.length();
+    switch (i % 3) {
+      case 0:  // Missing character
+        title.erase(pos, 1);
+        break;
+      case 1:  // Swapped characters
+        if (pos + 1 < title.length())
+          std::swap(title[pos], title[pos + 1]);
+        break;
+      case 2:  // Extra word
+        title += L" " + GenerateWord();
+        break;
+    }
+    Meow.CleanTitle(title);
+    queries.push_back(title);
+  }
+
+  double time_indexed = 0.0;
+  double time_exhaustive = 0.0;
+  int agreement = 0;
+  Tester tester;
+
+  foreach_(it, queries) {
+    anime::Episode episode;
+    episode.clean_title = *it;
+
+    context.scores.clear();
+    tester.Start();
+    Meow.ScoreDatabase(context, episode, false, false, false, false);
+    time_indexed += tester.GetElapsed();
+    auto scores_indexed = context.GetScores();
+
+    context.scores.clear();
+    tester.Start();
+    Meow.ScoreDatabase(context, episode, false, false, false, true);
+    time_exhaustive += tester.GetElapsed();
+    auto scores_exhaustive = context.GetScores();
+
+    if (scores_indexed.empty() && scores_exhaustive.empty()) {
+      agreement++;
+    } else if (!scores_indexed.empty() && !scores_exhaustive.empty() &&
+               scores_indexed.begin()->second ==
+               scores_exhaustive.begin()->second) {
+      agreement++;
+    }
+  }
+
+  Report(L"ScoreTitle",
+         L"Items: " + ToWstr(item_count) +
+         L" | Queries: " + ToWstr(query_count) +
+         L" | Exhaustive: " + ToWstr(time_exhaustive / query_count, 3) + L"ms" +
+         L" | Indexed: " + ToWstr(time_indexed / query_count, 3) + L"ms" +
+         L" | Top-1 agreement: " +
+         ToWstr(100.0 * agreement / query_count, 1) + L"%");
+}
+
+// Allocations can only be counted with the debug heap
+static long allocation_count = 0;
+
+#ifdef _DEBUG
+static int __cdecl CountAllocations(int alloc_type, void* user_data,
+                                    size_t size, int block_type,
+                                    long request_number,
+                                    const unsigned char* filename,
+                                    int line_number) {
+  if (alloc_type == _HOOK_ALLOC || alloc_type == _HOOK_REALLOC)
+    ::InterlockedIncrement(&allocation_count);
+  return TRUE;
+}
+#endif
+
+// GetMostCommonCharacter as it was, with a copy of its input and a map
+static wchar_t GetMostCommonCharacterReference(std::wstring str) {
+  const std::wstring table = L",_ .-+;&|~";
+
+  Trim(str);
+
+  std::map<wchar_t, int> frequency;
+
+  for (auto it = str.begin(); it != str.end(); ++it) {
+    if (IsAlphanumeric(*it))
+      continue;
+    if (table.find(*it) == std::wstring::npos)
+      continue;
+
+    frequency[*it] += 1;
+  }
+
+  wchar_t most_common_char = L'\0';
+
+  for (auto it = frequency.begin(); it != frequency.end(); ++it) {
+    if (most_common_char == L'\0') {
+      most_common_char = it->first;
+      continue;
+    }
+
+    int character_distance = static_cast<int>(table.find(it->first)) -
+                             static_cast<int>(table.find(most_common_char));
+    if (character_distance < 0) {
+      most_common_char = it->first;
+      continue;
+    }
+
+    float frequency_ratio = static_cast<float>(it->second) /
+                            static_cast<float>(frequency[most_common_char]);
+    if (frequency_ratio / character_distance > 0.8f) {
+      most_common_char = it->first;
+    }
+  }
+
+  return most_common_char;
+}
+
+// The string operations that ExamineTitle used to make to split a title into
+// tokens and words, before buffers were reused. Keywords are not checked, so
+// this is only a part of what examining a title used to cost.
+static size_t TokenizeTitleReference(std::wstring title) {
+  // Retrieve file name from full path
+  if (title.length() > 2 && title.at(1) == ':' && title.at(2) == '\\')
+    title = GetFileName(title);
+
+  // Trim file extension
+  std::wstring extension = GetFileExtension(title);
+  if (!extension.empty() &&
+      extension.length() < title.length() &&
+      extension.length() <= 5) {
+    std::wstring format = ToUpper_Copy(extension);
+    title.resize(title.length() - extension.length() - 1);
+  }
+
+  // Tokenize
+  const std::wstring delimiters = L"[](){}";
+  std::vector<Token> tokens;
+  tokens.reserve(4);
+  size_t index_begin = title.find_first_not_of(delimiters);
+  while (index_begin != std::wstring::npos) {
+    size_t index_end = title.find_first_of(delimiters, index_begin + 1);
+    tokens.resize(tokens.size() + 1);
+    if (index_end == std::wstring::npos) {
+      tokens.back().content = title.substr(index_begin);
+      break;
+    } else {
+      tokens.back().content = title.substr(index_begin,
+                                           index_end - index_begin);
+      if (index_begin > 0)
+        tokens.back().encloser = title.at(index_begin - 1);
+      index_begin = title.find_first_not_of(delimiters, index_end + 1);
+    }
+  }
+
+  // Split tokens into words
+  size_t word_count = 0;
+  foreach_(token, tokens) {
+    std::vector<std::wstring> words;
+    token->separator = GetMostCommonCharacterReference(token->content);
+    Split(token->content, std::wstring(1, token->separator), words);
+    word_count += words.size();
+    wchar_t trim_char[] = {token->separator, '\0'};
+    Trim(token->content, trim_char);
+  }
+
+  // Erase tokens that are too short
+  for (size_t i = 0; i < tokens.size(); i++) {
+    if (tokens[i].content.length() < 2 && !IsNumeric(tokens[i].content)) {
+      tokens.erase(tokens.begin() + i);
+      i--;
+    }
+  }
+
+  // Split the title into words
+  if (!tokens.empty()) {
+    std::vector<std::wstring> words;
+    Tokenize(tokens.front().content, L" ", words);
+    word_count += words.size();
+  }
+
+  return word_count;
+}
+
+// Examines the file names in the recognition test file, first with a new
+// context for each title so that no buffers are reused, then with a single
+// context as the application does. The tokenizer that was used before is run
+// as a reference.
+static void BenchmarkExamineTitle() {
+  const int pass_count = 100;
+
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathTestRecognition);
+  xml_parse_result parse_result = document.load_file(path.c_str());
+  if (parse_result.status != pugi::status_ok) {
+    LOG(LevelError, L"Could not read recognition test file: " + path);
+    return;
+  }
+
+  std::vector<std::wstring> titles;
+  xml_node recognition = document.child(L"recognition");
+  foreach_xmlnode_(file_node, recognition, L"file")
+    titles.push_back(XmlReadStrValue(file_node, L"file"));
+  if (titles.empty())
+    return;
+
+  const double title_count = static_cast<double>(titles.size() * pass_count);
+  double time_reference = 0.0;
+  double time_cold = 0.0;
+  double time_warm = 0.0;
+  long allocations_reference = 0;
+  long allocations_cold = 0;
+  long allocations_warm = 0;
+  Tester tester;
+
+#ifdef _DEBUG
+  _CRT_ALLOC_HOOK previous_hook = _CrtSetAllocHook(CountAllocations);
+#endif
+
+  size_t word_count = 0;
+  allocation_count = 0;
+  tester.Start();
+  for (int i = 0; i < pass_count; i++) {
+    foreach_(title, titles)
+      word_count += TokenizeTitleReference(*title);
+  }
+  time_reference = tester.GetElapsed();
+  allocations_reference = allocation_count;
+
+  anime::Episode episode;
+  allocation_count = 0;
+  tester.Start();
+  for (int i = 0; i < pass_count; i++) {
+    foreach_(title, titles) {
+      RecognitionContext context;
+      Meow.ExamineTitle(context, *title, episode,
+                        true, true, true, true, false);
+    }
+  }
+  time_cold = tester.GetElapsed();
+  allocations_cold = allocation_count;
+
+  RecognitionContext context;
+  foreach_(title, titles)  // Warm up buffers
+    Meow.ExamineTitle(context, *title, episode, true, true, true, true, false);
+  allocation_count = 0;
+  tester.Start();
+  for (int i = 0; i < pass_count; i++) {
+    foreach_(title, titles) {
+      Meow.ExamineTitle(context, *title, episode,
+                        true, true, true, true, false);
+    }
+  }
+  time_warm = tester.GetElapsed();
+  allocations_warm = allocation_count;
+
+#ifdef _DEBUG
+  _CrtSetAllocHook(previous_hook);
+  std::wstring allocations_text =
+      L" | Allocations/title: " +
+      ToWstr(allocations_reference / title_count, 2) + L" (baseline) / " +
+      ToWstr(allocations_cold / title_count, 2) + L" -> " +
+      ToWstr(allocations_warm / title_count, 2);
+#else
+  std::wstring allocations_text =
+      L" | Allocations/title: n/a (release build)";
+#endif
+
+  Report(L"ExamineTitle",
+         L"Titles: " + ToWstr(static_cast<int>(titles.size())) +
+         L" | Passes: " + ToWstr(pass_count) +
+         L" | Baseline tokenizer only: " +
+         ToWstr(time_reference * 1000000.0 / title_count, 0) + L"ns/title" +
+         L" (" + ToWstr(static_cast<ULONG>(word_count)) + L" words)" +
+         L" | New context: " + ToWstr(time_cold * 1000000.0 / title_count, 0) +
+         L"ns/title" +
+         L" | Reused context: " +
+         ToWstr(time_warm * 1000000.0 / title_count, 0) + L"ns/title" +
+         allocations_text);
+}
+
+// The series of calls that CleanTitle used to make, before they were merged
+// into a single pass
+static void CleanTitleReference(std::wstring& title) {
+  if (title.empty())
+    return;
+
+  EraseLeft(title, L"the ", true);
+  Replace(title, L" the ", L" ", false, true);
+  Erase(title, L"episode ", true);
+  Erase(title, L" ep.", true);
+  Replace(title, L" specials", L" special", false, true);
+
+  ReplaceChar(title, L'\u00E9', L'e');
+  ReplaceChar(title, L'\uFF0F', L'/');
+  ReplaceChar(title, L'\uFF5E', L'~');
+  ReplaceChar(title, L'\u223C', L'~');
+  ReplaceChar(title, L'\u301C', L'~');
+  ReplaceChar(title, L'\uFF1F', L'?');
+  ReplaceChar(title, L'\uFF01', L'!');
+  ReplaceChar(title, L'\u00D7', L'x');
+  ReplaceChar(title, L'\u2715', L'x');
+
+  Replace(title, L"\u014C", L"Ou");
+  Replace(title, L"\u014D", L"ou");
+  Replace(title, L"\u016B", L"uu");
+  Replace(title, L" wa ", L" ha ");
+  Replace(title, L" e ", L" he ");
+  Replace(title, L" o ", L" wo ");
+
+  Replace(title, L" & ", L" and ", true, false);
+
+  ErasePunctuation(title, true);
+}
+
+// Compares CleanTitle with the reference implementation for every title in
+// the anime database, including English titles and synonyms.
+static void BenchmarkCleanTitle() {
+  std::vector<std::wstring> titles;
+  foreach_(it, AnimeDatabase.items) {
+    titles.push_back(it->second.GetTitle());
+    titles.push_back(it->second.GetEnglishTitle());
+    auto synonyms = it->second.GetSynonyms();
+    titles.insert(titles.end(), synonyms.begin(), synonyms.end());
+    foreach_c_(synonym, it->second.GetUserSynonyms())
+      titles.push_back(*synonym);
+  }
+
+  std::vector<std::wstring> results(titles);
+  std::vector<std::wstring> reference_results(titles);
+  Tester tester;
+
+  tester.Start();
+  foreach_(it, results)
+    Meow.CleanTitle(*it);
+  double time = tester.GetElapsed();
+
+  tester.Start();
+  foreach_(it, reference_results)
+    CleanTitleReference(*it);
+  double time_reference = tester.GetElapsed();
+
+  int mismatch_count = 0;
+  for (size_t i = 0; i < titles.size(); i++) {
+    if (results[i] != reference_results[i]) {
+      LOG(LevelWarning, L"Mismatch: \"" + titles[i] + L"\" -> \"" +
+                        results[i] + L"\", expected \"" +
+                        reference_results[i] + L"\"");
+      mismatch_count++;
+    }
+  }
+
+  double title_count = static_cast<double>(std::max<size_t>(titles.size(), 1));
+  Report(L"CleanTitle",
+         L"Titles: " + ToWstr(static_cast<int>(titles.size())) +
+         L" | Reference: " +
+         ToWstr(time_reference * 1000000.0 / title_count, 0) + L"ns/title" +
+         L" | Single pass: " + ToWstr(time * 1000000.0 / title_count, 0) +
+         L"ns/title" +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares loading a database of 15k items from XML and from the binary
+// format. Reloaded items must serialize to the same file they were read from.
+static void BenchmarkLoadDatabase() {
+  const int item_count = 15000;
+  const int run_count = 3;
+
+  static const wchar_t* genres[] = {
+    L"Action", L"Adventure", L"Comedy", L"Drama", L"Fantasy", L"Mecha",
+    L"Romance", L"School", L"Sci-Fi", L"Slice of Life", L"Sports"
+  };
+  const int genre_count = sizeof(genres) / sizeof(*genres);
+
+  ScopedAnimeDatabase database(item_count);
+  foreach_(it, AnimeDatabase.items) {
+    anime::Item& item = it->second;
+    item.SetEnglishTitle(GenerateTitle());
+    std::vector<std::wstring> item_genres;
+    for (int i = 1 + std::rand() % 4; i > 0; i--)
+      item_genres.push_back(genres[std::rand() % genre_count]);
+    item.SetGenres(item_genres);
+    item.SetProducers(GenerateTitle() + L", " + GenerateTitle());
+    item.SetAiringStatus(anime::kFinishedAiring);
+    item.SetEpisodeLength(24);
+    item.SetDateStart(Date(1990 + std::rand() % 25, 1 + std::rand() % 12,
+                           1 + std::rand() % 28));
+    item.SetImageUrl(L"http://cdn.myanimelist.net/images/anime/" +
+                     ToWstr(it->first) + L".jpg");
+    item.SetScore(ToWstr(5.0 + (std::rand() % 500) / 100.0, 2));
+    item.SetPopularity(L"#" + ToWstr(it->first));
+    std::wstring synopsis;
+    for (int i = 10 + std::rand() % 20; i > 0; i--)
+      AppendString(synopsis, GenerateTitle(), L". ");
+    item.SetSynopsis(synopsis);
+    item.SetLastModified(1400000000 + it->first);
+  }
+
+  std::wstring path = taiga::GetPath(taiga::kPathTest) + L"benchmark_anime";
+  if (!AnimeDatabase.ExportDatabase(path + L".xml") ||
+      !AnimeDatabase.WriteDatabaseFile(path + L".bin")) {
+    Report(L"LoadDatabase", L"Could not write database files");
+    return;
+  }
+
+  double time_xml = 0.0;
+  double time_binary = 0.0;
+  Tester tester;
+
+  for (int i = 0; i < run_count; i++) {
+    AnimeDatabase.items.clear();
+    tester.Start();
+    AnimeDatabase.ImportDatabase(path + L".xml");
+    double elapsed = tester.GetElapsed();
+    if (i == 0 || elapsed < time_xml)
+      time_xml = elapsed;
+
+    AnimeDatabase.items.clear();
+    tester.Start();
+    AnimeDatabase.ReadDatabaseFile(path + L".bin");
+    elapsed = tester.GetElapsed();
+    if (i == 0 || elapsed < time_binary)
+      time_binary = elapsed;
+  }
+
+  std::string original_file, reloaded_file;
+  AnimeDatabase.WriteDatabaseFile(path + L".check.bin");
+  ReadFromFile(path + L".bin", original_file);
+  ReadFromFile(path + L".check.bin", reloaded_file);
+
+  Report(L"LoadDatabase",
+         L"Items: " + ToWstr(item_count) +
+         L" | XML: " + ToWstr(time_xml, 1) + L"ms (" +
+         ToSizeString(GetFileSize(path + L".xml")) + L")" +
+         L" | Binary: " + ToWstr(time_binary, 1) + L"ms (" +
+         ToSizeString(GetFileSize(path + L".bin")) + L")" +
+         L" | Round trip: " +
+         (original_file == reloaded_file ? L"identical" : L"DIFFERENT"));
+
+  ::DeleteFile((path + L".xml").c_str());
+  ::DeleteFile((path + L".bin").c_str());
+  ::DeleteFile((path + L".check.bin").c_str());
+}
+
+// User information that is compared after replaying the library journal
+struct LibraryEntryState {
+  bool in_list;
+  int progress;
+  int score;
+  int status;
+  Date date_start;
+  std::wstring tags;
+  std::wstring last_updated;
+};
+
+static void SetUpLibraryEntries(int list_count) {
+  std::srand(1);
+  foreach_(it, AnimeDatabase.items) {
+    anime::Item& item = it->second;
+    item.RemoveFromUserList();
+    if (it->first <= list_count) {
+      item.AddtoUserList();
+      item.SetMyStatus(anime::kWatching);
+      item.SetMyLastWatchedEpisode(std::rand() % item.GetEpisodeCount());
+      item.SetMyLastUpdated(ToWstr(1400000000 + it->first));
+    }
+  }
+}
+
+static void GetLibraryEntries(std::map<int, LibraryEntryState>& entries) {
+  foreach_(it, AnimeDatabase.items) {
+    const anime::Item& item = it->second;
+    LibraryEntryState& entry = entries[it->first];
+    entry.in_list = item.IsInList();
+    if (entry.in_list) {
+      entry.progress = item.GetMyLastWatchedEpisode(false);
+      entry.score = item.GetMyScore(false);
+      entry.status = item.GetMyStatus(false);
+      entry.date_start = item.GetMyDateStart(false);
+      entry.tags = item.GetMyTags(false);
+      entry.last_updated = item.GetMyLastUpdated();
+    }
+  }
+}
+
+// Applies random updates to a list of 5k entries, and compares the bytes that
+// are written by appending each change to the journal with rewriting the whole
+// list. Replaying the journal must restore the final state of every entry.
+static void BenchmarkLibraryJournal() {
+  const int item_count = 15000;
+  const int list_count = 5000;
+  const int update_count = 2000;
+
+  ScopedAnimeDatabase database(item_count);
+  SetUpLibraryEntries(list_count);
+
+  std::wstring path = taiga::GetPath(taiga::kPathTest) + L"benchmark_anime";
+  ::DeleteFile((path + L".journal").c_str());
+
+  double time = 0.0;
+  Tester tester;
+
+  for (int i = 0; i < update_count; i++) {
+    int anime_id = 1 + std::rand() % (list_count + 100);
+    anime::Item& item = AnimeDatabase.items[anime_id];
+    switch (std::rand() % 10) {
+      case 0:  // Delete
+        item.RemoveFromUserList();
+        break;
+      case 1:  // Score and tags
+        if (!item.IsInList())
+          item.AddtoUserList();
+        item.SetMyScore(1 + std::rand() % 10);
+        item.SetMyTags(GenerateWord() + L", " + GenerateWord());
+        break;
+      default:  // Progress
+        if (!item.IsInList())
+          item.AddtoUserList();
+        item.SetMyLastWatchedEpisode(item.GetMyLastWatchedEpisode(false) + 1);
+        item.SetMyDateStart(Date(2014, 1 + std::rand() % 12, 1));
+        break;
+    }
+    item.SetMyLastUpdated(ToWstr(1500000000 + i));
+
+    tester.Start();
+    AnimeDatabase.AppendToJournal(path + L".journal", anime_id);
+    time += tester.GetElapsed();
+  }
+
+  std::map<int, LibraryEntryState> expected_entries;
+  GetLibraryEntries(expected_entries);
+  QWORD journal_size = GetFileSize(path + L".journal");
+
+  // Measure a full rewrite of the list, as done for every update before
+  tester.Start();
+  AnimeDatabase.ExportList(path + L".xml");
+  double time_list = tester.GetElapsed();
+  QWORD list_size = GetFileSize(path + L".xml");
+
+  SetUpLibraryEntries(list_count);
+  int entry_count = AnimeDatabase.ReplayJournal(path + L".journal");
+
+  std::map<int, LibraryEntryState> entries;
+  GetLibraryEntries(entries);
+
+  int mismatch_count = 0;
+  foreach_(it, expected_entries) {
+    const LibraryEntryState& expected = it->second;
+    const LibraryEntryState& actual = entries[it->first];
+    if (expected.in_list != actual.in_list) {
+      mismatch_count++;
+    } else if (expected.in_list &&
+               (expected.progress != actual.progress ||
+                expected.score != actual.score ||
+                expected.status != actual.status ||
+                expected.date_start != actual.date_start ||
+                expected.tags != actual.tags ||
+                expected.last_updated != actual.last_updated)) {
+      mismatch_count++;
+    }
+  }
+
+  Report(L"LibraryJournal",
+         L"Entries: " + ToWstr(list_count) +
+         L" | Updates: " + ToWstr(update_count) +
+         L" | Journal: " + ToWstr(static_cast<int>(journal_size / update_count)) +
+         L" bytes/update, " + ToWstr(time * 1000.0 / update_count, 1) +
+         L"us/update" +
+         L" | Full rewrite: " + ToWstr(static_cast<int>(list_size)) +
+         L" bytes/update, " + ToWstr(time_list, 1) + L"ms/update" +
+         L" | Replayed: " + ToWstr(entry_count) +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+
+  ::DeleteFile((path + L".journal").c_str());
+  ::DeleteFile((path + L".xml").c_str());
+}
+
+// Finds an item the way Database::FindItem did before items were indexed by
+// their service IDs
+static anime::Item* FindItemByLinearScan(const std::wstring& id, enum_t service) {
+  if (!id.empty())
+    foreach_(it, AnimeDatabase.items)
+      if (id == it->second.GetId(service))
+        return &it->second;
+
+  return nullptr;
+}
+
+static anime::Item GenerateLibraryEntry(int anime_id) {
+  anime::Item entry;
+  entry.SetSource(sync::kMyAnimeList);
+  entry.SetId(ToWstr(anime_id), sync::kMyAnimeList);
+  entry.SetLastModified(1500000000);
+  entry.SetType(anime::kTv);
+  entry.SetEpisodeCount(12);
+  entry.AddtoUserList();
+  entry.SetMyStatus(anime::kWatching);
+  entry.SetMyLastWatchedEpisode(std::rand() % 12);
+  return entry;
+}
+
+// Merges a MyAnimeList response of 5k library entries into a database of 15k
+// items, 4.5k of which are already known by their MyAnimeList IDs. A second
+// response of 5k entries that are all new stands in for a first sync, where
+// every lookup misses.
+static void BenchmarkMergeLibrary() {
+  const int item_count = 15000;
+  const int entry_count = 5000;
+  const int new_entry_count = 500;
+
+  ScopedAnimeDatabase database(item_count);
+
+  std::vector<anime::Item> entries(entry_count);
+  for (int i = 0; i < entry_count; i++) {
+    int anime_id = i < entry_count - new_entry_count ?
+        1 + i * 3 : item_count + 1 + i;
+    if (anime_id <= item_count)
+      AnimeDatabase.items[anime_id].SetId(ToWstr(anime_id), sync::kMyAnimeList);
+    entries[i] = GenerateLibraryEntry(anime_id);
+  }
+
+  std::vector<anime::Item> new_entries(entry_count);
+  for (int i = 0; i < entry_count; i++)
+    new_entries[i] = GenerateLibraryEntry(item_count * 2 + 1 + i);
+
+  // Lookups that UpdateItem performs for each entry
+  Tester tester;
+  int mismatch_count = 0;
+
+  tester.Start();
+  std::vector<anime::Item*> linear_results;
+  foreach_c_(it, entries) {
+    anime::Item* item = nullptr;
+    for (enum_t i = sync::kTaiga; i <= sync::kLastService && !item; i++)
+      item = FindItemByLinearScan(it->GetId(i), i);
+    linear_results.push_back(item);
+  }
+  double time_linear = tester.GetElapsed();
+
+  tester.Start();
+  std::vector<anime::Item*> indexed_results;
+  foreach_c_(it, entries) {
+    anime::Item* item = nullptr;
+    for (enum_t i = sync::kTaiga; i <= sync::kLastService && !item; i++)
+      item = AnimeDatabase.FindItem(it->GetId(i), i);
+    indexed_results.push_back(item);
+  }
+  double time_indexed = tester.GetElapsed();
+
+  for (size_t i = 0; i < linear_results.size(); i++)
+    if (linear_results[i] != indexed_results[i])
+      mismatch_count++;
+
+  // The full merge also updates clean titles and user information
+  tester.Start();
+  foreach_c_(it, entries)
+    AnimeDatabase.UpdateItem(*it);
+  double time_merge = tester.GetElapsed();
+
+  // Every lookup misses for new entries, which used to mean a full scan each
+  tester.Start();
+  foreach_c_(it, new_entries)
+    for (enum_t i = sync::kTaiga; i <= sync::kLastService; i++)
+      if (FindItemByLinearScan(it->GetId(i), i))
+        mismatch_count++;
+  double time_linear_new = tester.GetElapsed();
+
+  tester.Start();
+  foreach_c_(it, new_entries)
+    for (enum_t i = sync::kTaiga; i <= sync::kLastService; i++)
+      if (AnimeDatabase.FindItem(it->GetId(i), i))
+        mismatch_count++;
+  double time_indexed_new = tester.GetElapsed();
+
+  tester.Start();
+  foreach_c_(it, new_entries)
+    AnimeDatabase.UpdateItem(*it);
+  double time_merge_new = tester.GetElapsed();
+
+  int merged_count = 0;
+  foreach_c_(it, entries)
+    if (AnimeDatabase.FindItem(it->GetId(sync::kMyAnimeList), sync::kMyAnimeList))
+      merged_count++;
+  foreach_c_(it, new_entries)
+    if (AnimeDatabase.FindItem(it->GetId(sync::kMyAnimeList), sync::kMyAnimeList))
+      merged_count++;
+
+  Report(L"MergeLibrary",
+         L"Items: " + ToWstr(item_count) +
+         L" | Entries: " + ToWstr(entry_count) +
+         L" | Lookups (linear scan): " + ToWstr(time_linear, 1) + L"ms" +
+         L" | Lookups (indexed): " + ToWstr(time_indexed, 1) + L"ms" +
+         L" | Mismatches: " + ToWstr(mismatch_count) +
+         L" | Merge (indexed): " + ToWstr(time_merge, 1) + L"ms" +
+         L" | New entries: " + ToWstr(entry_count) +
+         L" | Lookups (linear scan): " + ToWstr(time_linear_new, 1) + L"ms" +
+         L" | Lookups (indexed): " + ToWstr(time_indexed_new, 1) + L"ms" +
+         L" | Merge (indexed): " + ToWstr(time_merge_new, 1) + L"ms" +
+         L" | Found after merge: " + ToWstr(merged_count));
+}
+
+// Reads user values of every list item through the history queue, the way the
+// anime list does on each refresh, with 1k updates waiting to be sent.
+static void BenchmarkHistoryQueue() {
+  const int anime_count = 2000;
+  const int queue_count = 1000;
+
+  ScopedAnimeDatabase database(anime_count);
+  foreach_(it, AnimeDatabase.items)
+    it->second.AddtoUserList();
+
+  std::vector<HistoryItem> queue_items;
+  queue_items.swap(History.queue.items);
+  for (int i = 0; i < queue_count; i++) {
+    HistoryItem item;
+    item.anime_id = 1 + std::rand() % anime_count;
+    item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+    item.enabled = std::rand() % 10 != 0;
+    switch (std::rand() % 4) {
+      case 0: item.episode = std::rand() % 26; break;
+      case 1: item.score = std::rand() % 11; break;
+      case 2: item.status = 1 + std::rand() % 5; break;
+      case 3: item.tags = GenerateWord(); break;
+    }
+    History.queue.items.push_back(item);
+  }
+  History.queue.RebuildPendingValues();
+
+  Tester tester;
+
+  tester.Start();
+  long long linear_sum = 0;
+  foreach_c_(it, AnimeDatabase.items) {
+    const anime::Item& anime_item = it->second;
+    HistoryItem* history_item = nullptr;
+    #define SEARCH_QUEUE(mode, field, value) \
+        history_item = History.queue.FindItem(anime_item.GetId(), mode); \
+        linear_sum += history_item ? *history_item->field : value;
+    SEARCH_QUEUE(kQueueSearchEpisode, episode,
+                 anime_item.GetMyLastWatchedEpisode(false));
+    SEARCH_QUEUE(kQueueSearchScore, score, anime_item.GetMyScore(false));
+    SEARCH_QUEUE(kQueueSearchStatus, status, anime_item.GetMyStatus(false));
+    SEARCH_QUEUE(kQueueSearchRewatching, enable_rewatching,
+                 anime_item.GetMyRewatching(false));
+    history_item = History.queue.FindItem(anime_item.GetId(), kQueueSearchTags);
+    linear_sum += (history_item ? *history_item->tags :
+                                  anime_item.GetMyTags(false)).size();
+    #undef SEARCH_QUEUE
+  }
+  double time_linear = tester.GetElapsed();
+
+  tester.Start();
+  long long indexed_sum = 0;
+  foreach_c_(it, AnimeDatabase.items) {
+    const anime::Item& anime_item = it->second;
+    indexed_sum += anime_item.GetMyLastWatchedEpisode();
+    indexed_sum += anime_item.GetMyScore();
+    indexed_sum += anime_item.GetMyStatus();
+    indexed_sum += anime_item.GetMyRewatching();
+    indexed_sum += anime_item.GetMyTags().size();
+  }
+  double time_indexed = tester.GetElapsed();
+
+  queue_items.swap(History.queue.items);
+  History.queue.RebuildPendingValues();
+
+  Report(L"HistoryQueue",
+         L"Items: " + ToWstr(anime_count) +
+         L" | Queued: " + ToWstr(queue_count) +
+         L" | Linear scan: " + ToWstr(time_linear, 1) + L"ms" +
+         L" | Indexed: " + ToWstr(time_indexed, 1) + L"ms" +
+         L" | Results match: " + (linear_sum == indexed_sum ? L"yes" : L"no"));
+}
+
+// Sends 500 queued updates to a simulated service that takes 100-400ms to
+// respond and fails 10% of the time, first one at a time, then through the
+// dispatcher of the history queue.
+static void BenchmarkHistoryUpload() {
+  const int anime_count = 200;
+  const int queue_count = 500;
+  const int failure_rate = 10;  // percent
+
+  ScopedAnimeDatabase database(anime_count);
+
+  auto get_latency = []() {
+    return 100.0 + std::rand() % 301;
+  };
+
+  // Sending items one at a time, retrying each until it succeeds
+  int serial_request_count = 0;
+  double serial_time = 0.0;
+  for (int i = 0; i < queue_count; i++) {
+    do {
+      serial_request_count++;
+      serial_time += get_latency();
+    } while (std::rand() % 100 < failure_rate);
+  }
+
+  bool updating = History.queue.updating;
+  std::vector<HistoryItem> queue_items;
+  queue_items.swap(History.queue.items);
+  for (int i = 0; i < queue_count; i++) {
+    HistoryItem item;
+    item.anime_id = 1 + std::rand() % anime_count;
+    item.mode = taiga::kHttpServiceUpdateLibraryEntry;
+    item.episode = i;
+    History.queue.items.push_back(item);
+  }
+  History.queue.RebuildPendingValues();
+
+  struct SimulatedRequest {
+    int anime_id;
+    double end_time;
+    bool failed;
+  };
+  std::vector<SimulatedRequest> requests;
+  std::map<int, int> last_episodes;
+  int order_error_count = 0;
+  int request_count = 0;
+  time_t start_time = time(nullptr);
+  double clock = 0.0;
+
+  while (true) {
+    time_t now = start_time + static_cast<time_t>(clock / 1000.0);
+    auto anime_ids = History.queue.Dispatch(now);
+    foreach_c_(it, anime_ids) {
+      SimulatedRequest request;
+      request.anime_id = *it;
+      request.end_time = clock + get_latency();
+      request.failed = std::rand() % 100 < failure_rate;
+      requests.push_back(request);
+      request_count++;
+    }
+
+    if (requests.empty()) {
+      // Wait for the next retry, unless there are only failed items left
+      time_t retry_time = (std::numeric_limits<time_t>::max)();
+      foreach_c_(it, History.queue.items)
+        if (it->retry_time < retry_time)
+          retry_time = it->retry_time;
+      if (retry_time == (std::numeric_limits<time_t>::max)())
+        break;
+      clock = (retry_time - start_time) * 1000.0;
+      continue;
+    }
+
+    // Receive the first response
+    auto request = std::min_element(requests.begin(), requests.end(),
+        [](const SimulatedRequest& a, const SimulatedRequest& b) {
+          return a.end_time < b.end_time;
+        });
+    clock = request->end_time;
+    int anime_id = request->anime_id;
+    bool failed = request->failed;
+    requests.erase(request);
+
+    if (failed) {
+      now = start_time + static_cast<time_t>(clock / 1000.0);
+      History.queue.OnRequestFailed(anime_id, L"Simulated failure", true, now);
+    } else {
+      auto sent_items = History.queue.TakeSentItems(anime_id);
+      foreach_c_(it, sent_items) {
+        if (last_episodes.count(anime_id) &&
+            last_episodes[anime_id] > *it->episode)
+          order_error_count++;
+        last_episodes[anime_id] = *it->episode;
+      }
+    }
+  }
+
+  int unsent_count = static_cast<int>(History.queue.items.size());
+
+  queue_items.swap(History.queue.items);
+  History.queue.RebuildPendingValues();
+  History.queue.updating = updating;
+
+  Report(L"HistoryUpload",
+         L"Items: " + ToWstr(queue_count) +
+         L" | Serial: " + ToWstr(serial_request_count) + L" requests, " +
+         ToWstr(serial_time / 1000.0, 1) + L"s" +
+         L" | Pipelined: " + ToWstr(request_count) + L" requests, " +
+         ToWstr(clock / 1000.0, 1) + L"s" +
+         L" | Out of order: " + ToWstr(order_error_count) +
+         L" | Unsent: " + ToWstr(unsent_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void GenerateFeedFilter(FeedFilter& filter) {
+  static const wchar_t* resolutions[] = {L"480p", L"720p", L"1080p", L"hd"};
+  static const wchar_t* variables[] = {L"%watched%", L"%total%", L"%title%"};
+
+  filter.action = static_cast<FeedFilterAction>(std::rand() % 3);
+  filter.match = static_cast<FeedFilterMatch>(std::rand() % 2);
+  filter.option = static_cast<FeedFilterOption>(std::rand() % 3);
+  filter.name = GenerateWord();
+  if (std::rand() % 4 == 0)
+    filter.anime_ids.push_back(1 + std::rand() % 100);
+
+  for (int i = 1 + std::rand() % 3; i > 0; i--) {
+    auto element = static_cast<FeedFilterElement>(
+        std::rand() % kFeedFilterElement_Count);
+    auto op = static_cast<FeedFilterOperator>(
+        std::rand() % kFeedFilterOperator_Count);
+    std::wstring value;
+    switch (std::rand() % 4) {
+      case 0: value = ToWstr(std::rand() % 26); break;
+      case 1: value = resolutions[std::rand() % 4]; break;
+      case 2: value = variables[std::rand() % 3]; break;
+      case 3: value = std::rand() % 2 ? GenerateWord() : L"True"; break;
+    }
+    filter.AddCondition(element, op, value);
+  }
+}
+
+static void GenerateFeed(Feed& feed, int item_count, int anime_count) {
+  static const wchar_t* groups[] = {L"Commie", L"FFF", L"HorribleSubs", L""};
+  static const wchar_t* resolutions[] = {L"480p", L"720p", L"1080p", L""};
+
+  feed.items.resize(item_count);
+  for (int i = 0; i < item_count; i++) {
+    FeedItem& item = feed.items[i];
+    item.index = i;
+    item.title = GenerateTitle();
+    item.category = L"Anime";
+    item.description = GenerateTitle();
+    item.link = L"http://example.com/" + ToWstr(i) + L".torrent";
+    int anime_id = std::rand() % 10 ? 1 + std::rand() % anime_count :
+                                      anime::ID_NOTINLIST;
+    item.episode_data.anime_id = anime_id;
+    item.episode_data.title = anime_id > 0 ?
+        AnimeDatabase.items[anime_id].GetTitle() : GenerateTitle();
+    item.episode_data.number = ToWstr(1 + std::rand() % 26);
+    item.episode_data.version = std::rand() % 4 ? L"" : L"2";
+    item.episode_data.group = groups[std::rand() % 4];
+    item.episode_data.resolution = resolutions[std::rand() % 4];
+    item.episode_data.video_type = std::rand() % 2 ? L"H264" : L"x265";
+  }
+}
+
+static double RunFeedFilters(std::vector<FeedFilter>& filters, Feed& feed,
+                             bool compiled) {
+  Tester tester;
+  tester.Start();
+
+  // Same passes as FeedFilterManager::Filter, without the settings check
+  for (int preferences = 0; preferences < 2; preferences++) {
+    FeedFilterProgram program;
+    if (compiled)
+      program.Compile(filters, feed);
+    foreach_(item, feed.items) {
+      foreach_(filter, filters) {
+        if ((preferences != 0) != (filter->action == kFeedFilterActionPrefer))
+          continue;
+        filter->Filter(feed, *item, true, compiled ? &program : nullptr);
+      }
+    }
+  }
+
+  return tester.GetElapsed();
+}
+
+static void BenchmarkFeedFilter() {
+  const int anime_count = 1000;
+  const int item_count = 1000;
+  const int filter_count = 50;
+
+  ScopedAnimeDatabase database(anime_count);
+
+  for (int id = 1; id <= anime_count; id += 2) {
+    anime::Item& anime_item = AnimeDatabase.items[id];
+    anime_item.AddtoUserList();
+    anime_item.SetMyStatus(1 + std::rand() % 4);
+    anime_item.SetMyLastWatchedEpisode(std::rand() % 26);
+  }
+
+  std::vector<FeedFilter> filters;
+  foreach_c_(preset, Aggregator.filter_manager.presets)
+    filters.push_back(preset->filter);
+  while (filters.size() < static_cast<size_t>(filter_count)) {
+    filters.resize(filters.size() + 1);
+    GenerateFeedFilter(filters.back());
+  }
+
+  Feed interpreted_feed;
+  GenerateFeed(interpreted_feed, item_count, anime_count);
+  Feed compiled_feed = interpreted_feed;
+
+  double time_interpreted = RunFeedFilters(filters, interpreted_feed, false);
+  double time_compiled = RunFeedFilters(filters, compiled_feed, true);
+
+  int mismatch_count = 0;
+  int selected_count = 0;
+  for (int i = 0; i < item_count; i++) {
+    const FeedItem& item1 = interpreted_feed.items[i];
+    const FeedItem& item2 = compiled_feed.items[i];
+    if (item1.state != item2.state || item1.description != item2.description)
+      mismatch_count++;
+    if (item1.state == kFeedItemSelected)
+      selected_count++;
+  }
+
+  Report(L"FeedFilter",
+         L"Items: " + ToWstr(item_count) +
+         L" | Filters: " + ToWstr(filter_count) +
+         L" | Interpreted: " + ToWstr(time_interpreted, 1) + L"ms" +
+         L" | Compiled: " + ToWstr(time_compiled, 1) + L"ms" +
+         L" | Selected: " + ToWstr(selected_count) +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void BenchmarkFeedArchive() {
+  const int archive_count = 20000;
+  const int item_count = 1000;
+
+  std::srand(0);
+
+  FeedArchive archive;
+  for (int i = 0; i < archive_count; i++)
+    archive.Add(GenerateTitle() + L" - " + ToWstr(i % 26));
+
+  std::vector<std::wstring> titles;
+  for (int i = 0; i < item_count; i++) {
+    if (i % 2) {
+      titles.push_back(archive.items().at(std::rand() % archive_count));
+    } else {
+      titles.push_back(GenerateTitle() + L" - 27");
+    }
+  }
+
+  Tester tester;
+  int found_linear = 0;
+  int found_hashed = 0;
+
+  tester.Start();
+  foreach_c_(title, titles) {
+    auto& items = archive.items();
+    if (std::find(items.begin(), items.end(), *title) != items.end())
+      found_linear++;
+  }
+  double time_linear = tester.GetElapsed();
+
+  tester.Start();
+  foreach_c_(title, titles)
+    if (archive.Contains(*title))
+      found_hashed++;
+  double time_hashed = tester.GetElapsed();
+
+  Report(L"FeedArchive",
+         L"Archive: " + ToWstr(archive_count) +
+         L" | Items: " + ToWstr(item_count) +
+         L" | Linear search: " + ToWstr(time_linear, 1) + L"ms" +
+         L" | Hashed lookup: " + ToWstr(time_hashed, 1) + L"ms" +
+         L" | Found: " + ToWstr(found_linear) + L"/" + ToWstr(found_hashed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Compares reading a feed from memory with the way feeds used to be read, by
+// saving the response to disk and loading it into a document.
+static void BenchmarkFeedParser() {
+  const int item_count = 1000;
+  const int run_count = 5;
+
+  std::srand(0);
+
+  std::wstring data = L"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      L"<rss version=\"2.0\"><channel>\n"
+                      L"<title>Benchmark</title>\n"
+                      L"<link>http://example.com/</link>\n"
+                      L"<description>Generated feed</description>\n";
+  for (int i = 0; i < item_count; i++) {
+    data += L"<item>\n"
+            L"<title>[Group] " + GenerateTitle() + L" - " +
+            ToWstr(1 + std::rand() % 26) + L" [720p].mkv</title>\n"
+            L"<category>Anime</category>\n"
+            L"<link>http://example.com/download.php?id=" + ToWstr(i) +
+            L"&amp;f=torrent</link>\n"
+            L"<description><![CDATA[Size: 350 MB<br />" + GenerateTitle() +
+            L"]]></description>\n"
+            L"<guid isPermaLink=\"false\">" + ToWstr(i) + L"</guid>\n"
+            L"</item>\n";
+  }
+  data += L"</channel></rss>\n";
+
+  std::wstring path = taiga::GetPath(taiga::kPathTest) + L"benchmark_feed.xml";
+  std::string buffer = WstrToStr(data);
+
+  Tester tester;
+  double time_document = 0.0;
+  double time_stream = 0.0;
+  GenericFeed document_feed;
+  GenericFeed stream_feed;
+
+  for (int run = 0; run < run_count; run++) {
+    document_feed.items.clear();
+    tester.Start();
+    SaveToFile(buffer.data(), buffer.size(), path);
+    xml_document document;
+    document.load_file(path.c_str());
+    xml_node channel = document.child(L"rss").child(L"channel");
+    foreach_xmlnode_(node, channel, L"item") {
+      document_feed.items.resize(document_feed.items.size() + 1);
+      FeedItem& item = document_feed.items.back();
+      item.category = XmlReadStrValue(node, L"category");
+      item.title = XmlReadStrValue(node, L"title");
+      item.link = XmlReadStrValue(node, L"link");
+      item.description = XmlReadStrValue(node, L"description");
+    }
+    time_document += tester.GetElapsed();
+
+    stream_feed.items.clear();
+    tester.Start();
+    ParseFeed(data, stream_feed);
+    time_stream += tester.GetElapsed();
+  }
+
+  ::DeleteFile(path.c_str());
+
+  int mismatch_count = 0;
+  if (document_feed.items.size() != stream_feed.items.size()) {
+    mismatch_count = item_count;
+  } else {
+    for (size_t i = 0; i < stream_feed.items.size(); i++) {
+      const FeedItem& item1 = document_feed.items[i];
+      const FeedItem& item2 = stream_feed.items[i];
+      if (item1.category != item2.category || item1.title != item2.title ||
+          item1.link != item2.link || item1.description != item2.description)
+        mismatch_count++;
+    }
+  }
+
+  Report(L"FeedParser",
+         L"Items: " + ToWstr(item_count) +
+         L" | File + document: " + ToWstr(time_document / run_count, 2) + L"ms" +
+         L" | Stream: " + ToWstr(time_stream / run_count, 2) + L"ms" +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Same as Aggregator::CompareFeedItems
+static bool IsSameFeedItem(const GenericFeedItem& item1,
+                           const GenericFeedItem& item2) {
+  if (item1.permalink && item2.permalink)
+    if (!item1.guid.empty() || !item2.guid.empty())
+      if (item1.guid == item2.guid)
+        return true;
+  if (!item1.link.empty() || !item2.link.empty())
+    if (item1.link == item2.link)
+      return true;
+  if (!item1.title.empty() || !item2.title.empty())
+    if (item1.title == item2.title)
+      return true;
+  return false;
+}
+
+static void BenchmarkFeedMerge() {
+  const int source_count = 5;
+  const int item_count = 1000;
+
+  std::srand(0);
+
+  // Sources share some of their items with each other
+  std::vector<FeedItem> items;
+  for (int i = 0; i < source_count * item_count; i++) {
+    int id = std::rand() % (source_count * item_count * 2 / 3);
+    FeedItem item;
+    item.title = L"Item " + ToWstr(id);
+    item.link = L"http://example.com/" + ToWstr(std::rand() % 4) + L"/" +
+                ToWstr(id);
+    item.guid = ToWstr(id);
+    item.permalink = std::rand() % 2 == 0;
+    items.push_back(item);
+  }
+
+  Tester tester;
+
+  tester.Start();
+  std::vector<FeedItem> pairwise_items;
+  foreach_c_(item, items) {
+    bool duplicate = false;
+    foreach_c_(it, pairwise_items) {
+      if (IsSameFeedItem(*it, *item)) {
+        duplicate = true;
+        break;
+      }
+    }
+    if (!duplicate)
+      pairwise_items.push_back(*item);
+  }
+  double time_pairwise = tester.GetElapsed();
+
+  tester.Start();
+  std::vector<FeedItem> hashed_items = items;
+  Aggregator.RemoveDuplicateItems(hashed_items);
+  double time_hashed = tester.GetElapsed();
+
+  int mismatch_count = 0;
+  if (pairwise_items.size() != hashed_items.size()) {
+    mismatch_count = static_cast<int>(items.size());
+  } else {
+    for (size_t i = 0; i < hashed_items.size(); i++)
+      if (!IsSameFeedItem(pairwise_items[i], hashed_items[i]))
+        mismatch_count++;
+  }
+
+  Report(L"FeedMerge",
+         L"Items: " + ToWstr(static_cast<int>(items.size())) +
+         L" | Unique: " + ToWstr(static_cast<int>(hashed_items.size())) +
+         L" | Pairwise: " + ToWstr(time_pairwise, 1) + L"ms" +
+         L" | Hashed: " + ToWstr(time_hashed, 1) + L"ms" +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::wstring GenerateReleaseTitle(int anime_count) {
+  static const wchar_t* groups[] = {L"Commie", L"FFF", L"HorribleSubs"};
+  int anime_id = 1 + std::rand() % anime_count;
+  return L"[" + std::wstring(groups[std::rand() % 3]) + L"] " +
+         AnimeDatabase.items[anime_id].GetTitle() + L" - " +
+         ToWstr(1 + std::rand() % 26) + L" [720p].mkv";
+}
+
+static void BenchmarkFeedExamine() {
+  const int anime_count = 1000;
+  const int item_count = 1000;
+  const int changed_count = item_count / 20;
+
+  ScopedAnimeDatabase database(anime_count);
+
+  std::vector<std::wstring> titles;
+  for (int i = 0; i < item_count; i++)
+    titles.push_back(GenerateReleaseTitle(anime_count));
+
+  Feed feed;
+  feed.items.resize(item_count);
+  for (int i = 0; i < item_count; i++)
+    feed.items[i].title = titles[i];
+
+  Tester tester;
+
+  tester.Start();
+  feed.ExamineData();
+  double time_first = tester.GetElapsed();
+
+  // Next check replaces some of the items with new ones
+  for (int i = 0; i < changed_count; i++)
+    titles[std::rand() % item_count] = GenerateReleaseTitle(anime_count);
+  std::vector<FeedItem> items(item_count);
+  for (int i = 0; i < item_count; i++)
+    items[i].title = titles[i];
+
+  Feed uncached_feed;
+  uncached_feed.items = items;
+  tester.Start();
+  uncached_feed.ExamineData();
+  double time_uncached = tester.GetElapsed();
+
+  feed.items = items;
+  tester.Start();
+  feed.ExamineData();
+  double time_cached = tester.GetElapsed();
+
+  int mismatch_count = 0;
+  for (int i = 0; i < item_count; i++) {
+    const FeedItem& item1 = uncached_feed.items[i];
+    const FeedItem& item2 = feed.items[i];
+    if (item1.title != item2.title ||
+        item1.state != item2.state ||
+        item1.episode_data.anime_id != item2.episode_data.anime_id ||
+        item1.episode_data.number != item2.episode_data.number)
+      mismatch_count++;
+  }
+
+  Report(L"FeedExamine",
+         L"Items: " + ToWstr(item_count) +
+         L" | Changed: " + ToWstr(changed_count) +
+         L" | First check: " + ToWstr(time_first, 1) + L"ms" +
+         L" | Uncached: " + ToWstr(time_uncached, 1) + L"ms" +
+         L" | Cached: " + ToWstr(time_cached, 1) + L"ms" +
+         L" | Mismatches: " + ToWstr(mismatch_count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Counts the files that are passed to OnFile, and keeps a checksum of their
+// order, so that two walks over the same tree can be compared.
+class BenchmarkFileSearchHelper : public TaigaFileSearchHelper {
+public:
+  BenchmarkFileSearchHelper() : checksum(0), file_count(0) {
+    minimum_file_size_ = 0;
+  }
+
+  bool OnFile(const std::wstring& root, const std::wstring& name) {
+    checksum = checksum * 31 + std::hash<std::wstring>()(name);
+    file_count++;
+    return TaigaFileSearchHelper::OnFile(root, name);
+  }
+
+  size_t checksum;
+  int file_count;
+};
+
+// Walks a tree the way FileSearchHelper::Search did before directories were
+// read in parallel
+static bool SearchSequential(FileSearchHelper& helper,
+                             const std::wstring& root) {
+  std::wstring path = AddTrailingSlash(GetExtendedLengthPath(root)) + L"*";
+
+  WIN32_FIND_DATA find_data;
+  HANDLE handle = FindFirstFile(path.c_str(), &find_data);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  std::vector<WIN32_FIND_DATA> entries;
+  std::vector<std::wstring> paths;
+  do {
+    if (!IsDirectory(find_data))
+      paths.push_back(AddTrailingSlash(root) + find_data.cFileName);
+    entries.push_back(find_data);
+  } while (FindNextFile(handle, &find_data));
+  FindClose(handle);
+
+  if (!paths.empty())
+    helper.OnFiles(paths);
+
+  foreach_(entry, entries) {
+    bool result = false;
+    if (IsDirectory(*entry)) {
+      if (IsValidDirectory(*entry)) {
+        result = helper.OnDirectory(root, entry->cFileName);
+        if (!result)
+          result = SearchSequential(helper,
+                                    AddTrailingSlash(root) + entry->cFileName);
+      }
+    } else {
+      result = helper.OnFile(root, entry->cFileName);
+    }
+    if (result)
+      return true;
+  }
+
+  return false;
+}
+
+// Creates a folder for each anime in the database, grouped under 20 parent
+// folders, with 4 releases of each episode. Files are empty.
+static void CreateScanTree(const std::wstring& root, int anime_count,
+                           int episode_count) {
+  const int group_count = 20;
+  static const wchar_t* groups[] = {L"Commie", L"FFF", L"HorribleSubs", L"gg"};
+
+  for (int anime_id = 1; anime_id <= anime_count; anime_id++) {
+    const std::wstring title = AnimeDatabase.items[anime_id].GetTitle();
+    std::wstring folder = root + L"Group " +
+        ToWstr(anime_id % group_count) + L"\\" + title + L"\\";
+    for (int i = 0; i < 4; i++) {
+      for (int number = 1; number <= episode_count; number++) {
+        std::wstring file = L"[" + std::wstring(groups[i]) + L"] " + title +
+            L" - " + PadChar(ToWstr(number), L'0', 2) + L" [720p].mkv";
+        SaveToFile("", 0, folder + file);
+      }
+    }
+  }
+}
+
+// Scans a generated tree of 100k files in 1k folders, as a full scan and as a
+// search for a single episode that stops at the first match.
+static void BenchmarkScanFolders() {
+  const int anime_count = 1000;
+  const int episode_count = 25;
+
+  ScopedAnimeDatabase database(anime_count);
+
+  std::wstring root = taiga::GetPath(taiga::kPathTest) + L"scan\\";
+  CreateScanTree(root, anime_count, episode_count);
+
+  // Read the tree once, so that both walks find it in the file system cache
+  BenchmarkFileSearchHelper warm_up_helper;
+  warm_up_helper.Search(root);
+
+  Tester tester;
+
+  BenchmarkFileSearchHelper sequential_helper;
+  tester.Start();
+  SearchSequential(sequential_helper, root);
+  double time_sequential = tester.GetElapsed();
+
+  BenchmarkFileSearchHelper parallel_helper;
+  tester.Start();
+  parallel_helper.Search(root);
+  double time_parallel = tester.GetElapsed();
+
+  // Looking for a single episode
+  const int target_id = anime_count * 3 / 4;
+  BenchmarkFileSearchHelper sequential_target_helper;
+  sequential_target_helper.set_anime_id(target_id);
+  sequential_target_helper.set_episode_number(episode_count);
+  tester.Start();
+  SearchSequential(sequential_target_helper, root);
+  double time_sequential_target = tester.GetElapsed();
+
+  BenchmarkFileSearchHelper parallel_target_helper;
+  parallel_target_helper.set_anime_id(target_id);
+  parallel_target_helper.set_episode_number(episode_count);
+  tester.Start();
+  parallel_target_helper.Search(root);
+  double time_parallel_target = tester.GetElapsed();
+
+  bool results_match =
+      sequential_helper.file_count == parallel_helper.file_count &&
+      sequential_helper.checksum == parallel_helper.checksum &&
+      sequential_target_helper.file_count ==
+          parallel_target_helper.file_count &&
+      sequential_target_helper.path_found() ==
+          parallel_target_helper.path_found();
+
+  DeleteFolder(root);
+
+  Report(L"ScanFolders",
+         L"Files: " + ToWstr(parallel_helper.file_count) +
+         L" | Sequential: " + ToWstr(time_sequential, 1) + L"ms" +
+         L" | Parallel: " + ToWstr(time_parallel, 1) + L"ms" +
+         L" | Single episode (sequential): " +
+         ToWstr(time_sequential_target, 1) + L"ms" +
+         L" | Single episode (parallel): " +
+         ToWstr(time_parallel_target, 1) + L"ms" +
+         L" | Results match: " + (results_match ? L"yes" : L"no"));
+}
+
+// Rescans the same tree with a scan index: unchanged, after a file is added to
+// one folder, and replayed from the index alone without accessing the disk.
+static void BenchmarkScanIndex() {
+  const int anime_count = 1000;
+  const int episode_count = 25;
+
+  ScopedAnimeDatabase database(anime_count);
+
+  std::wstring root = taiga::GetPath(taiga::kPathTest) + L"scan\\";
+  CreateScanTree(root, anime_count, episode_count);
+
+  Tester tester;
+
+  BenchmarkFileSearchHelper helper;
+  tester.Start();
+  helper.Search(root);
+  double time_cold = tester.GetElapsed();
+  int file_count = helper.file_count;
+  size_t checksum = helper.checksum;
+
+  helper.file_count = 0;
+  helper.checksum = 0;
+  tester.Start();
+  helper.Search(root);
+  double time_unchanged = tester.GetElapsed();
+  bool results_match = helper.file_count == file_count &&
+                       helper.checksum == checksum;
+
+  // A new file must be noticed, even though its folder was indexed
+  const std::wstring title = AnimeDatabase.items[1].GetTitle();
+  SaveToFile("", 0, root + L"Group 1\\" + title + L"\\" + title +
+                    L" - " + ToWstr(episode_count + 1) + L".mkv");
+  helper.file_count = 0;
+  tester.Start();
+  helper.Search(root);
+  double time_changed = tester.GetElapsed();
+  results_match = results_match && helper.file_count == file_count + 1;
+
+  helper.file_count = 0;
+  helper.set_cache_only(true);
+  tester.Start();
+  helper.Search(root);
+  double time_cache_only = tester.GetElapsed();
+  results_match = results_match && helper.file_count == file_count + 1;
+
+  DeleteFolder(root);
+
+  Report(L"ScanIndex",
+         L"Files: " + ToWstr(file_count) +
+         L" | Cold: " + ToWstr(time_cold, 1) + L"ms" +
+         L" | Unchanged: " + ToWstr(time_unchanged, 1) + L"ms" +
+         L" | One file added: " + ToWstr(time_changed, 1) + L"ms" +
+         L" | Index only: " + ToWstr(time_cache_only, 1) + L"ms" +
+         L" | Results match: " + (results_match ? L"yes" : L"no"));
+}
+
+// Availability of every episode along with the next episode path, so that two
+// scans can be compared
+static std::vector<std::wstring> GetAvailability() {
+  std::vector<std::wstring> availability;
+  foreach_c_(it, AnimeDatabase.items) {
+    std::wstring episodes;
+    for (int i = 1; i <= it->second.GetAvailableEpisodeCount(); i++)
+      episodes += it->second.IsEpisodeAvailable(i) ? L'1' : L'0';
+    availability.push_back(episodes + L"|" + it->second.GetNextEpisodePath());
+  }
+  return availability;
+}
+
+static void ClearAvailability() {
+  foreach_(it, AnimeDatabase.items) {
+    for (int i = 1; i <= it->second.GetAvailableEpisodeCount(); i++)
+      it->second.SetEpisodeAvailability(i, false, EmptyString());
+    it->second.SetNextEpisodePath(EmptyString());
+  }
+}
+
+// Scans the folders of 1k anime one by one, as ScanAvailableEpisodesQuick did,
+// and all at once. 20 of the folders are the parents of the others.
+static void BenchmarkScanAnimeFolders() {
+  const int anime_count = 1000;
+  const int episode_count = 25;
+  const int group_count = 20;
+
+  ScopedAnimeDatabase database(anime_count);
+
+  std::wstring root = taiga::GetPath(taiga::kPathTest) + L"scan\\";
+  CreateScanTree(root, anime_count, episode_count);
+
+  foreach_(it, AnimeDatabase.items) {
+    std::wstring folder = root + L"Group " + ToWstr(it->first % group_count);
+    if (it->first > group_count)
+      folder += L"\\" + it->second.GetTitle();
+    it->second.SetFolder(folder);
+  }
+
+  Tester tester;
+
+  BenchmarkFileSearchHelper single_helper;
+  tester.Start();
+  foreach_r_(it, AnimeDatabase.items) {
+    single_helper.set_anime_id(it->first);
+    single_helper.set_episode_number(0);
+    single_helper.set_skip_directories(true);
+    single_helper.set_skip_files(false);
+    single_helper.set_skip_subdirectories(false);
+    single_helper.Search(it->second.GetFolder());
+  }
+  double time_single = tester.GetElapsed();
+  auto single_availability = GetAvailability();
+
+  ClearAvailability();
+
+  BenchmarkFileSearchHelper batch_helper;
+  tester.Start();
+  batch_helper.SearchAnimeFolders(false);
+  double time_batch = tester.GetElapsed();
+  auto batch_availability = GetAvailability();
+
+  DeleteFolder(root);
+
+  Report(L"ScanAnimeFolders",
+         L"Folders: " + ToWstr(anime_count) +
+         L" | One by one: " + ToWstr(time_single, 1) + L"ms" +
+         L" (" + ToWstr(single_helper.file_count) + L" files)" +
+         L" | At once: " + ToWstr(time_batch, 1) + L"ms" +
+         L" (" + ToWstr(batch_helper.file_count) + L" files)" +
+         L" | Results match: " +
+         (single_availability == batch_availability ? L"yes" : L"no"));
+}
+
+// Appends a line the way Logger::Log used to, by opening and closing the file
+// every time under a lock
+static void WriteLogLine(win::CriticalSection& critical_section,
+                         const std::wstring& path, const std::wstring& text) {
+  win::Lock lock(critical_section);
+
+  std::string output_text =
+      WstrToStr(std::wstring(GetDate()) + L" " + GetTime() + L" ");
+  output_text += "[Debug] debug.cpp:0 Benchmark | " + WstrToStr(text) + "\r\n";
+
+  std::ofstream stream;
+  stream.open(path, std::ofstream::app | std::ios::binary | std::ofstream::out);
+  if (stream.is_open()) {
+    stream.write(output_text.c_str(), output_text.size());
+    stream.close();
+  }
+}
+
+static int CountLines(const std::wstring& path) {
+  std::string file;
+  ReadFromFile(path, file);
+  return static_cast<int>(std::count(file.begin(), file.end(), '\n'));
+}
+
+// Logs 20k debug lines from all worker threads, synchronously and through the
+// queue, and measures how long a disabled level costs.
+static void BenchmarkLogging() {
+  const int line_count = 20000;
+  const int disabled_count = 1000000;
+
+  std::wstring path = taiga::GetPath(taiga::kPathTest) + L"logging";
+  CreateFolder(taiga::GetPath(taiga::kPathTest));
+  ::DeleteFile((path + L".sync.log").c_str());
+  ::DeleteFile((path + L".async.log").c_str());
+
+  Tester tester;
+
+  win::CriticalSection critical_section;
+  tester.Start();
+  win::ParallelFor(line_count, [&](size_t index, size_t worker) {
+    WriteLogLine(critical_section, path + L".sync.log",
+                 L"Line " + ToWstr(static_cast<int>(index)));
+  });
+  double time_sync = tester.GetElapsed();
+
+  double time_async = 0.0;
+  double time_async_total = 0.0;
+  {
+    class Logger logger;
+    logger.SetOutputPath(path + L".async.log");
+    logger.SetSeverityLevel(LevelDebug);
+    tester.Start();
+    win::ParallelFor(line_count, [&](size_t index, size_t worker) {
+      logger.Log(LevelDebug, __FILEW__, __LINE__, __FUNCTIONW__,
+                 L"Line " + ToWstr(static_cast<int>(index)));
+    });
+    time_async = tester.GetElapsed();
+    logger.Shutdown();
+    time_async_total = tester.GetElapsed();
+  }
+
+  int sync_lines = CountLines(path + L".sync.log");
+  int async_lines = CountLines(path + L".async.log");
+
+  // The level is checked before the message is built
+  int severity_level = LevelEmergency;
+  while (severity_level < LevelDebug && Logger.IsEnabled(severity_level + 1))
+    severity_level++;
+  Logger.SetSeverityLevel(LevelWarning);
+  tester.Start();
+  for (int i = 0; i < disabled_count; i++)
+    LOG(LevelDebug, L"Line " + ToWstr(i));
+  double time_disabled = tester.GetElapsed();
+  Logger.SetSeverityLevel(severity_level);
+
+  ::DeleteFile((path + L".sync.log").c_str());
+  ::DeleteFile((path + L".async.log").c_str());
+
+  Report(L"Logging",
+         L"Lines: " + ToWstr(line_count) +
+         L" | Synchronous: " + ToWstr(time_sync, 1) + L"ms" +
+         L" (" + ToWstr(sync_lines) + L" written)" +
+         L" | Queued: " + ToWstr(time_async, 1) + L"ms" +
+         L" (" + ToWstr(time_async_total, 1) + L"ms until written, " +
+         ToWstr(async_lines) + L" lines incl. drop notices)" +
+         L" | Disabled level x" + ToWstr(disabled_count) + L": " +
+         ToWstr(time_disabled, 1) + L"ms");
+}
+
+// Answers every request on a connection with a tiny response, and keeps the
+// connection alive until the client closes it
+static DWORD WINAPI ServeHttpConnection(LPVOID parameter) {
+  auto connection = static_cast<SOCKET>(reinterpret_cast<UINT_PTR>(parameter));
+  static const char response[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: 2\r\n"
+      "\r\n"
+      "OK";
+
+  std::string buffer;
+  char data[4096];
+  int received = 0;
+  while ((received = recv(connection, data, sizeof(data), 0)) > 0) {
+    buffer.append(data, received);
+    size_t pos = 0;
+    while ((pos = buffer.find("\r\n\r\n")) != std::string::npos) {
+      buffer.erase(0, pos + 4);
+      send(connection, response, sizeof(response) - 1, 0);
+    }
+  }
+
+  closesocket(connection);
+  return 0;
+}
+
+// Minimal HTTP server on the loopback interface, with a thread per connection
+class BenchmarkHttpServer : public win::Thread {
+public:
+  BenchmarkHttpServer() : listen_socket_(INVALID_SOCKET), port_(0) {}
+
+  bool Start() {
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+      return false;
+
+    listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int address_size = sizeof(address);
+    if (listen_socket_ == INVALID_SOCKET ||
+        bind(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+             address_size) != 0 ||
+        listen(listen_socket_, SOMAXCONN) != 0 ||
+        getsockname(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+                    &address_size) != 0)
+      return false;
+    port_ = ntohs(address.sin_port);
+
+    return CreateThread(nullptr, 0, 0);
+  }
+
+  void Stop() {
+    closesocket(listen_socket_);
+    if (GetThreadHandle())
+      WaitForSingleObject(GetThreadHandle(), INFINITE);
+    WSACleanup();
+  }
+
+  DWORD ThreadProc() {
+    while (true) {
+      SOCKET connection = accept(listen_socket_, nullptr, nullptr);
+      if (connection == INVALID_SOCKET)
+        break;
+      HANDLE thread = ::CreateThread(
+          nullptr, 0, ServeHttpConnection,
+          reinterpret_cast<LPVOID>(static_cast<UINT_PTR>(connection)), 0,
+          nullptr);
+      if (thread) {
+        CloseHandle(thread);
+      } else {
+        closesocket(connection);
+      }
+    }
+    return 0;
+  }
+
+  unsigned short port() const { return port_; }
+
+private:
+  SOCKET listen_socket_;
+  unsigned short port_;
+};
+
+static size_t DiscardHttpData(char* ptr, size_t size, size_t nmemb,
+                              void* userdata) {
+  return size * nmemb;
+}
+
+// Performs a request on its own thread with a new easy handle, the way each
+// client used to
+static DWORD WINAPI PerformHttpRequest(LPVOID parameter) {
+  auto url = reinterpret_cast<const std::string*>(parameter);
+  CURL* handle = curl_easy_init();
+  curl_easy_setopt(handle, CURLOPT_URL, url->c_str());
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, DiscardHttpData);
+  CURLcode code = curl_easy_perform(handle);
+  curl_easy_cleanup(handle);
+  return code == CURLE_OK ? 1 : 0;
+}
+
+class BenchmarkHttpClient : public base::http::Client {
+public:
+  BenchmarkHttpClient() : completed_count(nullptr), failed_count(nullptr) {}
+
+  void OnError(CURLcode error_code) { (*failed_count)++; }
+  void OnReadComplete() { (*completed_count)++; }
+
+  int* completed_count;
+  int* failed_count;
+};
+
+// Sends 500 small requests to a local server, with a thread per request as
+// before, and on the I/O thread of the HTTP engine. Both are limited to 6
+// connections to the host at a time.
+static void BenchmarkHttpEngine() {
+  const int request_count = 500;
+  const int connection_count = 6;
+  const double time_limit = 30000.0;
+
+  BenchmarkHttpServer server;
+  if (!server.Start()) {
+    Report(L"HttpEngine", L"Could not start the local server");
+    return;
+  }
+
+  std::vector<std::string> urls(request_count);
+  for (int i = 0; i < request_count; i++)
+    urls[i] = WstrToStr(L"http://127.0.0.1:" +
+                        ToWstr(static_cast<int>(server.port())) +
+                        L"/" + ToWstr(i));
+
+  Tester tester;
+
+  // Thread per request
+  int thread_succeeded = 0;
+  tester.Start();
+  for (int i = 0; i < request_count; i += connection_count) {
+    std::vector<HANDLE> threads;
+    for (int j = i; j < request_count && j < i + connection_count; j++) {
+      HANDLE thread = ::CreateThread(nullptr, 0, PerformHttpRequest,
+                                     &urls[j], 0, nullptr);
+      if (thread)
+        threads.push_back(thread);
+    }
+    foreach_(thread, threads) {
+      DWORD exit_code = 0;
+      WaitForSingleObject(*thread, INFINITE);
+      GetExitCodeThread(*thread, &exit_code);
+      thread_succeeded += exit_code;
+      CloseHandle(*thread);
+    }
+  }
+  double time_threads = tester.GetElapsed();
+
+  // Engine
+  int completed_count = 0;
+  int failed_count = 0;
+  std::unique_ptr<BenchmarkHttpClient[]> clients(
+      new BenchmarkHttpClient[request_count]);
+  tester.Start();
+  for (int i = 0; i < request_count; i++) {
+    base::http::Request request;
+    request.url.host = L"127.0.0.1";
+    request.url.port = server.port();
+    request.url.path = L"/" + ToWstr(i);
+    clients[i].completed_count = &completed_count;
+    clients[i].failed_count = &failed_count;
+    clients[i].MakeRequest(request);
+  }
+  // Completions are delivered through the message loop
+  while (completed_count + failed_count < request_count &&
+         tester.GetElapsed() < time_limit) {
+    MSG msg;
+    if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    } else {
+      MsgWaitForMultipleObjects(0, nullptr, FALSE, 10, QS_ALLINPUT);
+    }
+  }
+  double time_engine = tester.GetElapsed();
+
+  // Abandon transfers that did not complete in time, before their clients are
+  // destroyed
+  if (completed_count + failed_count < request_count)
+    base::http::Client::engine().Shutdown();
+  server.Stop();
+
+  Report(L"HttpEngine",
+         L"Requests: " + ToWstr(request_count) +
+         L" | Thread per request: " + ToWstr(time_threads, 1) + L"ms" +
+         L" (" + ToWstr(thread_succeeded) + L" succeeded)" +
+         L" | Engine: " + ToWstr(time_engine, 1) + L"ms" +
+         L" (" + ToWstr(completed_count) + L" succeeded, " +
+         ToWstr(failed_count) + L" failed)");
+}
+
+// Uncompresses a large gzipped list in one piece, the way responses used to be
+// buffered, and in pieces of the size that curl hands to the write callback
+static void BenchmarkGzipStream() {
+  const size_t data_size = 8 << 20;
+  const size_t chunk_size = CURL_MAX_WRITE_SIZE;
+
+  std::string data = "<myanimelist>";
+  for (int i = 0; data.size() < data_size; i++) {
+    std::string id = WstrToStr(ToWstr(i));
+    data += "<anime><series_animedb_id>" + id + "</series_animedb_id>"
+            "<series_title>Anime " + id + "</series_title>"
+            "<my_watched_episodes>" + WstrToStr(ToWstr(i % 26)) +
+            "</my_watched_episodes><my_status>2</my_status></anime>";
+  }
+  data += "</myanimelist>";
+
+  z_stream stream = {0};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = (Bytef*)&data[0];
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef*)&compressed[0];
+  stream.avail_out = compressed.size();
+  deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+
+  Tester tester;
+
+  // Whole response
+  tester.Start();
+  std::string output;
+  bool whole_result = UncompressGzippedString(compressed, output);
+  double time_whole = tester.GetElapsed();
+  size_t whole_size = output.size();
+  size_t whole_peak = compressed.size() + output.capacity();
+  std::string().swap(output);
+
+  // Pieces
+  tester.Start();
+  GzipStream gzip_stream;
+  bool stream_result = true;
+  size_t stream_size = 0;
+  size_t stream_peak = 0;
+  for (size_t pos = 0; pos < compressed.size(); pos += chunk_size) {
+    output.clear();
+    size_t size = (std::min)(chunk_size, compressed.size() - pos);
+    if (!gzip_stream.Uncompress(&compressed[pos], size, output)) {
+      stream_result = false;
+      break;
+    }
+    stream_size += output.size();
+    stream_peak = (std::max)(stream_peak, size + output.capacity());
+  }
+  stream_result = stream_result && gzip_stream.finished();
+  double time_stream = tester.GetElapsed();
+
+  Report(L"GzipStream",
+         L"Size: " + ToWstr(static_cast<int>(compressed.size() >> 10)) +
+         L" KiB -> " + ToWstr(static_cast<int>(data.size() >> 10)) + L" KiB" +
+         L" | Whole: " + ToWstr(time_whole, 1) + L"ms, " +
+         ToWstr(static_cast<int>(whole_peak >> 10)) + L" KiB buffered" +
+         (whole_result && whole_size == data.size() ? L"" : L" (failed)") +
+         L" | Pieces: " + ToWstr(time_stream, 1) + L"ms, " +
+         ToWstr(static_cast<int>(stream_peak >> 10)) + L" KiB buffered" +
+         (stream_result && stream_size == data.size() ? L"" : L" (failed)"));
+}
+
+// Dispatches requests the way HttpManager used to, by scanning the whole queue
+// and erasing from the middle of it
+static void ScanHttpRequests(std::vector<HttpRequest>& requests,
+                             std::map<std::wstring, unsigned int>& connections,
+                             std::deque<std::wstring>& in_flight) {
+  const unsigned int max_connections = 10;
+  const unsigned int max_connections_per_hostname = 6;
+
+  unsigned int connection_count = 0;
+  foreach_(it, connections)
+    connection_count += it->second;
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (connection_count == max_connections)
+      break;
+    const std::wstring& host = requests.at(i).url.host;
+    if (connections[host] == max_connections_per_hostname)
+      continue;
+    connection_count++;
+    connections[host]++;
+    in_flight.push_back(host);
+    requests.erase(requests.begin() + i);
+    i--;
+  }
+}
+
+// Queues requests for many hosts in all priorities, cancels some of them, and
+// completes the rest one at a time, dispatching new requests after each one
+static void BenchmarkHttpQueue() {
+  const int request_count = 5000;
+  const int host_count = 40;
+  const int cancel_interval = 10;
+
+  std::vector<HttpRequest> requests(request_count);
+  for (int i = 0; i < request_count; i++)
+    requests[i].url.host = L"host" + ToWstr(i % host_count) + L".example";
+
+  Tester tester;
+
+  // Vector
+  tester.Start();
+  std::vector<HttpRequest> queued_requests(requests);
+  for (int i = 0; i < request_count; i += cancel_interval) {
+    const std::wstring& uid = requests[i].uid;
+    for (auto it = queued_requests.begin(); it != queued_requests.end(); ++it) {
+      if (it->uid == uid) {
+        queued_requests.erase(it);
+        break;
+      }
+    }
+  }
+  std::map<std::wstring, unsigned int> connections;
+  std::deque<std::wstring> in_flight;
+  int scan_dispatched = 0;
+  ScanHttpRequests(queued_requests, connections, in_flight);
+  while (!in_flight.empty()) {
+    connections[in_flight.front()]--;
+    in_flight.pop_front();
+    scan_dispatched++;
+    ScanHttpRequests(queued_requests, connections, in_flight);
+  }
+  double time_scan = tester.GetElapsed();
+
+  // Queue
+  tester.Start();
+  taiga::HttpQueue queue;
+  for (int i = 0; i < request_count; i++)
+    queue.Push(requests[i], static_cast<taiga::HttpPriority>(
+                                i % taiga::kHttpPriorityCount));
+  for (int i = 0; i < request_count; i += cancel_interval)
+    queue.Cancel(requests[i].uid);
+  int queue_dispatched = 0;
+  HttpRequest request;
+  while (queue.Pop(request))
+    in_flight.push_back(request.url.host);
+  while (!in_flight.empty()) {
+    queue.FreeConnection(in_flight.front());
+    in_flight.pop_front();
+    queue_dispatched++;
+    while (queue.Pop(request))
+      in_flight.push_back(request.url.host);
+  }
+  double time_queue = tester.GetElapsed();
+
+  std::wstring delays;
+  for (int i = 0; i < taiga::kHttpPriorityCount; i++) {
+    const auto& stats = queue.stats(static_cast<taiga::HttpPriority>(i));
+    if (stats.count)
+      delays += L" " + ToWstr(static_cast<ULONG>(stats.total_delay /
+                                                 stats.count)) + L"ms";
+  }
+
+  Report(L"HttpQueue",
+         L"Requests: " + ToWstr(request_count) +
+         L", hosts: " + ToWstr(host_count) +
+         L" | Vector: " + ToWstr(time_scan, 1) + L"ms" +
+         L" (" + ToWstr(scan_dispatched) + L" sent)" +
+         L" | Queue: " + ToWstr(time_queue, 1) + L"ms" +
+         L" (" + ToWstr(queue_dispatched) + L" sent," +
+         L" average delay by priority:" + delays + L")");
+}
+
+#endif  // TAIGA_BENCHMARKS
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool RunBenchmark(const std::wstring& name) {
+#ifdef TAIGA_BENCHMARKS
+  bool run_all = name.empty() || IsEqual(name, L"all");
+
+  #define RUN_BENCHMARK(n, f) \
+    if (run_all || IsEqual(name, n)) { f(); found = true; }
+  bool found = false;
+  RUN_BENCHMARK(L"ScoreTitle", BenchmarkScoreTitle);
+  RUN_BENCHMARK(L"ExamineTitle", BenchmarkExamineTitle);
+  RUN_BENCHMARK(L"CleanTitle", BenchmarkCleanTitle);
+  RUN_BENCHMARK(L"LoadDatabase", BenchmarkLoadDatabase);
+  RUN_BENCHMARK(L"LibraryJournal", BenchmarkLibraryJournal);
+  RUN_BENCHMARK(L"MergeLibrary", BenchmarkMergeLibrary);
+  RUN_BENCHMARK(L"HistoryQueue", BenchmarkHistoryQueue);
+  RUN_BENCHMARK(L"HistoryUpload", BenchmarkHistoryUpload);
+  RUN_BENCHMARK(L"FeedFilter", BenchmarkFeedFilter);
+  RUN_BENCHMARK(L"FeedArchive", BenchmarkFeedArchive);
+  RUN_BENCHMARK(L"FeedParser", BenchmarkFeedParser);
+  RUN_BENCHMARK(L"FeedMerge", BenchmarkFeedMerge);
+  RUN_BENCHMARK(L"FeedExamine", BenchmarkFeedExamine);
+  RUN_BENCHMARK(L"ScanFolders", BenchmarkScanFolders);
+  RUN_BENCHMARK(L"ScanIndex", BenchmarkScanIndex);
+  RUN_BENCHMARK(L"ScanAnimeFolders", BenchmarkScanAnimeFolders);
+  RUN_BENCHMARK(L"Logging", BenchmarkLogging);
+  RUN_BENCHMARK(L"HttpEngine", BenchmarkHttpEngine);
+  RUN_BENCHMARK(L"GzipStream", BenchmarkGzipStream);
+  RUN_BENCHMARK(L"HttpQueue", BenchmarkHttpQueue);
+  #undef RUN_BENCHMARK
+
+  if (!found)
+    LOG(LevelWarning, L"Unknown benchmark: " + name);
+
+  return found;
+#else
+  LOG(LevelWarning, L"Benchmarks are not included in this build: " + name);
+  return false;
+#endif
+}
+
 } // namespace debug
\ No newline at end of file
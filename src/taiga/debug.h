@@ -29,6 +29,7 @@ class Tester {
 
   void Start();
   void End(std::wstring str, bool display_result);
+  double GetElapsed();
 
  private:
   double frequency_;
@@ -38,6 +39,11 @@ class Tester {
 void Print(std::wstring text);
 void Test();
 
+// Benchmarks are run with the "-benchmark <name>" command line argument, and
+// their results are written to the log file. They are only compiled into
+// builds that define TAIGA_BENCHMARKS, which debug builds do by default.
+bool RunBenchmark(const std::wstring& name);
+
 }  // namespace debug
 
 #endif  // TAIGA_TAIGA_DEBUG_H
\ No newline at end of file
@@ -16,6 +16,8 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
@@ -39,6 +41,35 @@ namespace taiga {
 const unsigned int kMaxSimultaneousConnections = 10;
 const unsigned int kMaxSimultaneousConnectionsPerHostname = 6;
 
+static HttpPriority GetPriority(HttpClientMode mode) {
+  switch (mode) {
+    // Requests that the user is waiting for
+    case kHttpServiceAuthenticateUser:
+    case kHttpServiceGetMetadataById:
+    case kHttpServiceGetMetadataByIdV2:
+    case kHttpServiceSearchTitle:
+    case kHttpFeedDownload:
+    case kHttpFeedDownloadAll:
+    case kHttpTwitterAuth:
+    case kHttpTaigaUpdateDownload:
+      return kHttpPriorityInteractive;
+    case kHttpServiceAddLibraryEntry:
+    case kHttpServiceDeleteLibraryEntry:
+    case kHttpServiceGetLibraryEntries:
+    case kHttpServiceUpdateLibraryEntry:
+    case kHttpTwitterRequest:
+    case kHttpTwitterPost:
+      return kHttpPrioritySync;
+    case kHttpFeedCheck:
+    case kHttpFeedCheckAuto:
+    case kHttpTaigaUpdateCheck:
+      return kHttpPriorityFeed;
+    case kHttpGetLibraryEntryImage:
+    default:
+      return kHttpPriorityPrefetch;
+  }
+}
+
 HttpClient::HttpClient()
     : mode_(kHttpSilent) {
   // The default header (e.g. "User-Agent: Taiga/1.0") will be used, unless
@@ -138,6 +169,16 @@ HttpClient& HttpManager::GetClient(HttpRequest& request) {
 }
 
 void HttpManager::CancelRequest(base::uid_t uid) {
+#ifdef TAIGA_HTTP_MULTITHREADED
+  {
+    win::Lock lock(critical_section_);
+    if (queue_.Cancel(uid)) {
+      LOG(LevelDebug, L"Removed from queue. ID: " + uid);
+      return;
+    }
+  }
+#endif
+
   if (clients_.count(uid)) {
     auto& client = clients_[uid];
     if (client.busy())
@@ -153,7 +194,7 @@ void HttpManager::MakeRequest(HttpRequest& request, HttpClientMode mode) {
   HttpClient& client = GetClient(request);
   client.set_mode(mode);
 
-  AddToQueue(request);
+  AddToQueue(request, mode);
   ProcessQueue();
 }
 
@@ -161,7 +202,7 @@ void HttpManager::MakeRequest(HttpClient& client, HttpRequest& request,
                               HttpClientMode mode) {
   client.set_mode(mode);
 
-  AddToQueue(request);
+  AddToQueue(request, mode);
   ProcessQueue();
 }
 
@@ -179,6 +220,16 @@ void HttpManager::HandleError(HttpResponse& response, const string_t& error) {
     case kHttpServiceUpdateLibraryEntry:
       ServiceManager.HandleHttpError(client.response_, error);
       break;
+
+    case kHttpFeedCheck:
+    case kHttpFeedCheckAuto: {
+      Feed* feed = reinterpret_cast<Feed*>(response.parameter);
+      if (feed) {
+        bool automatic = client.mode() == kHttpFeedCheckAuto;
+        Aggregator.HandleFeedCheckError(*feed, response, automatic);
+      }
+      break;
+    }
   }
 
   FreeConnection(client.request_.url.host);
@@ -218,7 +269,7 @@ void HttpManager::HandleResponse(HttpResponse& response) {
       Feed* feed = reinterpret_cast<Feed*>(response.parameter);
       if (feed) {
         bool automatic = client.mode() == kHttpFeedCheckAuto;
-        Aggregator.HandleFeedCheck(*feed, automatic);
+        Aggregator.HandleFeedCheck(*feed, response, automatic);
       }
       break;
     }
@@ -239,7 +290,7 @@ void HttpManager::HandleResponse(HttpResponse& response) {
       break;
 
     case kHttpTaigaUpdateCheck:
-      if (Taiga.Updater.ParseData(response.body))
+      if (Taiga.Updater.ParseData(response.body()))
         if (Taiga.Updater.IsDownloadAllowed())
           break;
       ui::OnUpdateFinished();
@@ -267,18 +318,37 @@ void HttpManager::FreeMemory() {
 }
 
 void HttpManager::Shutdown() {
+  base::http::Client::engine().Shutdown();
   clients_.clear();
+
+#ifdef TAIGA_HTTP_MULTITHREADED
+  win::Lock lock(critical_section_);
+
+  for (int i = 0; i < kHttpPriorityCount; i++) {
+    const auto& stats = queue_.stats(static_cast<HttpPriority>(i));
+    if (!stats.count)
+      continue;
+    UINT64 average_delay = stats.total_delay / stats.count;
+    LOG(LevelDebug, L"Priority: " + ToWstr(i) +
+                    L" | Requests: " + ToWstr(static_cast<ULONG>(stats.count)) +
+                    L" | Average delay: " + ToWstr(average_delay) + L" ms" +
+                    L" | Max delay: " +
+                    ToWstr(static_cast<ULONG>(stats.max_delay)) + L" ms");
+  }
+
+  queue_.Clear();
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void HttpManager::AddToQueue(HttpRequest& request) {
+void HttpManager::AddToQueue(HttpRequest& request, HttpClientMode mode) {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
   LOG(LevelDebug, L"ID: " + request.uid);
 
-  requests_.push_back(request);
+  queue_.Push(request, GetPriority(mode));
 #else
   HttpClient& client = clients_[request.uid];
   client.MakeRequest(request);
@@ -289,31 +359,15 @@ void HttpManager::ProcessQueue() {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
-  unsigned int connections = 0;
-  foreach_(it, connections_)
-    connections += it->second;
-
-  for (size_t i = 0; i < requests_.size(); i++) {
-    if (connections == kMaxSimultaneousConnections) {
-      LOG(LevelDebug, L"Reached max connections");
-      break;
-    }
-
-    HttpRequest& request = requests_.at(i);
-    if (connections_[request.url.host] == kMaxSimultaneousConnectionsPerHostname) {
-      LOG(LevelDebug, L"Reached max connections for hostname: " + request.url.host);
-      continue;
-    } else {
-      connections++;
-      connections_[request.url.host]++;
-
-      HttpClient& client = clients_[request.uid];
-      client.MakeRequest(request);
-
-      requests_.erase(requests_.begin() + i);
-      i--;
-    }
+  HttpRequest request;
+  while (queue_.Pop(request)) {
+    HttpClient& client = clients_[request.uid];
+    client.MakeRequest(request);
   }
+
+  if (queue_.size())
+    LOG(LevelDebug,
+        L"Queued requests: " + ToWstr(static_cast<ULONG>(queue_.size())));
 #endif
 }
 
@@ -321,7 +375,7 @@ void HttpManager::AddConnection(const string_t& hostname) {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
-  connections_[hostname]++;
+  queue_.AddConnection(hostname);
 #endif
 }
 
@@ -329,12 +383,145 @@ void HttpManager::FreeConnection(const string_t& hostname) {
 #ifdef TAIGA_HTTP_MULTITHREADED
   win::Lock lock(critical_section_);
 
-  if (connections_[hostname] > 0) {
-    connections_[hostname]--;
+  queue_.FreeConnection(hostname);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+HttpQueueStats::HttpQueueStats()
+    : count(0), total_delay(0), max_delay(0) {
+}
+
+HttpQueue::Host::Host()
+    : connections(0) {
+  for (int i = 0; i < kHttpPriorityCount; i++)
+    ready[i] = false;
+}
+
+HttpQueue::HttpQueue()
+    : connections_(0) {
+}
+
+void HttpQueue::Clear() {
+  connections_ = 0;
+  entries_.clear();
+  hosts_.clear();
+  for (int i = 0; i < kHttpPriorityCount; i++) {
+    ready_hosts_[i].clear();
+    stats_[i] = HttpQueueStats();
+  }
+}
+
+bool HttpQueue::Cancel(const base::uid_t& uid) {
+  auto it = entries_.find(uid);
+  if (it == entries_.end())
+    return false;
+
+  // The entry is skipped when it reaches the front of its queue
+  it->second->cancelled = true;
+  entries_.erase(it);
+  return true;
+}
+
+bool HttpQueue::Pop(HttpRequest& request) {
+  if (connections_ >= kMaxSimultaneousConnections)
+    return false;
+
+  for (int priority = 0; priority < kHttpPriorityCount; priority++) {
+    auto& ready_hosts = ready_hosts_[priority];
+
+    while (!ready_hosts.empty()) {
+      Host& host = *ready_hosts.front();
+      ready_hosts.pop_front();
+      host.ready[priority] = false;
+
+      auto& requests = host.requests[priority];
+      while (!requests.empty() && requests.front().cancelled)
+        requests.pop_front();
+      if (requests.empty())
+        continue;
+
+      // The host is ready again when one of its connections is freed
+      if (host.connections >= kMaxSimultaneousConnectionsPerHostname)
+        continue;
+
+      Entry& entry = requests.front();
+      DWORD delay = GetTickCount() - entry.time;
+      auto& stats = stats_[priority];
+      stats.count++;
+      stats.total_delay += delay;
+      stats.max_delay = (std::max)(stats.max_delay, delay);
+
+      request = entry.request;
+      entries_.erase(request.uid);
+      requests.pop_front();
+
+      host.connections++;
+      connections_++;
+
+      // Other hosts take their turn before the next request of this one
+      if (!requests.empty())
+        SetReady(host, priority);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void HttpQueue::Push(const HttpRequest& request, HttpPriority priority) {
+  Host& host = GetHost(request.url.host);
+
+  Entry entry;
+  entry.cancelled = false;
+  entry.request = request;
+  entry.time = GetTickCount();
+  host.requests[priority].push_back(entry);
+  entries_[request.uid] = &host.requests[priority].back();
+
+  SetReady(host, priority);
+}
+
+void HttpQueue::AddConnection(const std::wstring& hostname) {
+  GetHost(hostname).connections++;
+  connections_++;
+}
+
+void HttpQueue::FreeConnection(const std::wstring& hostname) {
+  Host& host = GetHost(hostname);
+
+  if (host.connections > 0) {
+    host.connections--;
+    connections_--;
   } else {
     LOG(LevelError, L"Connections for hostname was already zero: " + hostname);
+    return;
+  }
+
+  for (int priority = 0; priority < kHttpPriorityCount; priority++)
+    if (!host.requests[priority].empty())
+      SetReady(host, priority);
+}
+
+size_t HttpQueue::size() const {
+  return entries_.size();
+}
+
+const HttpQueueStats& HttpQueue::stats(HttpPriority priority) const {
+  return stats_[priority];
+}
+
+HttpQueue::Host& HttpQueue::GetHost(const std::wstring& hostname) {
+  return hosts_[hostname];
+}
+
+void HttpQueue::SetReady(Host& host, int priority) {
+  if (!host.ready[priority]) {
+    host.ready[priority] = true;
+    ready_hosts_[priority].push_back(&host);
   }
-#endif
 }
 
 }  // namespace taiga
\ No newline at end of file
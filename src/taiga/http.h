@@ -19,7 +19,9 @@
 #ifndef TAIGA_TAIGA_HTTP_H
 #define TAIGA_TAIGA_HTTP_H
 
+#include <deque>
 #include <map>
+#include <unordered_map>
 
 #include "base/http.h"
 #include "base/types.h"
@@ -54,6 +56,15 @@ enum HttpClientMode {
   kHttpTaigaUpdateDownload
 };
 
+// Requests of a higher priority are always sent first
+enum HttpPriority {
+  kHttpPriorityInteractive,
+  kHttpPrioritySync,
+  kHttpPriorityFeed,
+  kHttpPriorityPrefetch,
+  kHttpPriorityCount
+};
+
 class HttpClient : public base::http::Client {
 public:
   friend class HttpManager;
@@ -75,6 +86,62 @@ private:
   HttpClientMode mode_;
 };
 
+class HttpQueueStats {
+public:
+  HttpQueueStats();
+
+  unsigned int count;
+  QWORD total_delay;  // milliseconds
+  DWORD max_delay;    // milliseconds
+};
+
+// Keeps a FIFO queue of requests for each host and priority. A request is taken
+// from the highest priority that has one for a host with a free connection,
+// and hosts take turns within a priority. Requests can be cancelled while they
+// are queued.
+class HttpQueue {
+public:
+  HttpQueue();
+
+  void Clear();
+  bool Cancel(const base::uid_t& uid);
+  bool Pop(HttpRequest& request);
+  void Push(const HttpRequest& request, HttpPriority priority);
+
+  void AddConnection(const std::wstring& hostname);
+  void FreeConnection(const std::wstring& hostname);
+
+  size_t size() const;
+  const HttpQueueStats& stats(HttpPriority priority) const;
+
+private:
+  class Entry {
+  public:
+    bool cancelled;
+    HttpRequest request;
+    DWORD time;
+  };
+
+  class Host {
+  public:
+    Host();
+
+    unsigned int connections;
+    bool ready[kHttpPriorityCount];
+    std::deque<Entry> requests[kHttpPriorityCount];
+  };
+
+  Host& GetHost(const std::wstring& hostname);
+  void SetReady(Host& host, int priority);
+
+  unsigned int connections_;
+  // Entries are never moved while they are queued
+  std::unordered_map<std::wstring, Entry*> entries_;
+  std::unordered_map<std::wstring, Host> hosts_;
+  std::deque<Host*> ready_hosts_[kHttpPriorityCount];
+  HttpQueueStats stats_[kHttpPriorityCount];
+};
+
 class HttpManager {
 public:
   HttpClient& GetClient(HttpRequest& request);
@@ -91,15 +158,14 @@ public:
   void Shutdown();
 
 private:
-  void AddToQueue(HttpRequest& request);
+  void AddToQueue(HttpRequest& request, HttpClientMode mode);
   void ProcessQueue();
   void AddConnection(const string_t& hostname);
   void FreeConnection(const string_t& hostname);
 
   std::map<std::wstring, HttpClient> clients_;
-  std::map<std::wstring, unsigned int> connections_;
   win::CriticalSection critical_section_;
-  std::vector<HttpRequest> requests_;
+  HttpQueue queue_;
 };
 
 }  // namespace taiga
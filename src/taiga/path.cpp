@@ -56,14 +56,22 @@ std::wstring GetPath(PathType type) {
       return data_path + L"db\\";
     case kPathDatabaseAnime:
       return data_path + L"db\\anime.xml";
+    case kPathDatabaseAnimeBinary:
+      return data_path + L"db\\anime.bin";
+    case kPathDatabaseAnimeTitles:
+      return data_path + L"db\\anime_titles.bin";
     case kPathDatabaseImage:
       return data_path + L"db\\image\\";
+    case kPathDatabaseScanIndex:
+      return data_path + L"db\\scan_index.bin";
     case kPathDatabaseSeason:
       return data_path + L"db\\season\\";
     case kPathFeed:
       return data_path + L"feed\\";
     case kPathFeedHistory:
       return data_path + L"feed\\history.xml";
+    case kPathFeedHistoryJournal:
+      return data_path + L"feed\\history.journal";
     case kPathMedia:
       return data_path + L"media.xml";
     case kPathSettings:
@@ -82,6 +90,8 @@ std::wstring GetPath(PathType type) {
       return data_path + L"user\\" + GetUserDirectoryName() + L"\\history.xml";
     case kPathUserLibrary:
       return data_path + L"user\\" + GetUserDirectoryName() + L"\\anime.xml";
+    case kPathUserLibraryJournal:
+      return data_path + L"user\\" + GetUserDirectoryName() + L"\\anime.journal";
   }
 }
 
@@ -27,10 +27,14 @@ enum PathType {
   kPathData,
   kPathDatabase,
   kPathDatabaseAnime,
+  kPathDatabaseAnimeBinary,
+  kPathDatabaseAnimeTitles,
   kPathDatabaseImage,
+  kPathDatabaseScanIndex,
   kPathDatabaseSeason,
   kPathFeed,
   kPathFeedHistory,
+  kPathFeedHistoryJournal,
   kPathMedia,
   kPathSettings,
   kPathTest,
@@ -39,7 +43,8 @@ enum PathType {
   kPathThemeCurrent,
   kPathUser,
   kPathUserHistory,
-  kPathUserLibrary
+  kPathUserLibrary,
+  kPathUserLibraryJournal
 };
 
 std::wstring GetPath(PathType type);
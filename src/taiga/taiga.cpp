@@ -23,12 +23,15 @@
 #include "library/history.h"
 #include "taiga/announce.h"
 #include "taiga/api.h"
+#include "taiga/debug.h"
 #include "taiga/dummy.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
 #include "taiga/taiga.h"
 #include "taiga/version.h"
 #include "track/media.h"
+#include "track/recognition.h"
+#include "track/search.h"
 #include "ui/dialog.h"
 #include "ui/menu.h"
 #include "ui/theme.h"
@@ -85,6 +88,13 @@ BOOL App::InitInstance() {
   // Load data
   LoadData();
 
+  // Run benchmarks and exit, if requested
+  if (!benchmark.empty()) {
+    debug::RunBenchmark(benchmark);
+    Logger.Shutdown();
+    return FALSE;
+  }
+
   DummyAnime.Initialize();
   DummyEpisode.Initialize();
 
@@ -117,7 +127,14 @@ void App::Uninitialize() {
   // Save
   Settings.Save();
   AnimeDatabase.SaveDatabase();
-  Aggregator.SaveArchive();
+  AnimeDatabase.CompactList();
+  Meow.SaveTitleCache();
+  file_search_helper.SaveIndex();
+  Aggregator.CompactArchive();
+
+  // Flush the log before static objects start to be destroyed; anything
+  // logged after this point is written directly
+  Logger.Shutdown();
 
   // Exit
   PostQuitMessage();
@@ -137,6 +154,10 @@ void App::ParseCommandLineArguments() {
       debug_mode = true;
       Logger.SetSeverityLevel(LevelDebug);
       LOG(LevelDebug, argument);
+    } else if (argument == L"-benchmark" && benchmark.empty()) {
+      benchmark = i + 1 < argument_count ? argument_list[++i] : L"all";
+      if (!debug_mode)
+        Logger.SetSeverityLevel(LevelInformational);
     }
   }
 
@@ -155,6 +176,8 @@ void App::LoadData() {
   AnimeDatabase.LoadDatabase();
   AnimeDatabase.LoadList();
   AnimeDatabase.ClearInvalidItems();
+  Meow.LoadTitleCache();
+  file_search_helper.LoadIndex();
 
   History.Load();
 }
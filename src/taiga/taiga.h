@@ -55,6 +55,7 @@ public:
   void LoadData();
 
   int current_tip_type, play_status;
+  std::wstring benchmark;
   bool debug_mode;
   bool logged_in;
   base::SemanticVersion version;
@@ -154,6 +154,7 @@ void TimerManager::UpdateUi() {
 
 void TimerManager::OnTick() {
   MediaPlayers.CheckRunningPlayers();
+  History.queue.RetryDelayedItems();
   Stats.uptime++;
 
   UpdateEnabledState();
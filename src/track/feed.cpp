@@ -17,8 +17,10 @@
 */
 
 #include <algorithm>
+#include <unordered_set>
 
 #include "base/base64.h"
+#include "base/binary.h"
 #include "base/file.h"
 #include "base/foreach.h"
 #include "base/html.h"
@@ -31,10 +33,13 @@
 #include "taiga/http.h"
 #include "taiga/path.h"
 #include "taiga/settings.h"
+#include "taiga/taiga.h"
 #include "track/feed.h"
+#include "track/feed_parser.h"
 #include "track/recognition.h"
 #include "ui/dialog.h"
 #include "ui/ui.h"
+#include "win/win_thread.h"
 
 class Aggregator Aggregator;
 
@@ -85,14 +90,36 @@ bool FeedItem::operator<(const FeedItem& item) const {
 
 Feed::Feed()
     : category(kFeedCategoryLink),
-      download_index(-1) {
+      download_index(-1),
+      episode_cache_database_version_(0),
+      episode_cache_title_version_(0) {
 }
 
 bool Feed::Check(const std::wstring& source, bool automatic) {
-  if (source.empty())
+  // Multiple addresses can be separated by spaces
+  std::vector<std::wstring> urls;
+  Split(source, L" ", urls);
+  foreach_(url, urls)
+    Trim(*url, L" \t\r\n");
+  RemoveEmptyStrings(urls);
+  if (urls.empty())
     return false;
 
-  link = source;
+  link = urls.front();
+
+  // Validators are kept for the sources that are still in use
+  std::vector<FeedSource> previous_sources;
+  previous_sources.swap(sources);
+  foreach_(url, urls) {
+    sources.resize(sources.size() + 1);
+    foreach_(it, previous_sources) {
+      if (it->url == *url) {
+        sources.back() = *it;
+        break;
+      }
+    }
+    sources.back().url = *url;
+  }
 
   switch (category) {
     case kFeedCategoryLink:
@@ -100,15 +127,26 @@ bool Feed::Check(const std::wstring& source, bool automatic) {
       break;
   }
 
-  HttpRequest http_request;
-  http_request.url = link;
-  http_request.parameter = reinterpret_cast<LPARAM>(this);
-
   auto client_mode = automatic ?
       taiga::kHttpFeedCheckAuto : taiga::kHttpFeedCheck;
-  auto& client = ConnectionManager.GetClient(http_request);
-  client.set_download_path(GetDataPath() + L"feed.xml");
-  ConnectionManager.MakeRequest(client, http_request, client_mode);
+
+  // Sources are requested at the same time, and responses to any previous
+  // requests are ignored from now on
+  foreach_(it, sources) {
+    HttpRequest http_request;
+    http_request.url = it->url;
+    http_request.parameter = reinterpret_cast<LPARAM>(this);
+    if (!it->etag.empty())
+      http_request.header[L"If-None-Match"] = it->etag;
+    if (!it->last_modified.empty())
+      http_request.header[L"If-Modified-Since"] = it->last_modified;
+
+    it->request_uid = http_request.uid;
+    it->modified = false;
+
+    auto& client = ConnectionManager.GetClient(http_request);
+    ConnectionManager.MakeRequest(client, http_request, client_mode);
+  }
 
   return true;
 }
@@ -150,12 +188,50 @@ bool Feed::Download(int index) {
 }
 
 bool Feed::ExamineData() {
-  foreach_(it, items) {
-    // Examine title and compare with anime list items
-    Meow.ExamineTitle(it->title, it->episode_data,
+  auto titles = Meow.GetTitleSnapshot();
+
+  // Previous results are discarded if they might have been different now
+  Date date = GetDateJapan();
+  if (episode_cache_database_version_ != AnimeDatabase.GetVersion() ||
+      episode_cache_title_version_ != Meow.GetTitleVersion() ||
+      episode_cache_date_ != date) {
+    episode_cache_.clear();
+    episode_cache_database_version_ = AnimeDatabase.GetVersion();
+    episode_cache_title_version_ = Meow.GetTitleVersion();
+    episode_cache_date_ = date;
+  }
+
+  // Items that were seen before are not recognized again
+  std::vector<size_t> new_items;
+  for (size_t i = 0; i < items.size(); i++) {
+    auto it = episode_cache_.find(items[i].title);
+    if (it != episode_cache_.end()) {
+      static_cast<anime::Episode&>(items[i].episode_data) = it->second;
+    } else {
+      new_items.push_back(i);
+    }
+  }
+
+  // Examine titles and compare with anime list items. Items are independent of
+  // each other, so they are recognized in parallel.
+  std::vector<RecognitionContext> contexts(win::GetWorkerCount());
+  foreach_(context, contexts)
+    context->titles = titles;
+  win::ParallelFor(new_items.size(), [&](size_t index, size_t worker) {
+    auto& context = contexts[worker];
+    auto& item = items[new_items[index]];
+    Meow.ExamineTitle(context, item.title, item.episode_data,
                       true, true, true, true, false);
-    Meow.MatchDatabase(it->episode_data, true, true);
+    Meow.MatchDatabase(context, item.episode_data, true, true);
+  });
+
+  // Only the results for current items are kept
+  std::unordered_map<std::wstring, anime::Episode> episode_cache;
+  foreach_c_(it, items)
+    episode_cache[it->title] = it->episode_data;
+  episode_cache_.swap(episode_cache);
 
+  foreach_(it, items) {
     // Update last aired episode number
     if (it->episode_data.anime_id > anime::ID_UNKNOWN) {
       auto anime_item = AnimeDatabase.FindItem(it->episode_data.anime_id);
@@ -181,7 +257,7 @@ bool Feed::ExamineData() {
   return Aggregator.filter_manager.IsItemDownloadAvailable(*this);
 }
 
-std::wstring Feed::GetDataPath() {
+static std::wstring GetFeedDataPath(const std::wstring& link) {
   std::wstring path = taiga::GetPath(taiga::kPathFeed);
 
   if (!link.empty()) {
@@ -192,51 +268,81 @@ std::wstring Feed::GetDataPath() {
   return path;
 }
 
+std::wstring Feed::GetDataPath() {
+  return GetFeedDataPath(link);
+}
+
+FeedSource* Feed::FindSource(const base::uid_t& request_uid) {
+  foreach_(it, sources)
+    if (it->request_uid == request_uid)
+      return &(*it);
+
+  return nullptr;
+}
+
+bool Feed::IsCheckPending() const {
+  foreach_c_(it, sources)
+    if (!it->request_uid.empty())
+      return true;
+
+  return false;
+}
+
 bool Feed::Load() {
   std::wstring file = GetDataPath() + L"feed.xml";
-  items.clear();
 
-  xml_document document;
-  xml_parse_result parse_result = document.load_file(file.c_str());
+  std::string data;
+  if (!ReadFromFile(file, data)) {
+    items.clear();
+    return false;
+  }
+
+  return Load(StrToWstr(data));
+}
+
+bool Feed::Load(const std::wstring& data) {
+  GenericFeed feed;
+  bool result = ReadItems(data, feed);
+
+  title = feed.title;
+  link = feed.link;
+  description = feed.description;
+  items.swap(feed.items);
+
+  return result;
+}
 
-  if (parse_result.status != pugi::status_ok)
+bool Feed::ReadItems(const std::wstring& data, GenericFeed& output) {
+  output.items.clear();
+
+  // Read channel information and items
+  if (!ParseFeed(data, output)) {
+    output.items.clear();
     return false;
+  }
 
-  // Read channel information
-  xml_node channel = document.child(L"rss").child(L"channel");
-  title = XmlReadStrValue(channel, L"title");
-  link = XmlReadStrValue(channel, L"link");
-  description = XmlReadStrValue(channel, L"description");
-
-  // Read items
-  foreach_xmlnode_(item, channel, L"item") {
-    // Read data
-    items.resize(items.size() + 1);
-    items.back().index = items.size() - 1;
-    items.back().category = XmlReadStrValue(item, L"category");
-    items.back().title = XmlReadStrValue(item, L"title");
-    items.back().link = XmlReadStrValue(item, L"link");
-    items.back().description = XmlReadStrValue(item, L"description");
-
-    // Remove if title or link is empty
-    if (category == kFeedCategoryLink) {
-      if (items.back().title.empty() || items.back().link.empty()) {
-        items.pop_back();
-        continue;
-      }
-    }
+  // Remove if title or link is empty
+  if (category == kFeedCategoryLink) {
+    output.items.erase(std::remove_if(output.items.begin(), output.items.end(),
+        [](const FeedItem& item) {
+          return item.title.empty() || item.link.empty();
+        }), output.items.end());
+  }
 
+  for (size_t i = 0; i < output.items.size(); i++) {
+    FeedItem& item = output.items[i];
+    item.index = i;
     // Clean up title
-    DecodeHtmlEntities(items.back().title);
-    Replace(items.back().title, L"\\'", L"'");
+    DecodeHtmlEntities(item.title);
+    Replace(item.title, L"\\'", L"'");
     // Clean up description
-    Replace(items.back().description, L"<br/>", L"\n");
-    Replace(items.back().description, L"<br />", L"\n");
-    StripHtmlTags(items.back().description);
-    DecodeHtmlEntities(items.back().description);
-    Trim(items.back().description, L" \n");
-    Aggregator.ParseDescription(items.back(), link);
-    Replace(items.back().description, L"\n", L" | ");
+    Replace(item.description, L"<br/>", L"\n");
+    Replace(item.description, L"<br />", L"\n");
+    StripHtmlTags(item.description);
+    DecodeHtmlEntities(item.description);
+    Trim(item.description, L" \n");
+    Aggregator.ParseDescription(item, output.link);
+    Replace(item.description, L"\n", L" | ");
   }
 
   return true;
@@ -244,7 +350,41 @@ bool Feed::Load() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Aggregator::Aggregator() {
+void FeedArchive::Add(const std::wstring& title) {
+  items_.push_back(title);
+  counts_[title]++;
+}
+
+void FeedArchive::Clear() {
+  items_.clear();
+  counts_.clear();
+}
+
+bool FeedArchive::Contains(const std::wstring& title) const {
+  return counts_.find(title) != counts_.end();
+}
+
+void FeedArchive::Trim(size_t max_count) {
+  while (items_.size() > max_count) {
+    auto it = counts_.find(items_.front());
+    if (it != counts_.end() && --it->second == 0)
+      counts_.erase(it);
+    items_.pop_front();
+  }
+}
+
+const std::deque<std::wstring>& FeedArchive::items() const {
+  return items_;
+}
+
+size_t FeedArchive::size() const {
+  return items_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Aggregator::Aggregator()
+    : archive_journal_count_(0) {
   // Add torrent feed
   feeds.resize(feeds.size() + 1);
   feeds.back().category = kFeedCategoryLink;
@@ -263,15 +403,68 @@ bool Aggregator::Notify(const Feed& feed) {
 }
 
 bool Aggregator::SearchArchive(const std::wstring& file) {
-  foreach_(it, file_archive)
-    if (*it == file)
-      return true;
+  return file_archive.Contains(file);
+}
 
-  return false;
+void Aggregator::HandleFeedCheck(Feed& feed, const HttpResponse& response,
+                                 bool automatic) {
+  FeedSource* source = feed.FindSource(response.uid);
+  if (!source)
+    return;  // Response to a previous check
+  source->request_uid.clear();
+
+  // Items are kept from the previous response if the source is not modified,
+  // or if the server could not provide it
+  if (response.code >= 200 && response.code < 300) {
+    // Items are read from the response itself, and the file is only kept for
+    // debugging purposes
+    feed.ReadItems(response.body(), source->feed);
+    source->modified = true;
+    if (Taiga.debug_mode) {
+      SaveToFile(response.data.data(), response.data.size(),
+                 GetFeedDataPath(source->feed.link) + L"feed.xml");
+    }
+
+    source->etag.clear();
+    source->last_modified.clear();
+    foreach_c_(it, response.header) {
+      if (IsEqual(it->first, L"ETag")) {
+        source->etag = it->second;
+      } else if (IsEqual(it->first, L"Last-Modified")) {
+        source->last_modified = it->second;
+      }
+    }
+  }
+
+  OnFeedSourceChecked(feed, automatic);
 }
 
-void Aggregator::HandleFeedCheck(Feed& feed, bool automatic) {
-  feed.Load();
+void Aggregator::HandleFeedCheckError(Feed& feed, const HttpResponse& response,
+                                      bool automatic) {
+  FeedSource* source = feed.FindSource(response.uid);
+  if (!source)
+    return;
+  source->request_uid.clear();
+
+  // Items of the source are kept from the previous response
+  OnFeedSourceChecked(feed, automatic);
+}
+
+void Aggregator::OnFeedSourceChecked(Feed& feed, bool automatic) {
+  if (feed.IsCheckPending())
+    return;  // Wait for other sources
+
+  bool modified = false;
+  foreach_c_(it, feed.sources)
+    modified = modified || it->modified;
+
+  // There is no need to examine the same items again
+  if (!modified) {
+    ui::OnFeedCheck(filter_manager.IsItemDownloadAvailable(feed));
+    return;
+  }
+
+  MergeFeedSources(feed);
 
   bool success = feed.ExamineData();
   ui::OnFeedCheck(success);
@@ -288,10 +481,31 @@ void Aggregator::HandleFeedCheck(Feed& feed, bool automatic) {
   }
 }
 
+void Aggregator::MergeFeedSources(Feed& feed) {
+  feed.items.clear();
+
+  // Channel information is read from the first source
+  if (!feed.sources.empty()) {
+    const GenericFeed& channel = feed.sources.front().feed;
+    feed.title = channel.title;
+    feed.link = channel.link;
+    feed.description = channel.description;
+  }
+
+  foreach_c_(it, feed.sources)
+    feed.items.insert(feed.items.end(),
+                      it->feed.items.begin(), it->feed.items.end());
+
+  RemoveDuplicateItems(feed.items);
+
+  for (size_t i = 0; i < feed.items.size(); i++)
+    feed.items.at(i).index = i;
+}
+
 void Aggregator::HandleFeedDownload(Feed& feed, bool download_all) {
   auto feed_item = reinterpret_cast<FeedItem*>(&feed.items.at(feed.download_index));
 
-  file_archive.push_back(feed_item->title);
+  AddToArchive(feed_item->title);
 
   std::wstring file = feed_item->title;
   ValidateFileName(file);
@@ -430,22 +644,60 @@ void Aggregator::ParseDescription(FeedItem& feed_item,
   }
 }
 
+void Aggregator::AddToArchive(const std::wstring& file) {
+  file_archive.Add(file);
+
+  size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
+  if (max_count == 0)
+    return;  // The archive is not kept between sessions
+
+  std::wstring path = taiga::GetPath(taiga::kPathFeedHistoryJournal);
+  if (AppendToArchiveJournal(path, file))
+    archive_journal_count_++;
+
+  // Compacting once the journal outgrows the archive keeps both the amortized
+  // cost of an addition and the time it takes to replay the journal bounded
+  if (archive_journal_count_ > max_count)
+    SaveArchive();
+}
+
 bool Aggregator::LoadArchive() {
+  file_archive.Clear();
+  archive_journal_count_ = 0;
+
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathFeedHistory);
   xml_parse_result parse_result = document.load_file(path.c_str());
 
-  if (parse_result.status != pugi::status_ok)
-    return false;
-
   // Read discarded
-  file_archive.clear();
-  xml_node archive_node = document.child(L"archive");
-  foreach_xmlnode_(node, archive_node, L"item") {
-    file_archive.push_back(node.attribute(L"title").value());
+  if (parse_result.status == pugi::status_ok) {
+    xml_node archive_node = document.child(L"archive");
+    foreach_xmlnode_(node, archive_node, L"item") {
+      file_archive.Add(node.attribute(L"title").value());
+    }
   }
 
-  return true;
+  // Titles that were archived after the last time the archive was saved are
+  // in the journal. The archive is saved right away, for the same reason as
+  // the library journal.
+  std::wstring journal_path = taiga::GetPath(taiga::kPathFeedHistoryJournal);
+  if (FileExists(journal_path)) {
+    int entry_count = ReplayArchiveJournal(journal_path);
+    LOG(LevelDebug, L"Replayed " + ToWstr(entry_count) +
+                    L" entries from the feed archive journal");
+    SaveArchive();
+  }
+
+  return parse_result.status == pugi::status_ok;
+}
+
+void Aggregator::CompactArchive() {
+  size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
+
+  // The archive on disk is up to date, unless there are entries in the journal
+  // or the archive is not to be kept at all
+  if (archive_journal_count_ > 0 || max_count == 0)
+    SaveArchive();
 }
 
 bool Aggregator::SaveArchive() {
@@ -455,18 +707,125 @@ bool Aggregator::SaveArchive() {
   size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
 
   if (max_count > 0) {
-    size_t length = file_archive.size();
-    size_t i = 0;
-    if (length > max_count)
-      i = length - max_count;
-    for ( ; i < file_archive.size(); i++) {
+    file_archive.Trim(max_count);
+    foreach_c_(it, file_archive.items()) {
       xml_node xml_item = archive_node.append_child(L"item");
-      xml_item.append_attribute(L"title") = file_archive[i].c_str();
+      xml_item.append_attribute(L"title") = it->c_str();
     }
   }
 
   std::wstring path = taiga::GetPath(taiga::kPathFeedHistory);
-  return XmlWriteDocumentToFile(document, path);
+  if (!XmlWriteDocumentToFile(document, path))
+    return false;
+
+  // The archive is now up to date, and the journal can be discarded
+  archive_journal_count_ = 0;
+  ::DeleteFile(taiga::GetPath(taiga::kPathFeedHistoryJournal).c_str());
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Journal layout:
+//   UINT32 magic, UINT32 version
+//   Entries: UINT32 length, wchar_t title[length]
+// A partially written entry at the end of the journal is ignored.
+
+static const UINT32 kArchiveJournalMagic = 0x41464754;  // "TGFA"
+static const UINT32 kArchiveJournalVersion = 1;
+
+// An interrupted append can leave a new journal empty or with a partial
+// header, in which case it has to be recreated.
+static bool HasValidArchiveJournalHeader(const std::wstring& path) {
+  FileMapping file;
+  if (!file.Open(path))
+    return GetFileSize(path) >= sizeof(kArchiveJournalMagic) +
+                                sizeof(kArchiveJournalVersion);
+
+  BinaryReader reader(file.data(), file.size());
+  UINT32 magic = 0, version = 0;
+  return reader.Read(magic) && magic == kArchiveJournalMagic &&
+         reader.Read(version) && version == kArchiveJournalVersion;
+}
+
+bool Aggregator::AppendToArchiveJournal(const std::wstring& path,
+                                        const std::wstring& file) {
+  // Otherwise the journal would be rejected on replay, along with everything
+  // that is appended to it from now on
+  BinaryWriter writer;
+  if (!HasValidArchiveJournalHeader(path)) {
+    if (FileExists(path)) {
+      LOG(LevelWarning, L"Recreating feed archive journal: " + path);
+      ::DeleteFile(path.c_str());
+    }
+    writer.Write(kArchiveJournalMagic);
+    writer.Write(kArchiveJournalVersion);
+  }
+  writer.WriteString(file);
+
+  if (!AppendToFile(writer.buffer().data(), static_cast<DWORD>(writer.size()),
+                    path)) {
+    LOG(LevelError, L"Could not append to feed archive journal: " + path);
+    return false;
+  }
+
+  return true;
+}
+
+int Aggregator::ReplayArchiveJournal(const std::wstring& path) {
+  FileMapping file;
+  if (!file.Open(path))
+    return 0;
+
+  BinaryReader reader(file.data(), file.size());
+
+  UINT32 magic = 0, version = 0;
+  if (!reader.Read(magic) || magic != kArchiveJournalMagic ||
+      !reader.Read(version) || version != kArchiveJournalVersion) {
+    LOG(LevelError, L"Invalid feed archive journal: " + path);
+    return 0;
+  }
+
+  int entry_count = 0;
+  std::wstring title;
+  while (!reader.eof()) {
+    if (!reader.ReadString(title)) {
+      LOG(LevelWarning, L"Feed archive journal ends with a partial entry: " +
+                        path);
+      break;
+    }
+    file_archive.Add(title);
+    entry_count++;
+  }
+
+  return entry_count;
+}
+
+// Keeps the first of the items that CompareFeedItems would find to be the same.
+// Rather than comparing each item with every other item, fields that are
+// compared are looked up in hash sets.
+void Aggregator::RemoveDuplicateItems(std::vector<FeedItem>& items) {
+  std::unordered_set<std::wstring> guids, links, titles;
+
+  auto is_duplicate = [&](const FeedItem& item) -> bool {
+    bool duplicate =
+        (item.permalink && !item.guid.empty() && guids.count(item.guid)) ||
+        (!item.link.empty() && links.count(item.link)) ||
+        (!item.title.empty() && titles.count(item.title));
+    if (!duplicate) {
+      if (item.permalink && !item.guid.empty())
+        guids.insert(item.guid);
+      if (!item.link.empty())
+        links.insert(item.link);
+      if (!item.title.empty())
+        titles.insert(item.title);
+    }
+    return duplicate;
+  };
+
+  items.erase(std::remove_if(items.begin(), items.end(), is_duplicate),
+              items.end());
 }
 
 bool Aggregator::CompareFeedItems(const GenericFeedItem& item1,
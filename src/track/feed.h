@@ -19,9 +19,13 @@
 #ifndef TAIGA_TRACK_FEED_H
 #define TAIGA_TRACK_FEED_H
 
+#include <deque>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "base/time.h"
+#include "base/types.h"
 #include "library/anime_episode.h"
 #include "track/feed_filter.h"
 
@@ -107,6 +111,22 @@ public:
   std::vector<FeedItem> items;
 };
 
+// One of the addresses that items of a feed are read from. Validators of the
+// last response are kept, so that unchanged sources are not downloaded again.
+class FeedSource {
+public:
+  FeedSource() : modified(false) {}
+  ~FeedSource() {}
+
+  std::wstring url;
+  std::wstring etag;
+  std::wstring last_modified;
+  base::uid_t request_uid;
+  bool modified;
+
+  GenericFeed feed;
+};
+
 class Feed : public GenericFeed {
 public:
   Feed();
@@ -117,9 +137,46 @@ public:
   bool ExamineData();
   std::wstring GetDataPath();
   bool Load();
+  bool Load(const std::wstring& data);
+  bool ReadItems(const std::wstring& data, GenericFeed& output);
+
+  FeedSource* FindSource(const base::uid_t& request_uid);
+  bool IsCheckPending() const;
 
   FeedCategory category;
   int download_index;
+  std::vector<FeedSource> sources;
+
+private:
+  // Recognition results of the previous check, mapped by item title. Results
+  // depend on nothing but the title, the anime database and whether items have
+  // started airing, so they remain valid until one of these changes.
+  std::unordered_map<std::wstring, anime::Episode> episode_cache_;
+  unsigned int episode_cache_database_version_;
+  unsigned int episode_cache_title_version_;
+  Date episode_cache_date_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Titles of feed items that were downloaded or discarded before. Titles are
+// kept in insertion order, so that the oldest ones can be dropped first.
+class FeedArchive {
+public:
+  FeedArchive() {}
+  ~FeedArchive() {}
+
+  void Add(const std::wstring& title);
+  void Clear();
+  bool Contains(const std::wstring& title) const;
+  void Trim(size_t max_count);
+
+  const std::deque<std::wstring>& items() const;
+  size_t size() const;
+
+private:
+  std::deque<std::wstring> items_;
+  std::unordered_map<std::wstring, size_t> counts_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,22 +188,32 @@ public:
 
   Feed* Get(FeedCategory category);
 
-  void HandleFeedCheck(Feed& feed, bool automatic);
+  void HandleFeedCheck(Feed& feed, const HttpResponse& response, bool automatic);
+  void HandleFeedCheckError(Feed& feed, const HttpResponse& response, bool automatic);
   void HandleFeedDownload(Feed& feed, bool download_all);
 
   bool Notify(const Feed& feed);
   void ParseDescription(FeedItem& feed_item, const std::wstring& source);
+  void RemoveDuplicateItems(std::vector<FeedItem>& items);
 
+  void AddToArchive(const std::wstring& file);
+  void CompactArchive();
   bool LoadArchive();
   bool SaveArchive();
   bool SearchArchive(const std::wstring& file);
 
   std::vector<Feed> feeds;
-  std::vector<std::wstring> file_archive;
+  FeedArchive file_archive;
   FeedFilterManager filter_manager;
 
 private:
+  bool AppendToArchiveJournal(const std::wstring& path, const std::wstring& file);
   bool CompareFeedItems(const GenericFeedItem& item1, const GenericFeedItem& item2);
+  void MergeFeedSources(Feed& feed);
+  void OnFeedSourceChecked(Feed& feed, bool automatic);
+  int ReplayArchiveJournal(const std::wstring& path);
+
+  size_t archive_journal_count_;
 };
 
 extern Aggregator Aggregator;
@@ -28,89 +28,105 @@
 #include "track/feed.h"
 #include "track/feed_filter.h"
 
-bool EvaluateCondition(const FeedFilterCondition& condition,
-                       const FeedItem& item) {
-  bool is_numeric = false;
-  std::wstring element;
-  std::wstring value = ReplaceVariables(condition.value, item.episode_data);
-  auto anime = AnimeDatabase.FindItem(item.episode_data.anime_id);
+static bool IsNumericElement(FeedFilterElement element) {
+  switch (element) {
+    case kFeedFilterElement_Meta_Id:
+    case kFeedFilterElement_Meta_Episodes:
+    case kFeedFilterElement_Meta_Status:
+    case kFeedFilterElement_Meta_Type:
+    case kFeedFilterElement_User_Status:
+    case kFeedFilterElement_Episode_Number:
+    case kFeedFilterElement_Episode_Version:
+    case kFeedFilterElement_Local_EpisodeAvailable:
+      return true;
+    default:
+      return false;
+  }
+}
 
-  switch (condition.element) {
+static std::wstring GetElementText(FeedFilterElement element,
+                                   const FeedItem& item,
+                                   const anime::Item* anime) {
+  std::wstring text;
+
+  switch (element) {
     case kFeedFilterElement_File_Title:
-      element = item.title;
+      text = item.title;
       break;
     case kFeedFilterElement_File_Category:
-      element = item.category;
+      text = item.category;
       break;
     case kFeedFilterElement_File_Description:
-      element = item.description;
+      text = item.description;
       break;
     case kFeedFilterElement_File_Link:
-      element = item.link;
+      text = item.link;
       break;
     case kFeedFilterElement_Meta_Id:
       if (anime)
-        element = ToWstr(anime->GetId());
-      is_numeric = true;
+        text = ToWstr(anime->GetId());
       break;
     case kFeedFilterElement_Episode_Title:
-      element = item.episode_data.title;
+      text = item.episode_data.title;
       break;
     case kFeedFilterElement_Meta_DateStart:
       if (anime)
-        element = anime->GetDateStart();
+        text = anime->GetDateStart();
       break;
     case kFeedFilterElement_Meta_DateEnd:
       if (anime)
-        element = anime->GetDateEnd();
+        text = anime->GetDateEnd();
       break;
     case kFeedFilterElement_Meta_Episodes:
       if (anime)
-        element = ToWstr(anime->GetEpisodeCount());
-      is_numeric = true;
+        text = ToWstr(anime->GetEpisodeCount());
       break;
     case kFeedFilterElement_Meta_Status:
       if (anime)
-        element = ToWstr(anime->GetAiringStatus());
-      is_numeric = true;
+        text = ToWstr(anime->GetAiringStatus());
       break;
     case kFeedFilterElement_Meta_Type:
       if (anime)
-        element = ToWstr(anime->GetType());
-      is_numeric = true;
+        text = ToWstr(anime->GetType());
       break;
     case kFeedFilterElement_User_Status:
       if (anime)
-        element = ToWstr(anime->GetMyStatus());
-      is_numeric = true;
+        text = ToWstr(anime->GetMyStatus());
       break;
     case kFeedFilterElement_Episode_Number:
-      element = ToWstr(anime::GetEpisodeHigh(item.episode_data.number));
-      is_numeric = true;
+      text = ToWstr(anime::GetEpisodeHigh(item.episode_data.number));
       break;
     case kFeedFilterElement_Episode_Version:
-      element = item.episode_data.version;
-      if (element.empty())
-        element = L"1";
-      is_numeric = true;
+      text = item.episode_data.version;
+      if (text.empty())
+        text = L"1";
       break;
     case kFeedFilterElement_Local_EpisodeAvailable:
       if (anime)
-        element = ToWstr(anime->IsEpisodeAvailable(
+        text = ToWstr(anime->IsEpisodeAvailable(
             anime::GetEpisodeHigh(item.episode_data.number)));
-      is_numeric = true;
       break;
     case kFeedFilterElement_Episode_Group:
-      element = item.episode_data.group;
+      text = item.episode_data.group;
       break;
     case kFeedFilterElement_Episode_VideoResolution:
-      element = item.episode_data.resolution;
+      text = item.episode_data.resolution;
       break;
     case kFeedFilterElement_Episode_VideoType:
-      element = item.episode_data.video_type;
+      text = item.episode_data.video_type;
       break;
   }
 
+  return text;
+}
+
+bool EvaluateCondition(const FeedFilterCondition& condition,
+                       const FeedItem& item) {
+  std::wstring value = ReplaceVariables(condition.value, item.episode_data);
+  auto anime = AnimeDatabase.FindItem(item.episode_data.anime_id);
+  std::wstring element = GetElementText(condition.element, item, anime);
+  bool is_numeric = IsNumericElement(condition.element);
+
   switch (condition.op) {
     case kFeedFilterOperator_Equals:
       if (is_numeric) {
@@ -246,7 +262,8 @@ void FeedFilter::AddCondition(FeedFilterElement element,
   conditions.back().value = value;
 }
 
-void FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
+void FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive,
+                        FeedFilterProgram* program) {
   if (!enabled)
     return;
 
@@ -269,27 +286,31 @@ void FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
   bool matched = false;
   size_t condition_index = 0;
 
-  switch (match) {
-    case kFeedFilterMatchAll:
-      matched = true;
-      for (size_t i = 0; i < conditions.size(); i++) {
-        if (!EvaluateCondition(conditions.at(i), item)) {
-          matched = false;
-          condition_index = i;
-          break;
+  if (program) {
+    matched = program->Match(*this, item, condition_index);
+  } else {
+    switch (match) {
+      case kFeedFilterMatchAll:
+        matched = true;
+        for (size_t i = 0; i < conditions.size(); i++) {
+          if (!EvaluateCondition(conditions.at(i), item)) {
+            matched = false;
+            condition_index = i;
+            break;
+          }
         }
-      }
-      break;
-    case kFeedFilterMatchAny:
-      matched = false;
-      for (size_t i = 0; i < conditions.size(); i++) {
-        if (EvaluateCondition(conditions.at(i), item)) {
-          matched = true;
-          condition_index = i;
-          break;
+        break;
+      case kFeedFilterMatchAny:
+        matched = false;
+        for (size_t i = 0; i < conditions.size(); i++) {
+          if (EvaluateCondition(conditions.at(i), item)) {
+            matched = true;
+            condition_index = i;
+            break;
+          }
         }
-      }
-      break;
+        break;
+    }
   }
 
   switch (action) {
@@ -314,7 +335,17 @@ void FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
     case kFeedFilterActionPrefer: {
       if (recursive) {
         if (matched) {
-          foreach_(it, feed.items) {
+          // The program narrows candidates down to a bucket of similar items,
+          // which are still checked below
+          std::vector<FeedItem*> items;
+          if (program) {
+            program->FindSimilarItems(feed, item, items);
+          } else {
+            foreach_(it, feed.items)
+              items.push_back(&(*it));
+          }
+          foreach_(candidate, items) {
+            FeedItem* it = *candidate;
             // Do not bother if the item was discarded before
             if (it->IsDiscarded())
               continue;
@@ -336,7 +367,7 @@ void FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
             if (!IsEqual(it->episode_data.group, item.episode_data.group))
               continue;
             // Try applying the same filter
-            Filter(feed, *it, false);
+            Filter(feed, *it, false, program);
           }
         }
         // Filters are strong if they're limited, weak otherwise
@@ -386,6 +417,345 @@ void FeedFilter::Reset() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+FeedFilterProgram::FeedFilterProgram()
+    : filters_(nullptr),
+      has_buckets_(false),
+      item_count_(0),
+      items_(nullptr) {
+}
+
+FeedFilterProgram::Facts::Facts()
+    : anime(nullptr),
+      initialized(false),
+      number_mask(0),
+      text_mask(0),
+      resolution(0),
+      has_resolution(false) {
+}
+
+void FeedFilterProgram::Compile(const std::vector<FeedFilter>& filters,
+                                const Feed& feed) {
+  conditions_.clear();
+  condition_offsets_.clear();
+  dynamic_values_.clear();
+  facts_.clear();
+  id_buckets_.clear();
+  title_buckets_.clear();
+  has_buckets_ = false;
+
+  filters_ = filters.empty() ? nullptr : &filters.front();
+  items_ = feed.items.empty() ? nullptr : &feed.items.front();
+  item_count_ = feed.items.size();
+  facts_.resize(feed.items.size());
+
+  std::map<std::wstring, size_t> dynamic_indexes;
+
+  foreach_c_(filter, filters) {
+    condition_offsets_.push_back(conditions_.size());
+    foreach_c_(it, filter->conditions) {
+      Condition condition;
+      condition.element = it->element;
+      condition.op = it->op;
+      condition.raw_value = &it->value;
+      condition.dynamic_index = std::wstring::npos;
+      condition.number = 0;
+      condition.is_true = false;
+      condition.resolution = anime::TranslateResolution(it->value);
+
+      // Values without variables expand to the same text for every item
+      if (it->value.find(L'%') == std::wstring::npos) {
+        condition.value = ReplaceVariables(it->value, anime::Episode());
+        condition.number = ToInt(condition.value);
+        condition.is_true = IsEqual(condition.value, L"True");
+      } else {
+        auto index = dynamic_indexes.find(it->value);
+        if (index == dynamic_indexes.end()) {
+          index = dynamic_indexes.insert(std::make_pair(
+              it->value, dynamic_values_.size())).first;
+          dynamic_values_.push_back(it->value);
+        }
+        condition.dynamic_index = index->second;
+      }
+
+      conditions_.push_back(condition);
+    }
+  }
+  condition_offsets_.push_back(conditions_.size());
+}
+
+bool FeedFilterProgram::Match(const FeedFilter& filter, const FeedItem& item,
+                              size_t& condition_index) {
+  size_t filter_index = &filter - filters_;
+  if (!filters_ || &filter < filters_ ||
+      filter_index + 1 >= condition_offsets_.size()) {
+    LOG(LevelWarning, L"Filter was not compiled: " + filter.name);
+    return false;
+  }
+
+  Facts& facts = GetFacts(item);
+  size_t begin = condition_offsets_.at(filter_index);
+  size_t end = condition_offsets_.at(filter_index + 1);
+
+  switch (filter.match) {
+    case kFeedFilterMatchAll:
+      for (size_t i = begin; i < end; i++) {
+        if (!Evaluate(conditions_[i], item, facts)) {
+          condition_index = i - begin;
+          return false;
+        }
+      }
+      return true;
+    case kFeedFilterMatchAny:
+      for (size_t i = begin; i < end; i++) {
+        if (Evaluate(conditions_[i], item, facts)) {
+          condition_index = i - begin;
+          return true;
+        }
+      }
+      return false;
+  }
+
+  return false;
+}
+
+static std::wstring GetBucketKey(const std::wstring& anime,
+                                 const FeedItem& item) {
+  return anime + L'\t' + item.episode_data.number + L'\t' +
+         ToLower_Copy(item.episode_data.group);
+}
+
+void FeedFilterProgram::BuildBuckets() {
+  for (size_t i = 0; i < item_count_; i++) {
+    const FeedItem& item = items_[i];
+    if (item.episode_data.anime_id == anime::ID_NOTINLIST) {
+      std::wstring title = ToLower_Copy(item.episode_data.title);
+      title_buckets_[GetBucketKey(title, item)].push_back(i);
+    } else {
+      std::wstring id = ToWstr(item.episode_data.anime_id);
+      id_buckets_[GetBucketKey(id, item)].push_back(i);
+    }
+  }
+
+  has_buckets_ = true;
+}
+
+void FeedFilterProgram::FindSimilarItems(Feed& feed, const FeedItem& item,
+                                         std::vector<FeedItem*>& items) {
+  if (feed.items.empty() || &feed.items.front() != items_ ||
+      feed.items.size() != item_count_) {
+    foreach_(it, feed.items)
+      items.push_back(&(*it));
+    return;
+  }
+
+  if (!has_buckets_)
+    BuildBuckets();
+
+  // Items that are not in the list are identified by their titles, which
+  // makes them similar to any item with the same title
+  static const std::vector<size_t> empty_bucket;
+  const std::vector<size_t>* id_bucket = &empty_bucket;
+  const std::vector<size_t>* title_bucket = &empty_bucket;
+
+  auto it = title_buckets_.find(
+      GetBucketKey(ToLower_Copy(item.episode_data.title), item));
+  if (it != title_buckets_.end())
+    title_bucket = &it->second;
+  if (item.episode_data.anime_id != anime::ID_NOTINLIST) {
+    it = id_buckets_.find(
+        GetBucketKey(ToWstr(item.episode_data.anime_id), item));
+    if (it != id_buckets_.end())
+      id_bucket = &it->second;
+  }
+
+  // Merge both buckets in feed order
+  size_t i = 0, j = 0;
+  while (i < id_bucket->size() || j < title_bucket->size()) {
+    if (j == title_bucket->size() ||
+        (i < id_bucket->size() && id_bucket->at(i) < title_bucket->at(j))) {
+      items.push_back(&feed.items[id_bucket->at(i++)]);
+    } else {
+      items.push_back(&feed.items[title_bucket->at(j++)]);
+    }
+  }
+}
+
+bool FeedFilterProgram::Evaluate(const Condition& condition,
+                                 const FeedItem& item, Facts& facts) {
+  bool is_numeric = IsNumericElement(condition.element);
+  bool is_resolution =
+      condition.element == kFeedFilterElement_Episode_VideoResolution;
+
+  switch (condition.op) {
+    case kFeedFilterOperator_Equals:
+    case kFeedFilterOperator_NotEquals: {
+      bool equals = condition.op == kFeedFilterOperator_Equals;
+      if (is_numeric) {
+        int element = GetNumber(condition.element, item, facts);
+        bool is_true = condition.dynamic_index == std::wstring::npos ?
+            condition.is_true :
+            IsEqual(GetValue(condition, item, facts), L"True");
+        if (is_true)
+          return element == TRUE;
+        int value = GetValueNumber(condition, item, facts);
+        return equals ? element == value : element != value;
+      } else if (is_resolution) {
+        int element = GetResolution(item, facts);
+        return equals ? element == condition.resolution :
+                        element != condition.resolution;
+      } else {
+        bool result = IsEqual(GetText(condition.element, item, facts),
+                              GetValue(condition, item, facts));
+        return equals ? result : !result;
+      }
+    }
+    case kFeedFilterOperator_IsGreaterThan:
+    case kFeedFilterOperator_IsGreaterThanOrEqualTo:
+    case kFeedFilterOperator_IsLessThan:
+    case kFeedFilterOperator_IsLessThanOrEqualTo: {
+      int result = 0;
+      if (is_numeric || is_resolution) {
+        int element = is_numeric ? GetNumber(condition.element, item, facts) :
+                                   GetResolution(item, facts);
+        int value = is_numeric ? GetValueNumber(condition, item, facts) :
+                                 condition.resolution;
+        result = element < value ? -1 : (element > value ? 1 : 0);
+      } else {
+        result = CompareStrings(GetText(condition.element, item, facts),
+                                *condition.raw_value);
+      }
+      switch (condition.op) {
+        case kFeedFilterOperator_IsGreaterThan:
+          return result > 0;
+        case kFeedFilterOperator_IsGreaterThanOrEqualTo:
+          return result >= 0;
+        case kFeedFilterOperator_IsLessThan:
+          return result < 0;
+        default:
+          return result <= 0;
+      }
+    }
+    case kFeedFilterOperator_BeginsWith:
+      return StartsWith(GetText(condition.element, item, facts),
+                        GetValue(condition, item, facts));
+    case kFeedFilterOperator_EndsWith:
+      return EndsWith(GetText(condition.element, item, facts),
+                      GetValue(condition, item, facts));
+    case kFeedFilterOperator_Contains:
+      return InStr(GetText(condition.element, item, facts),
+                   GetValue(condition, item, facts), 0, true) > -1;
+    case kFeedFilterOperator_NotContains:
+      return InStr(GetText(condition.element, item, facts),
+                   GetValue(condition, item, facts), 0, true) == -1;
+  }
+
+  return false;
+}
+
+FeedFilterProgram::Facts& FeedFilterProgram::GetFacts(const FeedItem& item) {
+  size_t index = &item - items_;
+  bool is_compiled = items_ && &item >= items_ && index < facts_.size();
+
+  // Items that are not part of the compiled feed get a temporary record
+  if (!is_compiled)
+    scratch_facts_ = Facts();
+
+  Facts& facts = is_compiled ? facts_[index] : scratch_facts_;
+  if (!facts.initialized) {
+    facts.anime = AnimeDatabase.FindItem(item.episode_data.anime_id);
+    facts.values.resize(dynamic_values_.size());
+    facts.value_numbers.resize(dynamic_values_.size());
+    facts.value_state.resize(dynamic_values_.size());
+    facts.initialized = true;
+  }
+
+  return facts;
+}
+
+int FeedFilterProgram::GetNumber(FeedFilterElement element,
+                                 const FeedItem& item, Facts& facts) {
+  unsigned int bit = 1 << element;
+  if (!(facts.number_mask & bit)) {
+    facts.numbers[element] = ToInt(GetText(element, item, facts));
+    facts.number_mask |= bit;
+  }
+
+  return facts.numbers[element];
+}
+
+int FeedFilterProgram::GetResolution(const FeedItem& item, Facts& facts) {
+  if (!facts.has_resolution) {
+    facts.resolution =
+        anime::TranslateResolution(item.episode_data.resolution);
+    facts.has_resolution = true;
+  }
+
+  return facts.resolution;
+}
+
+const std::wstring& FeedFilterProgram::GetText(FeedFilterElement element,
+                                               const FeedItem& item,
+                                               Facts& facts) {
+  // Item fields are read in place, as filters may modify them in debug mode
+  switch (element) {
+    case kFeedFilterElement_File_Title:
+      return item.title;
+    case kFeedFilterElement_File_Category:
+      return item.category;
+    case kFeedFilterElement_File_Description:
+      return item.description;
+    case kFeedFilterElement_File_Link:
+      return item.link;
+    case kFeedFilterElement_Episode_Title:
+      return item.episode_data.title;
+    case kFeedFilterElement_Episode_Group:
+      return item.episode_data.group;
+    case kFeedFilterElement_Episode_VideoResolution:
+      return item.episode_data.resolution;
+    case kFeedFilterElement_Episode_VideoType:
+      return item.episode_data.video_type;
+  }
+
+  if (element < 0 || element >= kFeedFilterElement_Count)
+    return EmptyString();
+
+  unsigned int bit = 1 << element;
+  if (!(facts.text_mask & bit)) {
+    facts.texts[element] = GetElementText(element, item, facts.anime);
+    facts.text_mask |= bit;
+  }
+
+  return facts.texts[element];
+}
+
+const std::wstring& FeedFilterProgram::GetValue(const Condition& condition,
+                                                const FeedItem& item,
+                                                Facts& facts) {
+  size_t index = condition.dynamic_index;
+  if (index == std::wstring::npos)
+    return condition.value;
+
+  if (!facts.value_state[index]) {
+    facts.values[index] = ReplaceVariables(dynamic_values_[index],
+                                           item.episode_data);
+    facts.value_numbers[index] = ToInt(facts.values[index]);
+    facts.value_state[index] = 1;
+  }
+
+  return facts.values[index];
+}
+
+int FeedFilterProgram::GetValueNumber(const Condition& condition,
+                                      const FeedItem& item, Facts& facts) {
+  if (condition.dynamic_index == std::wstring::npos)
+    return condition.number;
+
+  GetValue(condition, item, facts);
+  return facts.value_numbers[condition.dynamic_index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 FeedFilterPreset::FeedFilterPreset()
     : is_default(false) {
 }
@@ -445,11 +815,14 @@ void FeedFilterManager::Filter(Feed& feed, bool preferences) {
   if (!Settings.GetBool(taiga::kTorrent_Filter_Enabled))
     return;
 
+  FeedFilterProgram program;
+  program.Compile(filters, feed);
+
   foreach_(item, feed.items) {
     foreach_(filter, filters) {
       if (preferences != (filter->action == kFeedFilterActionPrefer))
         continue;
-      filter->Filter(feed, *item, true);
+      filter->Filter(feed, *item, true, &program);
     }
   }
 }
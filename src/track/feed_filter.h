@@ -21,6 +21,7 @@
 
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 enum FeedFilterElement {
@@ -85,8 +86,12 @@ enum FeedFilterShortcodeType {
   kFeedFilterShortcodeOption
 };
 
+namespace anime {
+class Item;
+}
 class Feed;
 class FeedItem;
+class FeedFilterProgram;
 
 class FeedFilterCondition {
 public:
@@ -111,7 +116,8 @@ public:
   FeedFilter& operator=(const FeedFilter& filter);
 
   void AddCondition(FeedFilterElement element, FeedFilterOperator op, const std::wstring& value);
-  void Filter(Feed& feed, FeedItem& item, bool recursive);
+  void Filter(Feed& feed, FeedItem& item, bool recursive,
+              FeedFilterProgram* program = nullptr);
   void Reset();
 
 public:
@@ -126,6 +132,75 @@ public:
   std::vector<FeedFilterCondition> conditions;
 };
 
+// Filters compiled for evaluation against every item of a feed. Condition
+// values without variables are expanded and parsed once, and facts about each
+// item are computed on first use rather than once per condition.
+class FeedFilterProgram {
+public:
+  FeedFilterProgram();
+  ~FeedFilterProgram() {}
+
+  void Compile(const std::vector<FeedFilter>& filters, const Feed& feed);
+  bool Match(const FeedFilter& filter, const FeedItem& item,
+             size_t& condition_index);
+  void FindSimilarItems(Feed& feed, const FeedItem& item,
+                        std::vector<FeedItem*>& items);
+
+private:
+  class Condition {
+  public:
+    FeedFilterElement element;
+    FeedFilterOperator op;
+    const std::wstring* raw_value;
+    std::wstring value;
+    size_t dynamic_index;
+    int number;
+    int resolution;
+    bool is_true;
+  };
+
+  class Facts {
+  public:
+    Facts();
+
+    const anime::Item* anime;
+    bool initialized;
+    int numbers[kFeedFilterElement_Count];
+    unsigned int number_mask;
+    std::wstring texts[kFeedFilterElement_Count];
+    unsigned int text_mask;
+    int resolution;
+    bool has_resolution;
+    std::vector<std::wstring> values;
+    std::vector<int> value_numbers;
+    std::vector<char> value_state;
+  };
+
+  void BuildBuckets();
+  bool Evaluate(const Condition& condition, const FeedItem& item, Facts& facts);
+  Facts& GetFacts(const FeedItem& item);
+  int GetNumber(FeedFilterElement element, const FeedItem& item, Facts& facts);
+  int GetResolution(const FeedItem& item, Facts& facts);
+  const std::wstring& GetText(FeedFilterElement element, const FeedItem& item, Facts& facts);
+  const std::wstring& GetValue(const Condition& condition, const FeedItem& item, Facts& facts);
+  int GetValueNumber(const Condition& condition, const FeedItem& item, Facts& facts);
+
+  std::vector<Condition> conditions_;
+  std::vector<size_t> condition_offsets_;
+  std::vector<std::wstring> dynamic_values_;
+  std::vector<Facts> facts_;
+  Facts scratch_facts_;
+  const FeedFilter* filters_;
+  const FeedItem* items_;
+  size_t item_count_;
+
+  // Item indexes grouped by anime (or title), episode and group
+  typedef std::unordered_map<std::wstring, std::vector<size_t>> bucket_map_t;
+  bucket_map_t id_buckets_;
+  bucket_map_t title_buckets_;
+  bool has_buckets_;
+};
+
 class FeedFilterPreset {
 public:
   FeedFilterPreset();
@@ -0,0 +1,485 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "track/feed.h"
+#include "track/feed_parser.h"
+
+enum FeedFormat {
+  kFeedFormatUnknown,
+  kFeedFormatRss,
+  kFeedFormatAtom
+};
+
+enum FeedField {
+  kFeedFieldTitle       = 1 << 0,
+  kFeedFieldLink        = 1 << 1,
+  kFeedFieldDescription = 1 << 2,
+  kFeedFieldCategory    = 1 << 3,
+  kFeedFieldGuid        = 1 << 4,
+  kFeedFieldPubDate     = 1 << 5,
+  kFeedFieldEnclosure   = 1 << 6
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool IsName(const wchar_t* begin, const wchar_t* end,
+                   const wchar_t* name) {
+  for ( ; begin < end && *name; ++begin, ++name)
+    if (*begin != *name)
+      return false;
+  return begin == end && !*name;
+}
+
+static bool IsWhitespace(wchar_t c) {
+  return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n';
+}
+
+static bool HasPrefix(const wchar_t* begin, const wchar_t* end,
+                       const wchar_t* str) {
+  for ( ; *str; ++begin, ++str)
+    if (begin == end || *begin != *str)
+      return false;
+  return true;
+}
+
+static const wchar_t* Find(const wchar_t* begin, const wchar_t* end,
+                           const wchar_t* str) {
+  size_t length = wcslen(str);
+  for ( ; begin + length <= end; ++begin)
+    if (*begin == *str && std::equal(str, str + length, begin))
+      return begin;
+  return nullptr;
+}
+
+static void AppendCodePoint(unsigned long code_point, std::wstring& output) {
+  if (sizeof(wchar_t) == 2 && code_point > 0xFFFF) {
+    code_point -= 0x10000;
+    output.push_back(static_cast<wchar_t>(0xD800 + (code_point >> 10)));
+    output.push_back(static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF)));
+  } else {
+    output.push_back(static_cast<wchar_t>(code_point));
+  }
+}
+
+// Decodes the predefined entities and character references, returning the
+// position after the reference, or the original position if there is none.
+static const wchar_t* DecodeEntity(const wchar_t* begin, const wchar_t* end,
+                                   std::wstring& output) {
+  const wchar_t* p = begin + 1;
+
+  if (p < end && *p == L'#') {
+    unsigned long code_point = 0;
+    const wchar_t* digits = ++p;
+    if (p < end && *p == L'x') {
+      digits = ++p;
+      for ( ; p < end; ++p) {
+        if (*p >= L'0' && *p <= L'9') {
+          code_point = code_point * 16 + (*p - L'0');
+        } else if ((*p | 0x20) >= L'a' && (*p | 0x20) <= L'f') {
+          code_point = code_point * 16 + ((*p | 0x20) - L'a' + 10);
+        } else {
+          break;
+        }
+      }
+    } else {
+      for ( ; p < end && *p >= L'0' && *p <= L'9'; ++p)
+        code_point = code_point * 10 + (*p - L'0');
+    }
+    if (p == digits || p == end || *p != L';')
+      return begin;
+    AppendCodePoint(code_point, output);
+    return p + 1;
+  }
+
+  static const struct {
+    const wchar_t* name;
+    wchar_t character;
+  } entities[] = {
+    {L"amp;", L'&'}, {L"lt;", L'<'}, {L"gt;", L'>'},
+    {L"quot;", L'"'}, {L"apos;", L'\''}
+  };
+  for (size_t i = 0; i < sizeof(entities) / sizeof(*entities); i++) {
+    if (HasPrefix(p, end, entities[i].name)) {
+      output.push_back(entities[i].character);
+      return p + wcslen(entities[i].name);
+    }
+  }
+
+  return begin;
+}
+
+// Line endings are normalized for both text and CDATA sections, while entities
+// are only decoded in text.
+static void AppendText(const wchar_t* begin, const wchar_t* end,
+                       bool decode_entities, std::wstring& output) {
+  output.reserve(output.size() + (end - begin));
+
+  while (begin < end) {
+    wchar_t c = *begin;
+    if (c == L'\r') {
+      output.push_back(L'\n');
+      begin += begin + 1 < end && begin[1] == L'\n' ? 2 : 1;
+    } else if (c == L'&' && decode_entities) {
+      const wchar_t* next = DecodeEntity(begin, end, output);
+      if (next == begin) {
+        output.push_back(c);
+        ++begin;
+      } else {
+        begin = next;
+      }
+    } else {
+      output.push_back(c);
+      ++begin;
+    }
+  }
+}
+
+static bool ReadAttribute(const wchar_t* begin, const wchar_t* end,
+                          const wchar_t* name, std::wstring& value) {
+  while (begin < end) {
+    while (begin < end && (IsWhitespace(*begin) || *begin == L'/'))
+      ++begin;
+    const wchar_t* name_begin = begin;
+    while (begin < end && *begin != L'=' && !IsWhitespace(*begin))
+      ++begin;
+    const wchar_t* name_end = begin;
+    while (begin < end && IsWhitespace(*begin))
+      ++begin;
+    if (begin == end || *begin != L'=')
+      return false;
+    ++begin;
+    while (begin < end && IsWhitespace(*begin))
+      ++begin;
+    if (begin == end || (*begin != L'"' && *begin != L'\''))
+      return false;
+    const wchar_t* value_end = std::find(begin + 1, end, *begin);
+    if (value_end == end)
+      return false;
+    if (IsName(name_begin, name_end, name)) {
+      value.clear();
+      AppendText(begin + 1, value_end, true, value);
+      return true;
+    }
+    begin = value_end + 1;
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class FeedReader {
+public:
+  FeedReader(GenericFeed& feed);
+
+  bool Read(const wchar_t* begin, const wchar_t* end);
+
+private:
+  void OnStartTag(const wchar_t* name, const wchar_t* name_end,
+                  const wchar_t* attributes, const wchar_t* attributes_end);
+  bool OnEndTag();
+  void OnText(const wchar_t* begin, const wchar_t* end, bool is_cdata);
+
+  void OnChannelElement(const wchar_t* name, const wchar_t* name_end,
+                        const wchar_t* attributes, const wchar_t* attributes_end);
+  void OnItemElement(const wchar_t* name, const wchar_t* name_end,
+                     const wchar_t* attributes, const wchar_t* attributes_end);
+  void ReadField(std::wstring& target, int field, int& fields);
+  void ReadLink(const wchar_t* attributes, const wchar_t* attributes_end,
+                std::wstring& link, std::wstring* enclosure, int& fields);
+
+  GenericFeed& feed_;
+  FeedFormat format_;
+
+  int depth_;
+  int channel_depth_;
+  int item_depth_;
+  int channel_fields_;
+  int item_fields_;
+
+  std::wstring* field_;
+  int field_depth_;
+  bool field_has_text_;
+};
+
+FeedReader::FeedReader(GenericFeed& feed)
+    : feed_(feed),
+      format_(kFeedFormatUnknown),
+      depth_(0),
+      channel_depth_(0),
+      item_depth_(0),
+      channel_fields_(0),
+      item_fields_(0),
+      field_(nullptr),
+      field_depth_(0),
+      field_has_text_(false) {
+}
+
+bool FeedReader::Read(const wchar_t* begin, const wchar_t* end) {
+  const wchar_t* p = begin;
+
+  // Skip byte order mark
+  if (p < end && *p == 0xFEFF)
+    ++p;
+
+  while (p < end) {
+    if (*p != L'<') {
+      const wchar_t* text_end = std::find(p, end, L'<');
+      OnText(p, text_end, false);
+      p = text_end;
+
+    } else if (HasPrefix(p, end, L"<!--")) {
+      const wchar_t* comment_end = Find(p + 4, end, L"-->");
+      if (!comment_end)
+        return false;
+      p = comment_end + 3;
+
+    } else if (HasPrefix(p, end, L"<![CDATA[")) {
+      const wchar_t* cdata_end = Find(p + 9, end, L"]]>");
+      if (!cdata_end)
+        return false;
+      OnText(p + 9, cdata_end, true);
+      p = cdata_end + 3;
+
+    } else if (HasPrefix(p, end, L"<?")) {
+      const wchar_t* pi_end = Find(p + 2, end, L"?>");
+      if (!pi_end)
+        return false;
+      p = pi_end + 2;
+
+    } else if (HasPrefix(p, end, L"<!")) {
+      // Document type declaration, which may have an internal subset
+      const wchar_t* subset = std::find(p, end, L'[');
+      const wchar_t* declaration_end = std::find(p, end, L'>');
+      if (subset < declaration_end)
+        declaration_end = Find(subset, end, L"]>");
+      if (!declaration_end || declaration_end == end)
+        return false;
+      p = std::find(declaration_end, end, L'>') + 1;
+
+    } else if (HasPrefix(p, end, L"</")) {
+      const wchar_t* tag_end = std::find(p, end, L'>');
+      if (tag_end == end || !OnEndTag())
+        return false;
+      p = tag_end + 1;
+
+    } else {
+      const wchar_t* name = p + 1;
+      const wchar_t* name_end = name;
+      while (name_end < end && !IsWhitespace(*name_end) &&
+             *name_end != L'/' && *name_end != L'>')
+        ++name_end;
+      // Attribute values may contain '>'
+      const wchar_t* tag_end = name_end;
+      wchar_t quote = 0;
+      for ( ; tag_end < end; ++tag_end) {
+        if (quote) {
+          if (*tag_end == quote)
+            quote = 0;
+        } else if (*tag_end == L'"' || *tag_end == L'\'') {
+          quote = *tag_end;
+        } else if (*tag_end == L'>') {
+          break;
+        }
+      }
+      if (tag_end == end || name_end == name)
+        return false;
+      bool self_closing = *(tag_end - 1) == L'/';
+      OnStartTag(name, name_end, name_end, tag_end);
+      if (self_closing && !OnEndTag())
+        return false;
+      p = tag_end + 1;
+    }
+  }
+
+  return depth_ == 0;
+}
+
+void FeedReader::OnStartTag(const wchar_t* name, const wchar_t* name_end,
+                            const wchar_t* attributes,
+                            const wchar_t* attributes_end) {
+  depth_++;
+
+  // Elements within a field are not read
+  if (field_)
+    return;
+
+  if (depth_ == 1) {
+    if (IsName(name, name_end, L"rss")) {
+      format_ = kFeedFormatRss;
+    } else if (IsName(name, name_end, L"feed")) {
+      format_ = kFeedFormatAtom;
+      channel_depth_ = depth_;
+    }
+  } else if (format_ == kFeedFormatRss && depth_ == 2 && !channel_depth_) {
+    if (IsName(name, name_end, L"channel"))
+      channel_depth_ = depth_;
+  } else if (channel_depth_ && depth_ == channel_depth_ + 1) {
+    OnChannelElement(name, name_end, attributes, attributes_end);
+  } else if (item_depth_ && depth_ == item_depth_ + 1) {
+    OnItemElement(name, name_end, attributes, attributes_end);
+  }
+}
+
+bool FeedReader::OnEndTag() {
+  if (depth_ == 0)
+    return false;
+
+  if (field_ && depth_ == field_depth_) {
+    field_ = nullptr;
+  } else if (item_depth_ && depth_ == item_depth_) {
+    FeedItem& item = feed_.items.back();
+    if (item.link.empty() && !item.enclosure.empty())
+      item.link = item.enclosure;
+    item_depth_ = 0;
+  } else if (channel_depth_ && depth_ == channel_depth_) {
+    channel_depth_ = 0;
+  }
+
+  depth_--;
+  return true;
+}
+
+void FeedReader::OnText(const wchar_t* begin, const wchar_t* end,
+                        bool is_cdata) {
+  // Only the first text node of a field is read, and text that consists of
+  // whitespace only does not make a node.
+  if (!field_ || depth_ != field_depth_ || field_has_text_)
+    return;
+  if (!is_cdata && std::find_if(begin, end, [](wchar_t c) {
+        return !IsWhitespace(c);
+      }) == end)
+    return;
+
+  AppendText(begin, end, !is_cdata, *field_);
+  field_has_text_ = true;
+}
+
+void FeedReader::OnChannelElement(const wchar_t* name, const wchar_t* name_end,
+                                  const wchar_t* attributes,
+                                  const wchar_t* attributes_end) {
+  if (IsName(name, name_end, format_ == kFeedFormatRss ? L"item" : L"entry")) {
+    feed_.items.resize(feed_.items.size() + 1);
+    feed_.items.back().index = feed_.items.size() - 1;
+    item_depth_ = depth_;
+    item_fields_ = 0;
+  } else if (IsName(name, name_end, L"title")) {
+    ReadField(feed_.title, kFeedFieldTitle, channel_fields_);
+  } else if (IsName(name, name_end, format_ == kFeedFormatRss ?
+                                    L"description" : L"subtitle")) {
+    ReadField(feed_.description, kFeedFieldDescription, channel_fields_);
+  } else if (IsName(name, name_end, L"link")) {
+    if (format_ == kFeedFormatRss) {
+      ReadField(feed_.link, kFeedFieldLink, channel_fields_);
+    } else {
+      ReadLink(attributes, attributes_end, feed_.link, nullptr,
+               channel_fields_);
+    }
+  }
+}
+
+void FeedReader::OnItemElement(const wchar_t* name, const wchar_t* name_end,
+                               const wchar_t* attributes,
+                               const wchar_t* attributes_end) {
+  FeedItem& item = feed_.items.back();
+
+  if (IsName(name, name_end, L"title")) {
+    ReadField(item.title, kFeedFieldTitle, item_fields_);
+  } else if (format_ == kFeedFormatRss) {
+    if (IsName(name, name_end, L"link")) {
+      ReadField(item.link, kFeedFieldLink, item_fields_);
+    } else if (IsName(name, name_end, L"description")) {
+      ReadField(item.description, kFeedFieldDescription, item_fields_);
+    } else if (IsName(name, name_end, L"category")) {
+      ReadField(item.category, kFeedFieldCategory, item_fields_);
+    } else if (IsName(name, name_end, L"guid")) {
+      std::wstring permalink;
+      if (ReadAttribute(attributes, attributes_end, L"isPermaLink", permalink))
+        item.permalink = permalink != L"false";
+      ReadField(item.guid, kFeedFieldGuid, item_fields_);
+    } else if (IsName(name, name_end, L"pubDate")) {
+      ReadField(item.pub_date, kFeedFieldPubDate, item_fields_);
+    } else if (IsName(name, name_end, L"enclosure")) {
+      if (!(item_fields_ & kFeedFieldEnclosure)) {
+        ReadAttribute(attributes, attributes_end, L"url", item.enclosure);
+        item_fields_ |= kFeedFieldEnclosure;
+      }
+    }
+  } else {
+    if (IsName(name, name_end, L"link")) {
+      ReadLink(attributes, attributes_end, item.link, &item.enclosure,
+               item_fields_);
+    } else if (IsName(name, name_end, L"summary") ||
+               IsName(name, name_end, L"content")) {
+      ReadField(item.description, kFeedFieldDescription, item_fields_);
+    } else if (IsName(name, name_end, L"category")) {
+      if (!(item_fields_ & kFeedFieldCategory)) {
+        ReadAttribute(attributes, attributes_end, L"term", item.category);
+        item_fields_ |= kFeedFieldCategory;
+      }
+    } else if (IsName(name, name_end, L"id")) {
+      item.permalink = false;
+      ReadField(item.guid, kFeedFieldGuid, item_fields_);
+    } else if (IsName(name, name_end, L"updated")) {
+      ReadField(item.pub_date, kFeedFieldPubDate, item_fields_);
+    }
+  }
+}
+
+// Only the first element with the same name is read, as with
+// pugi::xml_node::child_value.
+void FeedReader::ReadField(std::wstring& target, int field, int& fields) {
+  if (fields & field)
+    return;
+  fields |= field;
+
+  field_ = &target;
+  field_depth_ = depth_;
+  field_has_text_ = false;
+}
+
+void FeedReader::ReadLink(const wchar_t* attributes,
+                          const wchar_t* attributes_end,
+                          std::wstring& link, std::wstring* enclosure,
+                          int& fields) {
+  std::wstring rel;
+  ReadAttribute(attributes, attributes_end, L"rel", rel);
+
+  if (rel.empty() || rel == L"alternate") {
+    if (!(fields & kFeedFieldLink)) {
+      ReadAttribute(attributes, attributes_end, L"href", link);
+      fields |= kFeedFieldLink;
+    }
+  } else if (rel == L"enclosure" && enclosure) {
+    if (!(fields & kFeedFieldEnclosure)) {
+      ReadAttribute(attributes, attributes_end, L"href", *enclosure);
+      fields |= kFeedFieldEnclosure;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ParseFeed(const std::wstring& data, GenericFeed& feed) {
+  FeedReader reader(feed);
+
+  const wchar_t* begin = data.data();
+  return reader.Read(begin, begin + data.size());
+}
\ No newline at end of file
@@ -40,7 +40,8 @@ FolderInfo::FolderInfo()
 }
 
 FolderInfo::FolderChangeInfo::FolderChangeInfo()
-    : action(0), parameter(0), type(kPathTypeFile) {
+    : action(0), parameter(0), type(kPathTypeFile),
+      recognized(false), anime_id(anime::ID_UNKNOWN) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -240,6 +241,18 @@ void FolderMonitor::SetWindowHandle(HWND hwnd) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+bool FolderMonitor::IsActionHandled(DWORD action) const {
+  switch (action) {
+    case FILE_ACTION_ADDED:
+    case FILE_ACTION_REMOVED:
+    case FILE_ACTION_RENAMED_OLD_NAME:
+    case FILE_ACTION_RENAMED_NEW_NAME:
+      return true;
+    default:
+      return false;
+  }
+}
+
 bool FolderMonitor::IsPathAvailable(DWORD action) const {
   switch (action) {
     case FILE_ACTION_ADDED:
@@ -256,18 +269,35 @@ void FolderMonitor::OnChange(FolderInfo& folder_info) {
   // Lock folder data
   win::Lock lock(critical_section_);
 
-  foreach_(change_info, folder_info.change_list) {
-    switch (change_info->action) {
-      case FILE_ACTION_ADDED:
-      case FILE_ACTION_REMOVED:
-      case FILE_ACTION_RENAMED_OLD_NAME:
-      case FILE_ACTION_RENAMED_NEW_NAME:
-        break;
-      default:
-        continue;
+  AddTrailingSlash(folder_info.path);
+
+  // Examine paths and compare with list items in parallel, before handling
+  // changes in their original order
+  std::vector<RecognitionContext> contexts(win::GetWorkerCount());
+  auto titles = Meow.GetTitleSnapshot();
+  foreach_(context, contexts)
+    context->titles = titles;
+  win::ParallelFor(folder_info.change_list.size(),
+                   [&](size_t index, size_t worker) {
+    auto& context = contexts[worker];
+    auto& change_info = folder_info.change_list[index];
+    if (!IsActionHandled(change_info.action))
+      return;
+    change_info.recognized = Meow.ExamineTitle(
+        context, folder_info.path + change_info.file_name, change_info.episode);
+    if (change_info.recognized) {
+      change_info.matched_episode = change_info.episode;
+      auto anime_item = Meow.MatchDatabase(context, change_info.matched_episode,
+                                           true, true, true, false, false);
+      if (anime_item)
+        change_info.anime_id = anime_item->GetId();
     }
+  });
+
+  foreach_(change_info, folder_info.change_list) {
+    if (!IsActionHandled(change_info->action))
+      continue;
 
-    AddTrailingSlash(folder_info.path);
     std::wstring path = folder_info.path + change_info->file_name;
 
     // Is it a file or a directory?
@@ -353,13 +383,14 @@ void FolderMonitor::HandleAnime(const std::wstring& path,
   }
 
   // Examine path and compare with list items
-  anime::Episode episode;
-  if (Meow.ExamineTitle(path, episode)) {
-    if (anime_id == anime::ID_UNKNOWN || change_info.type == kPathTypeFile) {
-      auto anime_item = Meow.MatchDatabase(episode, true, true, true, false, false);
-      if (anime_item)
-        anime_id = anime_item->GetId();
-    }
+  if (change_info.recognized) {
+    // The matched episode is used only where the match itself is
+    bool matched = anime_id == anime::ID_UNKNOWN ||
+                   change_info.type == kPathTypeFile;
+    if (matched && change_info.anime_id != anime::ID_UNKNOWN)
+      anime_id = change_info.anime_id;
+    const anime::Episode& episode =
+        matched ? change_info.matched_episode : change_info.episode;
 
     if (anime_id != anime::ID_UNKNOWN) {
       auto anime_item = AnimeDatabase.FindItem(anime_id);
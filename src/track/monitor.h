@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include "library/anime_episode.h"
 #include "win/win_thread.h"
 
 #define WM_MONITORCALLBACK (WM_APP + 0x32)
@@ -56,6 +57,12 @@ public:
     std::wstring file_name;
     LPARAM parameter;
     PathType type;
+    // Recognition results, computed in advance. Matching the database may
+    // change the episode (e.g. its number for sequels), so both are kept.
+    anime::Episode episode;
+    anime::Episode matched_episode;
+    bool recognized;
+    int anime_id;
   };
   std::vector<FolderChangeInfo> change_list;
 
@@ -90,6 +97,7 @@ public:
 
 private:
   void HandleAnime(const std::wstring& path, FolderInfo& folder_info, size_t change_index);
+  bool IsActionHandled(DWORD action) const;
   bool IsPathAvailable(DWORD action) const;
   BOOL ReadDirectoryChanges(FolderInfo& folder_info) const;
 
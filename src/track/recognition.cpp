@@ -16,11 +16,17 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
+#include "base/binary.h"
+#include "base/file.h"
 #include "base/foreach.h"
+#include "base/log.h"
 #include "base/string.h"
 #include "library/anime_db.h"
 #include "library/anime_episode.h"
 #include "library/anime_util.h"
+#include "taiga/path.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
 #include "taiga/taiga.h"
@@ -29,17 +35,10 @@
 
 RecognitionEngine Meow;
 
-class Token {
-public:
-  Token() : encloser('\0'), separator('\0'), untouched(true) {}
-
-  std::wstring content;
-  wchar_t encloser;
-  wchar_t separator;
-  bool untouched;
-};
-
-RecognitionEngine::RecognitionEngine() {
+RecognitionEngine::RecognitionEngine()
+    : titles_items_version_(0),
+      titles_modified_(false),
+      titles_version_(0) {
   ReadKeyword(audio_keywords,
       L"2CH, 5.1CH, 5.1, AAC, AC3, DTS, DTS5.1, DTS-ES, DUALAUDIO, DUAL AUDIO, "
       L"FLAC, MP3, OGG, TRUEHD5.1, VORBIS");
@@ -61,6 +60,21 @@ RecognitionEngine::RecognitionEngine() {
       L"EPISODE, EP., EP, VOLUME, VOL., VOL, EPS., EPS");
   ReadKeyword(episode_prefixes,
       L"EP., EP, E, VOL., VOL, EPS., \x7B2C");
+
+  AddKeywords(audio_keywords, kKeywordAudio);
+  AddKeywords(video_keywords, kKeywordVideo);
+  AddKeywords(extra_keywords, kKeywordExtra);
+  AddKeywords(extra_unsafe_keywords, kKeywordExtraUnsafe);
+  AddKeywords(version_keywords, kKeywordVersion);
+  AddKeywords(episode_keywords, kKeywordEpisode);
+  AddKeywords(episode_prefixes, kKeywordEpisodePrefix);
+  keywords_.Build();
+}
+
+void RecognitionEngine::AddKeywords(const std::vector<std::wstring>& keywords,
+                                    int category) {
+  foreach_c_(keyword, keywords)
+    keywords_.Add(*keyword, category);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -72,24 +86,110 @@ anime::Item* RecognitionEngine::MatchDatabase(anime::Episode& episode,
                                               bool check_episode,
                                               bool check_date,
                                               bool give_score) {
+  context_.titles = GetTitleSnapshot();
+  return MatchDatabase(context_, episode, in_list, reverse, strict,
+                       check_episode, check_date, give_score);
+}
+
+bool RecognitionEngine::CompareEpisode(anime::Episode& episode,
+                                       const anime::Item& anime_item,
+                                       bool strict,
+                                       bool check_episode,
+                                       bool check_date,
+                                       bool give_score) {
+  context_.titles = GetTitleSnapshot();
+  return CompareEpisode(context_, episode, anime_item, strict, check_episode,
+                        check_date, give_score);
+}
+
+void RecognitionEngine::ScoreDatabase(anime::Episode& episode,
+                                      bool in_list,
+                                      bool check_episode,
+                                      bool check_date,
+                                      bool exhaustive) {
+  context_.titles = GetTitleSnapshot();
+  ScoreDatabase(context_, episode, in_list, check_episode, check_date,
+                exhaustive);
+}
+
+bool RecognitionEngine::ExamineTitle(const std::wstring& title,
+                                     anime::Episode& episode,
+                                     bool examine_inside,
+                                     bool examine_outside,
+                                     bool examine_number,
+                                     bool check_extras,
+                                     bool check_extension) {
+  return ExamineTitle(context_, title, episode, examine_inside,
+                      examine_outside, examine_number, check_extras,
+                      check_extension);
+}
+
+std::multimap<int, int, std::greater<int>> RecognitionEngine::GetScores() {
+  return context_.GetScores();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+anime::Item* RecognitionEngine::MatchDatabase(RecognitionContext& context,
+                                              anime::Episode& episode,
+                                              bool in_list,
+                                              bool reverse,
+                                              bool strict,
+                                              bool check_episode,
+                                              bool check_date,
+                                              bool give_score) const {
   // Reset scores
-  foreach_(it, scores)
+  foreach_(it, context.scores)
     it->second = 0;
 
+  // Strict matches can only be found among the items that have an equal title
+  // (or title + number), so we look those up first
+  if (strict) {
+    auto& candidates = context.candidates;
+    candidates.clear();
+    context.titles->FindInTitleIndex(episode.clean_title, candidates);
+    if (!episode.number.empty())
+      context.titles->FindInTitleIndex(episode.clean_title + episode.number,
+                                       candidates);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+
+    #define COMPARE_CANDIDATE(it) { \
+      auto anime_item = AnimeDatabase.FindItem(*it); \
+      if (anime_item && (!in_list || anime_item->IsInList())) \
+        if (CompareEpisode(context, episode, *anime_item, strict, \
+                           check_episode, check_date, give_score)) \
+          return AnimeDatabase.FindItem(episode.anime_id); }
+    if (reverse) {
+      foreach_r_(it, candidates)
+        COMPARE_CANDIDATE(it);
+    } else {
+      foreach_(it, candidates)
+        COMPARE_CANDIDATE(it);
+    }
+    #undef COMPARE_CANDIDATE
+
+    // Other items are only compared if we need their scores
+    if (give_score)
+      ScoreDatabase(context, episode, in_list, check_episode, check_date);
+    return nullptr;
+  }
+
   if (reverse) {
     foreach_r_(it, AnimeDatabase.items) {
       if (in_list && !it->second.IsInList())
         continue;
-      if (Meow.CompareEpisode(episode, it->second, strict, check_episode,
-                              check_date, give_score))
+      if (CompareEpisode(context, episode, it->second, strict, check_episode,
+                         check_date, give_score))
         return AnimeDatabase.FindItem(episode.anime_id);
     }
   } else {
     foreach_(it, AnimeDatabase.items) {
       if (in_list && !it->second.IsInList())
         continue;
-      if (Meow.CompareEpisode(episode, it->second, strict, check_episode,
-                              check_date, give_score))
+      if (CompareEpisode(context, episode, it->second, strict, check_episode,
+                         check_date, give_score))
         return AnimeDatabase.FindItem(episode.anime_id);
     }
   }
@@ -97,14 +197,47 @@ anime::Item* RecognitionEngine::MatchDatabase(anime::Episode& episode,
   return nullptr;
 }
 
+void RecognitionEngine::ScoreDatabase(RecognitionContext& context,
+                                      anime::Episode& episode,
+                                      bool in_list,
+                                      bool check_episode,
+                                      bool check_date,
+                                      bool exhaustive) const {
+  // Only the items that share the most trigrams with the episode title are
+  // worth scoring, unless we are told otherwise
+  std::vector<int> candidates;
+  if (!exhaustive)
+    context.titles->FindInTrigramIndex(episode.clean_title, in_list,
+                                       candidates);
+
+  // Items that have an equal title are not scored by CompareEpisode, so it is
+  // safe to call it with strict matching here
+  if (candidates.empty()) {
+    foreach_r_(it, AnimeDatabase.items) {
+      if (in_list && !it->second.IsInList())
+        continue;
+      CompareEpisode(context, episode, it->second, true, check_episode,
+                     check_date, true);
+    }
+  } else {
+    foreach_r_(it, candidates) {
+      auto anime_item = AnimeDatabase.FindItem(*it);
+      if (anime_item)
+        CompareEpisode(context, episode, *anime_item, true, check_episode,
+                       check_date, true);
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-bool RecognitionEngine::CompareEpisode(anime::Episode& episode,
+bool RecognitionEngine::CompareEpisode(RecognitionContext& context,
+                                       anime::Episode& episode,
                                        const anime::Item& anime_item,
                                        bool strict,
                                        bool check_episode,
                                        bool check_date,
-                                       bool give_score) {
+                                       bool give_score) const {
   // Leave if title is empty
   if (episode.clean_title.empty())
     return false;
@@ -115,10 +248,15 @@ bool RecognitionEngine::CompareEpisode(anime::Episode& episode,
 
   bool found = false;
 
-  // Compare with titles
-  if (clean_titles[anime_item.GetId()].empty())
-    UpdateCleanTitles(anime_item.GetId());
-  foreach_(it, clean_titles[anime_item.GetId()]) {
+  // Compare with titles. Items that were added after the snapshot was taken
+  // have their titles cleaned here, without modifying the snapshot.
+  std::vector<std::wstring> item_titles;
+  auto clean_titles = context.titles->FindCleanTitles(anime_item.GetId());
+  if (!clean_titles) {
+    GetCleanTitles(anime_item, item_titles);
+    clean_titles = &item_titles;
+  }
+  foreach_c_(it, *clean_titles) {
     found = CompareTitle(*it, episode, anime_item, strict);
     if (found)
       break;
@@ -127,7 +265,7 @@ bool RecognitionEngine::CompareEpisode(anime::Episode& episode,
   if (!found) {
     // Score title in case we need it later on
     if (give_score)
-      ScoreTitle(episode, anime_item);
+      ScoreTitle(context, episode, anime_item, clean_titles->front());
     // Leave if not found
     return false;
   }
@@ -163,7 +301,7 @@ bool RecognitionEngine::CompareEpisode(anime::Episode& episode,
 bool RecognitionEngine::CompareTitle(const std::wstring& anime_title,
                                      anime::Episode& episode,
                                      const anime::Item& anime_item,
-                                     bool strict) {
+                                     bool strict) const {
   // Compare with title + number
   if (strict && anime_item.GetEpisodeCount() == 1 && !episode.number.empty()) {
     if (IsEqual(episode.clean_title + episode.number, anime_title)) {
@@ -184,10 +322,10 @@ bool RecognitionEngine::CompareTitle(const std::wstring& anime_title,
   return false;
 }
 
-std::multimap<int, int, std::greater<int>> RecognitionEngine::GetScores() {
+std::multimap<int, int, std::greater<int>> RecognitionContext::GetScores() const {
   std::multimap<int, int, std::greater<int>> reverse_map;
 
-  foreach_(it, scores) {
+  foreach_c_(it, scores) {
     if (it->second == 0)
       continue;
     reverse_map.insert(std::pair<int, int>(it->second, it->first));
@@ -196,10 +334,11 @@ std::multimap<int, int, std::greater<int>> RecognitionEngine::GetScores() {
   return reverse_map;
 }
 
-bool RecognitionEngine::ScoreTitle(const anime::Episode& episode,
-                                   const anime::Item& anime_item) {
+bool RecognitionEngine::ScoreTitle(RecognitionContext& context,
+                                   const anime::Episode& episode,
+                                   const anime::Item& anime_item,
+                                   const std::wstring& anime_title) const {
   const std::wstring& episode_title = episode.clean_title;
-  const std::wstring& anime_title = clean_titles[anime_item.GetId()].front();
 
   const int score_bonus_small = 1;
   const int score_bonus_big = 5;
@@ -238,7 +377,7 @@ bool RecognitionEngine::ScoreTitle(const anime::Episode& episode,
   }
 
   if (score > score_min) {
-    scores[anime_item.GetId()] = score;
+    context.scores[anime_item.GetId()] = score;
     return true;
   }
 
@@ -247,13 +386,191 @@ bool RecognitionEngine::ScoreTitle(const anime::Episode& episode,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool RecognitionEngine::ExamineTitle(std::wstring title,
+KeywordTable::KeywordTable()
+    : max_length_(0), seed_(0) {
+}
+
+void KeywordTable::Add(const std::wstring& keyword, int categories) {
+  std::wstring key = keyword;
+  std::transform(key.begin(), key.end(), key.begin(), tolower);
+  keywords_[key] |= categories;
+  max_length_ = std::max(max_length_, key.length());
+}
+
+void KeywordTable::Build() {
+  entries_.assign(keywords_.begin(), keywords_.end());
+  keywords_.clear();
+
+  // Look for a seed that gives each keyword a slot of its own, increasing the
+  // size of the table if it takes too long to find one
+  size_t slot_count = 64;
+  while (slot_count < entries_.size() * entries_.size())
+    slot_count *= 2;
+
+  for (seed_ = 1; ; seed_++) {
+    if (seed_ % 256 == 0)
+      slot_count *= 2;
+    slots_.assign(slot_count, 0);
+    bool collision = false;
+    for (size_t i = 0; i < entries_.size(); i++) {
+      const std::wstring& key = entries_[i].first;
+      auto& slot = slots_[Hash(key.data(), key.length(), seed_)];
+      if (slot) {
+        collision = true;
+        break;
+      }
+      slot = static_cast<unsigned short>(i + 1);
+    }
+    if (!collision)
+      break;
+  }
+}
+
+int KeywordTable::Find(const std::wstring& str) const {
+  return Find(str, 0, str.length());
+}
+
+int KeywordTable::Find(const std::wstring& str, size_t pos,
+                       size_t length) const {
+  if (length == 0 || length > max_length_ || slots_.empty())
+    return 0;
+
+  size_t slot = slots_[Hash(str.data() + pos, length, seed_)];
+  if (!slot)
+    return 0;
+
+  const auto& entry = entries_[slot - 1];
+  if (entry.first.length() != length)
+    return 0;
+  for (size_t i = 0; i < length; i++)
+    if (tolower(str[pos + i]) != entry.first[i])
+      return 0;
+
+  return entry.second;
+}
+
+size_t KeywordTable::Hash(const wchar_t* str, size_t length,
+                          unsigned int seed) const {
+  // FNV-1a over lowercase characters
+  unsigned int hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<unsigned int>(tolower(str[i]));
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 15;
+
+  return hash & (slots_.size() - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StringArena::Acquire(std::wstring& str) {
+  // Here we assume that the string has no buffer of its own
+  if (!buffers_.empty()) {
+    str.swap(buffers_.back());
+    buffers_.pop_back();
+  }
+  str.clear();
+}
+
+void StringArena::Release(std::wstring& str) {
+  buffers_.push_back(std::wstring());
+  buffers_.back().swap(str);
+}
+
+static bool IsEqualAt(const std::wstring& str, size_t pos,
+                      const std::wstring& key) {
+  if (pos + key.length() > str.length())
+    return false;
+
+  for (size_t i = 0; i < key.length(); i++)
+    if (tolower(str[pos + i]) != tolower(key[i]))
+      return false;
+
+  return true;
+}
+
+static void SwapTokens(Token& token1, Token& token2) {
+  token1.content.swap(token2.content);
+  std::swap(token1.encloser, token2.encloser);
+  std::swap(token1.separator, token2.separator);
+  std::swap(token1.untouched, token2.untouched);
+}
+
+static void EraseToken(StringArena& arena, std::vector<Token>& tokens,
+                       size_t index) {
+  arena.Release(tokens[index].content);
+  for (size_t i = index; i + 1 < tokens.size(); i++)
+    SwapTokens(tokens[i], tokens[i + 1]);
+  tokens.pop_back();
+}
+
+static void ReleaseTokens(StringArena& arena, std::vector<Token>& tokens,
+                          size_t count) {
+  for (size_t i = count; i < tokens.size(); i++)
+    arena.Release(tokens[i].content);
+  tokens.erase(tokens.begin() + std::min(count, tokens.size()), tokens.end());
+}
+
+static void ReleaseWords(StringArena& arena, std::vector<std::wstring>& words) {
+  foreach_(word, words)
+    arena.Release(*word);
+  words.clear();
+}
+
+static void AppendWord(const std::wstring& str, size_t pos, size_t length,
+                       std::vector<std::wstring>& words, StringArena& arena) {
+  words.push_back(std::wstring());
+  arena.Acquire(words.back());
+  words.back().assign(str, pos, length);
+}
+
+// Same as Split, except that the separator is a single character
+static void SplitWords(const std::wstring& str, wchar_t separator,
+                       std::vector<std::wstring>& words, StringArena& arena) {
+  size_t index_begin = 0, index_end;
+
+  do {
+    index_end = str.find(separator, index_begin);
+    if (index_end == std::wstring::npos)
+      index_end = str.length();
+
+    AppendWord(str, index_begin, index_end - index_begin, words, arena);
+
+    index_begin = index_end + 1;
+  } while (index_begin <= str.length());
+}
+
+// Same as Tokenize, except that the delimiter is a single character
+static void TokenizeWords(const std::wstring& str, wchar_t delimiter,
+                          std::vector<std::wstring>& words,
+                          StringArena& arena) {
+  size_t index_begin = str.find_first_not_of(delimiter);
+
+  while (index_begin != std::wstring::npos) {
+    size_t index_end = str.find_first_of(delimiter, index_begin + 1);
+    if (index_end == std::wstring::npos) {
+      AppendWord(str, index_begin, std::wstring::npos, words, arena);
+      break;
+    } else {
+      AppendWord(str, index_begin, index_end - index_begin, words, arena);
+      index_begin = str.find_first_not_of(delimiter, index_end + 1);
+    }
+  }
+}
+
+bool RecognitionEngine::ExamineTitle(RecognitionContext& context,
+                                     const std::wstring& raw_title,
                                      anime::Episode& episode,
                                      bool examine_inside,
                                      bool examine_outside,
                                      bool examine_number,
                                      bool check_extras,
-                                     bool check_extension) {
+                                     bool check_extension) const {
+  // Work on a copy, as the title may belong to the episode itself
+  std::wstring& title = context.title;
+  title.assign(raw_title);
+
   // Clear previous data
   episode.Clear();
 
@@ -265,8 +582,9 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
 
   // Retrieve file name from full path
   if (title.length() > 2 && title.at(1) == ':' && title.at(2) == '\\') {
-    episode.folder = GetPathOnly(title);
-    title = GetFileName(title);
+    size_t pos = title.find_last_of(L"/\\") + 1;
+    episode.folder.assign(title, 0, pos);
+    title.erase(0, pos);
   }
   episode.file = title;
 
@@ -277,20 +595,22 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
         return false;
 
   // Check and trim file extension
-  std::wstring extension = GetFileExtension(title);
+  std::wstring& extension = context.extension;
+  extension.assign(title, title.find_last_of(L'.') + 1, std::wstring::npos);
   if (!extension.empty() &&
       extension.length() < title.length() &&
       extension.length() <= 5) {
     if (IsAlphanumeric(extension) &&
         CheckFileExtension(extension, valid_extensions)) {
-      episode.format = ToUpper_Copy(extension);
+      episode.format = extension;
+      ToUpper(episode.format);
       title.resize(title.length() - extension.length() - 1);
     } else {
       if (IsNumeric(extension)) {
-        std::wstring temp = title.substr(0, title.length() - extension.length());
+        size_t length = title.length() - extension.length();
         foreach_(it, episode_keywords) {
-          if (temp.length() >= it->length() &&
-              IsEqual(CharRight(temp, it->length()), *it)) {
+          if (length >= it->length() &&
+              IsEqualAt(title, length - it->length(), *it)) {
             title.resize(title.length() - extension.length() - it->length() - 1);
             episode.number = extension;
             break;
@@ -312,9 +632,9 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
   //   some keyword within is recognized and erased.
 
   // Tokenize
-  std::vector<Token> tokens;
-  tokens.reserve(4);
-  TokenizeTitle(title, L"[](){}", tokens);
+  auto& tokens = context.tokens;
+  ReleaseTokens(context.arena, tokens, 0);
+  TokenizeTitle(title, L"[](){}", tokens, context.arena);
   if (tokens.empty())
     return false;
   title.clear();
@@ -323,10 +643,10 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
   foreach_(token, tokens) {
     if (IsTokenEnclosed(*token)) {
       if (examine_inside)
-        ExamineToken(*token, episode, check_extras);
+        ExamineToken(context, *token, episode, check_extras);
     } else {
       if (examine_outside)
-        ExamineToken(*token, episode, check_extras);
+        ExamineToken(context, *token, episode, check_extras);
     }
   }
 
@@ -341,34 +661,41 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
         tokens[i - 1].content.length() < 2) {
       continue;
     }
-    tokens[i - 1].content += L"(" + tokens[i].content + L")";
+    tokens[i - 1].content.push_back(L'(');
+    tokens[i - 1].content.append(tokens[i].content);
+    tokens[i - 1].content.push_back(L')');
     if (IsTokenEnclosed(tokens[i + 1]) == false) {
-      tokens[i - 1].content += tokens[i + 1].content;
+      tokens[i - 1].content.append(tokens[i + 1].content);
       if (tokens[i - 1].separator == '\0')
         tokens[i - 1].separator = tokens[i + 1].separator;
-      tokens.erase(tokens.begin() + i + 1);
+      EraseToken(context.arena, tokens, i + 1);
     }
-    tokens.erase(tokens.begin() + i);
+    EraseToken(context.arena, tokens, i);
     i = 0;
   }
+  size_t token_count = 0;
   for (size_t i = 0; i < tokens.size(); i++) {
     // Trim separator character from each side of the token
     wchar_t trim_char[] = {tokens[i].separator, '\0'};
     Trim(tokens[i].content, trim_char);
     // Tokens that are too short are now garbage, so we take them out
-    if (tokens[i].content.length() < 2 && !IsNumeric(tokens[i].content)) {
-      tokens.erase(tokens.begin() + i);
-      i--;
-    }
+    if (tokens[i].content.length() < 2 && !IsNumeric(tokens[i].content))
+      continue;
+    if (i != token_count)
+      SwapTokens(tokens[i], tokens[token_count]);
+    token_count++;
   }
+  ReleaseTokens(context.arena, tokens, token_count);
 
   //////////////////////////////////////////////////////////////////////////////
   // Now we apply some logic to decide on the title and the group name
 
   int group_index = -1;
   int title_index = -1;
-  std::vector<int> group_vector;
-  std::vector<int> title_vector;
+  auto& group_vector = context.group_indexes;
+  auto& title_vector = context.title_indexes;
+  group_vector.clear();
+  title_vector.clear();
   for (size_t i = 0; i < tokens.size(); i++) {
     if (IsTokenEnclosed(tokens[i])) {
       group_vector.push_back(i);
@@ -419,9 +746,8 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
     ReplaceChar(tokens[title_index].content, tokens[title_index].separator, ' ');
     // Do some clean-up
     Trim(tokens[title_index].content, L" -");
-    // Set the title
-    title = tokens[title_index].content;
-    tokens[title_index].content.clear();
+    // Set the title (which is empty at this point, so the token is cleared)
+    title.swap(tokens[title_index].content);
     tokens[title_index].untouched = false;
   }
 
@@ -456,9 +782,9 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
     // Check title
     if (episode.number.empty()) {
       // Split into words
-      std::vector<std::wstring> words;
-      words.reserve(4);
-      Tokenize(title, L" ", words);
+      auto& words = context.words;
+      ReleaseWords(context.arena, words);
+      TokenizeWords(title, L' ', words, context.arena);
       if (words.empty())
         return false;
       title.clear();
@@ -526,7 +852,8 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
       for (int i = 0; i < static_cast<int>(words.size()); i++) {
         if (number_index == -1 || i < number_index) {
           // Ignore episode keywords
-          if (i == number_index - 1 && CompareKeys(words[i], episode_keywords))
+          if (i == number_index - 1 &&
+              keywords_.Find(words[i]) & kKeywordEpisode)
             continue;
           AppendKeyword(title, words[i]);
         } else if (i > number_index) {
@@ -568,7 +895,7 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
   // Examine remaining tokens once more
   foreach_(token, tokens)
     if (!token->content.empty())
-      ExamineToken(*token, episode, true);
+      ExamineToken(context, *token, episode, true);
 
   //////////////////////////////////////////////////////////////////////////////
 
@@ -582,21 +909,24 @@ bool RecognitionEngine::ExamineTitle(std::wstring title,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void RecognitionEngine::ExamineToken(Token& token, anime::Episode& episode,
-                                     bool compare_extras) {
+void RecognitionEngine::ExamineToken(RecognitionContext& context,
+                                     Token& token, anime::Episode& episode,
+                                     bool compare_extras) const {
   // Split into words. The most common non-alphanumeric character is the
   // separator.
-  std::vector<std::wstring> words;
+  auto& words = context.token_words;
+  ReleaseWords(context.arena, words);
   token.separator = GetMostCommonCharacter(token.content);
-  Split(token.content, std::wstring(1, token.separator), words);
+  SplitWords(token.content, token.separator, words, context.arena);
 
   // Revert if there are words that are too short. This prevents splitting some
   // group names (e.g. "m.3.3.w") and keywords (e.g. "H.264").
   if (IsTokenEnclosed(token)) {
     foreach_(word, words) {
       if (word->length() == 1) {
-        words.clear();
-        words.push_back(token.content);
+        ReleaseWords(context.arena, words);
+        AppendWord(token.content, 0, token.content.length(), words,
+                   context.arena);
         break;
       }
     }
@@ -610,6 +940,8 @@ void RecognitionEngine::ExamineToken(Token& token, anime::Episode& episode,
     #define RemoveWordFromToken(b) { \
       Erase(token.content, *word, b); token.untouched = false; }
 
+    int categories = keywords_.Find(*word);
+
     // Checksum
     if (episode.checksum.empty() && word->length() == 8 && IsHex(*word)) {
       episode.checksum = *word;
@@ -619,22 +951,22 @@ void RecognitionEngine::ExamineToken(Token& token, anime::Episode& episode,
       episode.resolution = *word;
       RemoveWordFromToken(false);
     // Video info
-    } else if (CompareKeys(*word, video_keywords)) {
+    } else if (categories & kKeywordVideo) {
       AppendKeyword(episode.video_type, *word);
       RemoveWordFromToken(true);
     // Audio info
-    } else if (CompareKeys(*word, audio_keywords)) {
+    } else if (categories & kKeywordAudio) {
       AppendKeyword(episode.audio_type, *word);
       RemoveWordFromToken(true);
     // Version
-    } else if (episode.version.empty() && CompareKeys(*word, version_keywords)) {
+    } else if (episode.version.empty() && categories & kKeywordVersion) {
       episode.version.push_back(word->at(word->length() - 1));
       RemoveWordFromToken(true);
     // Extras
-    } else if (compare_extras && CompareKeys(*word, extra_keywords)) {
+    } else if (compare_extras && categories & kKeywordExtra) {
       AppendKeyword(episode.extras, *word);
       RemoveWordFromToken(true);
-    } else if (compare_extras && CompareKeys(*word, extra_unsafe_keywords)) {
+    } else if (compare_extras && categories & kKeywordExtraUnsafe) {
       AppendKeyword(episode.extras, *word);
       if (IsTokenEnclosed(token))
         RemoveWordFromToken(true);
@@ -649,96 +981,635 @@ void RecognitionEngine::ExamineToken(Token& token, anime::Episode& episode,
 // Helper functions
 
 void RecognitionEngine::AppendKeyword(std::wstring& str,
-                                      const std::wstring& keyword) {
+                                      const std::wstring& keyword) const {
   AppendString(str, keyword, L" ");
 }
 
-bool RecognitionEngine::CompareKeys(const std::wstring& str,
-                                    const std::vector<std::wstring>& keys) {
-  if (!str.empty())
-    foreach_(key, keys)
-      if (IsEqual(str, *key))
-        return true;
+void RecognitionEngine::GetCleanTitles(const anime::Item& anime_item,
+                                       std::vector<std::wstring>& titles) const {
+  // Main title
+  titles.push_back(anime_item.GetTitle());
+  CleanTitle(titles.back());
 
-  return false;
+  // English title
+  if (!anime_item.GetEnglishTitle().empty()) {
+    titles.push_back(anime_item.GetEnglishTitle());
+    CleanTitle(titles.back());
+  }
+
+  // Synonyms
+  if (!anime_item.GetUserSynonyms().empty()) {
+    foreach_c_(it, anime_item.GetUserSynonyms()) {
+      titles.push_back(*it);
+      CleanTitle(titles.back());
+    }
+  }
+  if (!anime_item.GetSynonyms().empty()) {
+    auto synonyms = anime_item.GetSynonyms();
+    foreach_(it, synonyms) {
+      titles.push_back(*it);
+      CleanTitle(titles.back());
+    }
+  }
 }
 
-void RecognitionEngine::CleanTitle(std::wstring& title) {
-  if (title.empty())
-    return;
+std::shared_ptr<const TitleSnapshot> RecognitionEngine::GetTitleSnapshot() {
+  UpdateTitleIndex();
+  return titles_;
+}
+
+unsigned int RecognitionEngine::GetTitleVersion() const {
+  return titles_version_;
+}
 
-  EraseUnnecessary(title);
-  TransliterateSpecial(title);
-  ErasePunctuation(title, true);
+TitleSnapshot& RecognitionEngine::GetMutableTitles() {
+  titles_version_++;
+
+  // The main thread context is the only user we can safely let go of
+  context_.titles.reset();
+
+  // Copy on write, if the snapshot is still in use elsewhere
+  if (!titles_) {
+    titles_.reset(new TitleSnapshot);
+  } else if (!titles_.unique()) {
+    titles_.reset(new TitleSnapshot(*titles_));
+  }
+
+  return *titles_;
+}
+
+void RecognitionEngine::ClearCleanTitles() {
+  titles_version_++;
+  context_.titles.reset();
+  titles_.reset();
 }
 
 void RecognitionEngine::UpdateCleanTitles(int anime_id) {
   auto anime_item = AnimeDatabase.FindItem(anime_id);
+  auto& titles = GetMutableTitles();
 
-  clean_titles[anime_id].clear();
+  titles.Remove(anime_id);
 
-  // Main title
-  clean_titles[anime_id].push_back(anime_item->GetTitle());
-  CleanTitle(clean_titles[anime_id].back());
+  std::vector<std::wstring> clean_titles;
+  GetCleanTitles(*anime_item, clean_titles);
+  titles.Add(anime_id, clean_titles);
+  titles_modified_ = true;
+}
 
-  // English title
-  if (!anime_item->GetEnglishTitle().empty()) {
-    clean_titles[anime_id].push_back(anime_item->GetEnglishTitle());
-    CleanTitle(clean_titles[anime_id].back());
+void RecognitionEngine::UpdateTitleIndex() {
+  // Every item in the database must have its clean titles indexed before we
+  // can rely on the index for strict matching. Comparing the number of items
+  // is not enough, as an item may have been removed and another one added.
+  unsigned int items_version = AnimeDatabase.GetItemsVersion();
+  if (titles_ && titles_items_version_ == items_version)
+    return;
+  titles_items_version_ = items_version;
+
+  auto& titles = GetMutableTitles();
+
+  for (auto it = titles.clean_titles.begin();
+       it != titles.clean_titles.end(); ) {
+    int anime_id = it->first;
+    ++it;
+    if (!AnimeDatabase.FindItem(anime_id))
+      titles.Remove(anime_id);
   }
 
-  // Synonyms
-  if (!anime_item->GetUserSynonyms().empty()) {
-    foreach_(it, anime_item->GetUserSynonyms()) {
-      clean_titles[anime_id].push_back(*it);
-      CleanTitle(clean_titles[anime_id].back());
+  foreach_(it, AnimeDatabase.items) {
+    if (!titles.FindCleanTitles(it->first)) {
+      std::vector<std::wstring> clean_titles;
+      GetCleanTitles(it->second, clean_titles);
+      titles.Add(it->first, clean_titles);
+      titles_modified_ = true;
     }
   }
-  if (!anime_item->GetSynonyms().empty()) {
-    auto synonyms = anime_item->GetSynonyms();
-    foreach_(it, synonyms) {
-      clean_titles[anime_id].push_back(*it);
-      CleanTitle(clean_titles[anime_id].back());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bump the version whenever CleanTitle output changes, so that stale caches
+// are discarded as a whole.
+static const UINT32 kTitleCacheMagic = 0x54434754;  // "TGCT"
+static const UINT32 kTitleCacheVersion = 1;
+
+static void HashTitle(UINT64& hash, const std::wstring& title) {
+  // FNV-1a, with a terminator so that ("ab", "c") differs from ("a", "bc")
+  for (size_t i = 0; i <= title.size(); ++i) {
+    hash ^= i < title.size() ? title[i] : 0;
+    hash *= 0x100000001b3ULL;
+  }
+}
+
+// Identifies the source titles that clean titles are derived from. Unlike the
+// last modified time, this also covers user synonyms.
+static UINT64 GetTitleFingerprint(const anime::Item& anime_item) {
+  UINT64 hash = 0xcbf29ce484222325ULL;
+
+  HashTitle(hash, anime_item.GetTitle());
+  HashTitle(hash, anime_item.GetEnglishTitle());
+  foreach_c_(it, anime_item.GetUserSynonyms())
+    HashTitle(hash, *it);
+  auto synonyms = anime_item.GetSynonyms();
+  foreach_c_(it, synonyms)
+    HashTitle(hash, *it);
+
+  return hash;
+}
+
+bool RecognitionEngine::LoadTitleCache() {
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeTitles);
+
+  FileMapping file;
+  if (!file.Open(path))
+    return false;
+
+  BinaryReader reader(file.data(), file.size());
+
+  UINT32 magic = 0, version = 0, count = 0;
+  if (!reader.Read(magic) || magic != kTitleCacheMagic ||
+      !reader.Read(version) || version != kTitleCacheVersion ||
+      !reader.Read(count)) {
+    LOG(LevelWarning, L"Discarding incompatible title cache: " + path);
+    return false;
+  }
+
+  auto& titles = GetMutableTitles();
+  size_t loaded = 0;
+  bool corrupt = false;
+  std::vector<std::wstring> clean_titles;
+
+  for (UINT32 i = 0; i < count; ++i) {
+    INT32 anime_id = 0;
+    INT64 last_modified = 0;
+    UINT64 fingerprint = 0;
+    UINT32 title_count = 0;
+    if (!reader.Read(anime_id) || !reader.Read(last_modified) ||
+        !reader.Read(fingerprint) || !reader.Read(title_count))
+      break;
+
+    // Each title takes at least the bytes of its length
+    if (title_count > reader.remaining() / sizeof(UINT32)) {
+      corrupt = true;
+      break;
     }
+
+    clean_titles.resize(title_count);
+    for (UINT32 j = 0; j < title_count; ++j)
+      if (!reader.ReadString(clean_titles[j]))
+        break;
+    if (reader.failed())
+      break;
+
+    auto anime_item = AnimeDatabase.FindItem(anime_id);
+    if (!anime_item || !anime_item->GetLastModified() ||
+        anime_item->GetLastModified() != static_cast<time_t>(last_modified) ||
+        GetTitleFingerprint(*anime_item) != fingerprint)
+      continue;
+
+    titles.Remove(anime_id);
+    titles.Add(anime_id, clean_titles);
+    loaded++;
+  }
+
+  if (corrupt) {
+    LOG(LevelWarning, L"Title cache is corrupt: " + path);
+  } else if (reader.failed()) {
+    LOG(LevelWarning, L"Title cache is truncated: " + path);
   }
+
+  // Anything that was discarded will be normalized again, and saved on exit
+  titles_modified_ = loaded < AnimeDatabase.items.size();
+
+  LOG(LevelDebug, L"Loaded clean titles of " + ToWstr(static_cast<int>(loaded)) + L"/" +
+                  ToWstr(static_cast<int>(count)) + L" items");
+
+  return loaded > 0;
+}
+
+bool RecognitionEngine::SaveTitleCache() {
+  UpdateTitleIndex();
+
+  if (!titles_modified_)
+    return true;
+
+  BinaryWriter entries;
+  UINT32 count = 0;
+
+  foreach_c_(it, titles_->clean_titles) {
+    // Titles of items that have been removed from the database are skipped
+    auto anime_item = AnimeDatabase.FindItem(it->first);
+    if (!anime_item)
+      continue;
+    entries.Write(static_cast<INT32>(it->first));
+    entries.Write(static_cast<INT64>(anime_item->GetLastModified()));
+    entries.Write(GetTitleFingerprint(*anime_item));
+    entries.Write(static_cast<UINT32>(it->second.size()));
+    foreach_c_(title, it->second)
+      entries.WriteString(*title);
+    count++;
+  }
+
+  BinaryWriter writer;
+  writer.Write(kTitleCacheMagic);
+  writer.Write(kTitleCacheVersion);
+  writer.Write(count);
+  writer.WriteBytes(entries.buffer().data(), entries.size());
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeTitles);
+  if (!SaveToFile(writer.buffer().data(),
+                  static_cast<DWORD>(writer.size()), path)) {
+    LOG(LevelError, L"Could not save title cache: " + path);
+    return false;
+  }
+
+  titles_modified_ = false;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::wstring GetTitleIndexKey(const std::wstring& title) {
+  // Keys are case-folded, so that a lookup returns every item that IsEqual
+  // would consider to be a match. Candidates are verified afterwards.
+  std::wstring key = title;
+  ToLower(key);
+  return key;
+}
+
+static void GetTitleTrigrams(const std::wstring& title,
+                             std::vector<unsigned __int64>& trigrams) {
+  // Titles are padded with a space on each side, so that short titles have at
+  // least one trigram, and word boundaries carry more weight
+  std::wstring key = L" " + GetTitleIndexKey(title) + L" ";
+
+  for (size_t i = 0; i + 2 < key.length(); i++) {
+    trigrams.push_back(
+        (static_cast<unsigned __int64>(key[i]) << 32) |
+        (static_cast<unsigned __int64>(key[i + 1]) << 16) |
+        static_cast<unsigned __int64>(key[i + 2]));
+  }
+
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+}
+
+void TitleSnapshot::Add(int anime_id,
+                        const std::vector<std::wstring>& titles) {
+  clean_titles[anime_id] = titles;
+
+  std::vector<unsigned __int64> trigrams;
+
+  foreach_c_(title, titles) {
+    if (title->empty())
+      continue;
+    auto& anime_ids = title_index[GetTitleIndexKey(*title)];
+    if (std::find(anime_ids.begin(), anime_ids.end(), anime_id) ==
+        anime_ids.end())
+      anime_ids.push_back(anime_id);
+    GetTitleTrigrams(*title, trigrams);
+  }
+
+  // Trigrams are merged, so that each item is listed only once per trigram
+  foreach_(trigram, trigrams)
+    trigram_index[*trigram].push_back(anime_id);
+}
+
+void TitleSnapshot::Remove(int anime_id) {
+  auto it = clean_titles.find(anime_id);
+  if (it == clean_titles.end())
+    return;
+
+  std::vector<unsigned __int64> trigrams;
+
+  foreach_(title, it->second) {
+    GetTitleTrigrams(*title, trigrams);
+    auto key = title_index.find(GetTitleIndexKey(*title));
+    if (key == title_index.end())
+      continue;
+    auto& anime_ids = key->second;
+    anime_ids.erase(std::remove(anime_ids.begin(), anime_ids.end(), anime_id),
+                    anime_ids.end());
+    if (anime_ids.empty())
+      title_index.erase(key);
+  }
+
+  foreach_(trigram, trigrams) {
+    auto key = trigram_index.find(*trigram);
+    if (key == trigram_index.end())
+      continue;
+    auto& anime_ids = key->second;
+    anime_ids.erase(std::remove(anime_ids.begin(), anime_ids.end(), anime_id),
+                    anime_ids.end());
+    if (anime_ids.empty())
+      trigram_index.erase(key);
+  }
+
+  clean_titles.erase(it);
+}
+
+const std::vector<std::wstring>* TitleSnapshot::FindCleanTitles(
+    int anime_id) const {
+  auto it = clean_titles.find(anime_id);
+  return it != clean_titles.end() ? &it->second : nullptr;
+}
+
+void TitleSnapshot::FindInTitleIndex(const std::wstring& title,
+                                     std::vector<int>& anime_ids) const {
+  if (title.empty())
+    return;
+
+  auto it = title_index.find(GetTitleIndexKey(title));
+  if (it != title_index.end())
+    anime_ids.insert(anime_ids.end(), it->second.begin(), it->second.end());
 }
 
-void RecognitionEngine::EraseUnnecessary(std::wstring& str) {
-  EraseLeft(str, L"the ", true);
-  Replace(str, L" the ", L" ", false, true);
-  Erase(str, L"episode ", true);
-  Erase(str, L" ep.", true);
-  Replace(str, L" specials", L" special", false, true);
+void TitleSnapshot::FindInTrigramIndex(const std::wstring& title,
+                                       bool in_list,
+                                       std::vector<int>& anime_ids) const {
+  // Maximum number of candidates that are returned
+  const size_t candidate_count = 50;
+
+  if (title.empty())
+    return;
+
+  std::vector<unsigned __int64> trigrams;
+  GetTitleTrigrams(title, trigrams);
+
+  // Count shared trigrams for each item
+  std::unordered_map<int, int> counts;
+  foreach_(trigram, trigrams) {
+    auto it = trigram_index.find(*trigram);
+    if (it != trigram_index.end())
+      foreach_c_(anime_id, it->second)
+        ++counts[*anime_id];
+  }
+
+  // Mapped as <count, anime_id>
+  std::vector<std::pair<int, int>> ranking;
+  ranking.reserve(counts.size());
+  foreach_(it, counts) {
+    if (in_list) {
+      auto anime_item = AnimeDatabase.FindItem(it->first);
+      if (!anime_item || !anime_item->IsInList())
+        continue;
+    }
+    ranking.push_back(std::make_pair(it->second, it->first));
+  }
+
+  size_t count = std::min(candidate_count, ranking.size());
+  std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end(),
+                    std::greater<std::pair<int, int>>());
+
+  for (size_t i = 0; i < count; i++)
+    anime_ids.push_back(ranking[i].second);
+  std::sort(anime_ids.begin(), anime_ids.end());
 }
 
-// TODO: make faster
-void RecognitionEngine::TransliterateSpecial(std::wstring& str) {
-  // Character equivalencies
-  ReplaceChar(str, L'\u00E9', L'e');  // small e acute accent
-  ReplaceChar(str, L'\uFF0F', L'/');  // unicode slash
-  ReplaceChar(str, L'\uFF5E', L'~');  // unicode tilde
-  ReplaceChar(str, L'\u223C', L'~');  // unicode tilde 2
-  ReplaceChar(str, L'\u301C', L'~');  // unicode tilde 3
-  ReplaceChar(str, L'\uFF1F', L'?');  // unicode question mark
-  ReplaceChar(str, L'\uFF01', L'!');  // unicode exclamation point
-  ReplaceChar(str, L'\u00D7', L'x');  // multiplication symbol
-  ReplaceChar(str, L'\u2715', L'x');  // multiplication symbol 2
+////////////////////////////////////////////////////////////////////////////////
+// Title normalization
+//
+// Clean titles used to be built with a series of Erase, Replace and ReplaceChar
+// calls, followed by ErasePunctuation. Each of those calls is now a stage that
+// characters are streamed through, so that the title is read and written only
+// once. Stages keep the semantics of the calls they replace, including where
+// matching resumes after a replacement, so that the output is the same.
+
+enum NormalizeMode {
+  // EraseLeft
+  kNormalizeLeft,
+  // Case-insensitive Replace, which skips over a failed partial match
+  kNormalizeSkipping,
+  // Erase, and case-sensitive Replace
+  kNormalizeLeftmost,
+  // Case-sensitive Replace with replace_all, which rescans the replacement
+  kNormalizeRescan,
+  // ReplaceChar, and Replace with single characters
+  kNormalizeFold
+};
 
-  // A few common always-equivalent romanizations
-  Replace(str, L"\u014C", L"Ou");  // O macron
-  Replace(str, L"\u014D", L"ou");  // o macron
-  Replace(str, L"\u016B", L"uu");  // u macron
-  Replace(str, L" wa ", L" ha ");  // hepburn to wapuro
-  Replace(str, L" e ", L" he ");  // hepburn to wapuro
-  Replace(str, L" o ", L" wo ");  // hepburn to wapuro
+struct NormalizeStage {
+  const wchar_t* find;
+  const wchar_t* replace_with;
+  NormalizeMode mode;
+  bool case_insensitive;
+};
 
+static const NormalizeStage kNormalizeStages[] = {
+  // Unnecessary words
+  {L"the ", L"", kNormalizeLeft, true},
+  {L" the ", L" ", kNormalizeSkipping, true},
+  {L"episode ", L"", kNormalizeLeftmost, true},
+  {L" ep.", L"", kNormalizeLeftmost, true},
+  {L" specials", L" special", kNormalizeSkipping, true},
+  // Character equivalencies and macrons
+  {L"", L"", kNormalizeFold, false},
+  // Hepburn to wapuro
+  {L" wa ", L" ha ", kNormalizeLeftmost, false},
+  {L" e ", L" he ", kNormalizeLeftmost, false},
+  {L" o ", L" wo ", kNormalizeLeftmost, false},
   // Abbreviations
-  Replace(str, L" & ", L" and ", true, false);
+  {L" & ", L" and ", kNormalizeRescan, false}
+};
+
+const size_t kNormalizeStageCount =
+    sizeof(kNormalizeStages) / sizeof(*kNormalizeStages);
+
+class TitleNormalizer {
+public:
+  TitleNormalizer(std::wstring& output);
+
+  void Put(wchar_t c);
+  void Flush();
+
+private:
+  void PutStage(size_t stage, wchar_t c);
+  void PutStage(size_t stage, const wchar_t* str, size_t length);
+  void Fold(size_t stage, wchar_t c);
+  void ErasePunctuation(wchar_t c);
+
+  class State {
+  public:
+    wchar_t pending[16];
+    size_t length;
+    size_t find_length;
+    bool done;
+  };
+  State states_[kNormalizeStageCount];
+
+  std::wstring& output_;
+  size_t trailing_pos_;
+};
+
+static bool IsCharsEqual(wchar_t c1, wchar_t c2, bool case_insensitive) {
+  return case_insensitive ? tolower(c1) == tolower(c2) : c1 == c2;
+}
+
+TitleNormalizer::TitleNormalizer(std::wstring& output)
+    : output_(output), trailing_pos_(std::wstring::npos) {
+  for (size_t i = 0; i < kNormalizeStageCount; i++) {
+    states_[i].length = 0;
+    states_[i].find_length = wcslen(kNormalizeStages[i].find);
+    states_[i].done = false;
+  }
+}
+
+void TitleNormalizer::Put(wchar_t c) {
+  PutStage(0, c);
+}
+
+void TitleNormalizer::Flush() {
+  // Pending characters cannot be a part of a match anymore
+  for (size_t i = 0; i < kNormalizeStageCount; i++) {
+    auto& state = states_[i];
+    size_t length = state.length;
+    state.length = 0;
+    state.done = true;
+    PutStage(i + 1, state.pending, length);
+  }
+}
+
+void TitleNormalizer::PutStage(size_t stage, const wchar_t* str,
+                               size_t length) {
+  for (size_t i = 0; i < length; i++)
+    PutStage(stage, str[i]);
+}
+
+void TitleNormalizer::PutStage(size_t stage, wchar_t c) {
+  if (stage == kNormalizeStageCount) {
+    ErasePunctuation(c);
+    return;
+  }
+
+  const auto& stage_info = kNormalizeStages[stage];
+  auto& state = states_[stage];
+
+  switch (stage_info.mode) {
+    case kNormalizeFold: {
+      Fold(stage, c);
+      break;
+    }
+
+    case kNormalizeLeft:
+    case kNormalizeSkipping: {
+      if (state.done) {
+        PutStage(stage + 1, c);
+        break;
+      }
+      state.pending[state.length++] = c;
+      if (!IsCharsEqual(c, stage_info.find[state.length - 1],
+                        stage_info.case_insensitive)) {
+        // The mismatching character is not checked again
+        size_t length = state.length;
+        state.length = 0;
+        state.done = stage_info.mode == kNormalizeLeft;
+        PutStage(stage + 1, state.pending, length);
+      } else if (state.length == state.find_length) {
+        state.length = 0;
+        state.done = stage_info.mode == kNormalizeLeft;
+        PutStage(stage + 1, stage_info.replace_with,
+                 wcslen(stage_info.replace_with));
+      }
+      break;
+    }
+
+    case kNormalizeLeftmost:
+    case kNormalizeRescan: {
+      state.pending[state.length++] = c;
+      while (state.length > 0) {
+        size_t i = 0;
+        while (i < state.length &&
+               IsCharsEqual(state.pending[i], stage_info.find[i],
+                            stage_info.case_insensitive))
+          i++;
+        if (i == state.length) {
+          if (state.length == state.find_length) {
+            state.length = 0;
+            if (stage_info.mode == kNormalizeRescan) {
+              PutStage(stage, stage_info.replace_with,
+                       wcslen(stage_info.replace_with));
+            } else {
+              PutStage(stage + 1, stage_info.replace_with,
+                       wcslen(stage_info.replace_with));
+            }
+          }
+          break;
+        }
+        // The first pending character cannot be the start of a match
+        wchar_t first = state.pending[0];
+        std::copy(state.pending + 1, state.pending + state.length,
+                  state.pending);
+        state.length--;
+        PutStage(stage + 1, first);
+      }
+      break;
+    }
+  }
+}
+
+void TitleNormalizer::Fold(size_t stage, wchar_t c) {
+  switch (c) {
+    // Character equivalencies
+    case L'\u00E9': c = L'e'; break;  // small e acute accent
+    case L'\uFF0F': c = L'/'; break;  // unicode slash
+    case L'\uFF5E': c = L'~'; break;  // unicode tilde
+    case L'\u223C': c = L'~'; break;  // unicode tilde 2
+    case L'\u301C': c = L'~'; break;  // unicode tilde 3
+    case L'\uFF1F': c = L'?'; break;  // unicode question mark
+    case L'\uFF01': c = L'!'; break;  // unicode exclamation point
+    case L'\u00D7': c = L'x'; break;  // multiplication symbol
+    case L'\u2715': c = L'x'; break;  // multiplication symbol 2
+    // A few common always-equivalent romanizations
+    case L'\u014C': PutStage(stage + 1, L"Ou", 2); return;  // O macron
+    case L'\u014D': PutStage(stage + 1, L"ou", 2); return;  // o macron
+    case L'\u016B': PutStage(stage + 1, L"uu", 2); return;  // u macron
+  }
+
+  PutStage(stage + 1, c);
+}
+
+void TitleNormalizer::ErasePunctuation(wchar_t c) {
+  // Trailing characters are kept (e.g. "Hayate no Gotoku!", "Needless+",
+  // "Gintama'"), so they are only erased once something else follows them
+  if (c == L'!' || c == L'+' || c == L'\'') {
+    if (trailing_pos_ == std::wstring::npos)
+      trailing_pos_ = output_.length();
+    output_.push_back(c);
+    return;
+  }
+  if (trailing_pos_ != std::wstring::npos) {
+    output_.resize(trailing_pos_);
+    trailing_pos_ = std::wstring::npos;
+  }
+
+  // Control codes, white-space and punctuation characters
+  if (c <= 255 && !isalnum(c))
+    return;
+  // Unicode stars, hearts, notes, etc. (0x2000-0x2767)
+  if (c > 8192 && c < 10087)
+    return;
+
+  output_.push_back(c);
+}
+
+void RecognitionEngine::CleanTitle(std::wstring& title) const {
+  if (title.empty())
+    return;
+
+  std::wstring output;
+  output.reserve(title.length());
+
+  TitleNormalizer normalizer(output);
+  foreach_(it, title)
+    normalizer.Put(*it);
+  normalizer.Flush();
+
+  title.swap(output);
 }
 
 bool RecognitionEngine::IsEpisodeFormat(const std::wstring& str,
                                         anime::Episode& episode,
-                                        const wchar_t separator) {
+                                        const wchar_t separator) const {
   unsigned int numstart, i, j;
 
   // Find first number
@@ -748,7 +1619,7 @@ bool RecognitionEngine::IsEpisodeFormat(const std::wstring& str,
 
   // Check for episode prefix
   if (numstart > 0)
-    if (!CompareKeys(str.substr(0, numstart), episode_prefixes))
+    if (!(keywords_.Find(str, 0, numstart) & kKeywordEpisodePrefix))
       return false;
 
   for (i = numstart + 1; i < str.length(); i++) {
@@ -824,11 +1695,11 @@ bool RecognitionEngine::IsEpisodeFormat(const std::wstring& str,
   return false;
 }
 
-bool RecognitionEngine::IsResolution(const std::wstring& str) {
+bool RecognitionEngine::IsResolution(const std::wstring& str) const {
   return anime::TranslateResolution(str, true) > 0;
 }
 
-bool RecognitionEngine::IsCountingWord(const std::wstring& str) {
+bool RecognitionEngine::IsCountingWord(const std::wstring& str) const {
   if (str.length() > 2) {
     if (EndsWith(str, L"th") || EndsWith(str, L"nd") || EndsWith(str, L"rd") || EndsWith(str, L"st") ||
         EndsWith(str, L"TH") || EndsWith(str, L"ND") || EndsWith(str, L"RD") || EndsWith(str, L"ST")) {
@@ -846,7 +1717,7 @@ bool RecognitionEngine::IsCountingWord(const std::wstring& str) {
   return false;
 }
 
-bool RecognitionEngine::IsTokenEnclosed(const Token& token) {
+bool RecognitionEngine::IsTokenEnclosed(const Token& token) const {
   return token.encloser == '[' ||
          token.encloser == '(' ||
          token.encloser == '{';
@@ -858,18 +1729,20 @@ void RecognitionEngine::ReadKeyword(std::vector<std::wstring>& output,
 }
 
 size_t RecognitionEngine::TokenizeTitle(const std::wstring& str,
-                                        const std::wstring& delimiters,
-                                        std::vector<Token>& tokens) {
+                                        const wchar_t delimiters[],
+                                        std::vector<Token>& tokens,
+                                        StringArena& arena) const {
   size_t index_begin = str.find_first_not_of(delimiters);
 
   while (index_begin != std::wstring::npos) {
     size_t index_end = str.find_first_of(delimiters, index_begin + 1);
     tokens.resize(tokens.size() + 1);
+    arena.Acquire(tokens.back().content);
     if (index_end == std::wstring::npos) {
-      tokens.back().content = str.substr(index_begin);
+      tokens.back().content.assign(str, index_begin, std::wstring::npos);
       break;
     } else {
-      tokens.back().content = str.substr(index_begin, index_end - index_begin);
+      tokens.back().content.assign(str, index_begin, index_end - index_begin);
       if (index_begin > 0)
         tokens.back().encloser = str.at(index_begin - 1);
       index_begin = str.find_first_not_of(delimiters, index_end + 1);
@@ -879,7 +1752,7 @@ size_t RecognitionEngine::TokenizeTitle(const std::wstring& str,
   return tokens.size();
 }
 
-bool RecognitionEngine::ValidateEpisodeNumber(anime::Episode& episode) {
+bool RecognitionEngine::ValidateEpisodeNumber(anime::Episode& episode) const {
   int number = ToInt(episode.number);
 
   if (number <= 0 || number > 1000) {
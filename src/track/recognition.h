@@ -20,7 +20,9 @@
 #define TAIGA_TRACK_RECOGNITION_H
 
 #include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <functional>
 
@@ -28,7 +30,109 @@ namespace anime {
 class Episode;
 class Item;
 }
-class Token;
+
+class Token {
+public:
+  Token() : encloser('\0'), separator('\0'), untouched(true) {}
+
+  std::wstring content;
+  wchar_t encloser;
+  wchar_t separator;
+  bool untouched;
+};
+
+enum KeywordCategory {
+  kKeywordAudio         = 1 << 0,
+  kKeywordVideo         = 1 << 1,
+  kKeywordExtra         = 1 << 2,
+  kKeywordExtraUnsafe   = 1 << 3,
+  kKeywordVersion       = 1 << 4,
+  kKeywordEpisode       = 1 << 5,
+  kKeywordEpisodePrefix = 1 << 6
+};
+
+// Maps keywords to their categories. Keywords are case-insensitive, and the
+// table is built so that every keyword has a slot of its own, which means that
+// a lookup takes a single probe.
+class KeywordTable {
+public:
+  KeywordTable();
+
+  void Add(const std::wstring& keyword, int categories);
+  void Build();
+
+  int Find(const std::wstring& str) const;
+  int Find(const std::wstring& str, size_t pos, size_t length) const;
+
+private:
+  size_t Hash(const wchar_t* str, size_t length, unsigned int seed) const;
+
+  // Mapped as <lowercase keyword, categories>
+  std::map<std::wstring, int> keywords_;
+  std::vector<std::pair<std::wstring, int>> entries_;
+  // Indexes of entries, plus one, as zero marks an empty slot
+  std::vector<unsigned short> slots_;
+  size_t max_length_;
+  unsigned int seed_;
+};
+
+// Keeps the buffers of strings that are no longer in use, so that they can be
+// reused without allocating memory.
+class StringArena {
+public:
+  void Acquire(std::wstring& str);
+  void Release(std::wstring& str);
+
+private:
+  std::vector<std::wstring> buffers_;
+};
+
+// Normalized titles of database items, along with the indexes that are built
+// from them. Snapshots are shared between threads, so they must not be
+// modified once they are handed out by RecognitionEngine::GetTitleSnapshot.
+class TitleSnapshot {
+public:
+  void Add(int anime_id, const std::vector<std::wstring>& titles);
+  void Remove(int anime_id);
+
+  const std::vector<std::wstring>* FindCleanTitles(int anime_id) const;
+  void FindInTitleIndex(const std::wstring& title, std::vector<int>& anime_ids) const;
+  void FindInTrigramIndex(const std::wstring& title, bool in_list, std::vector<int>& anime_ids) const;
+
+  // Mapped as <anime_id, clean titles>
+  std::map<int, std::vector<std::wstring>> clean_titles;
+
+  // Mapped as <normalized clean title, anime IDs>
+  std::unordered_map<std::wstring, std::vector<int>> title_index;
+
+  // Mapped as <trigram, anime IDs>
+  std::unordered_map<unsigned __int64, std::vector<int>> trigram_index;
+};
+
+// Holds the state of recognition calls. A context can be reused for any number
+// of calls, but it must not be used by more than one thread at a time.
+class RecognitionContext {
+public:
+  std::multimap<int, int, std::greater<int>> GetScores() const;
+
+  // Mapped as <anime_id, score>
+  std::map<int, int> scores;
+
+  // Titles to match against, which must be set on the main thread
+  std::shared_ptr<const TitleSnapshot> titles;
+
+  // Scratch buffers. Strings are recycled through the arena, so that examining
+  // titles does not allocate once the buffers are large enough.
+  StringArena arena;
+  std::wstring title;
+  std::wstring extension;
+  std::vector<Token> tokens;
+  std::vector<std::wstring> words;
+  std::vector<std::wstring> token_words;
+  std::vector<int> group_indexes;
+  std::vector<int> title_indexes;
+  std::vector<int> candidates;
+};
 
 class RecognitionEngine {
 public:
@@ -37,6 +141,9 @@ public:
 
   void Initialize();
 
+  // These functions use the context of the main thread, and may only be called
+  // from there.
+
   anime::Item* MatchDatabase(anime::Episode& episode,
                              bool in_list = true,
                              bool reverse = true,
@@ -52,7 +159,13 @@ public:
                       bool check_date = true,
                       bool give_score = false);
 
-  bool ExamineTitle(std::wstring title,
+  void ScoreDatabase(anime::Episode& episode,
+                     bool in_list = true,
+                     bool check_episode = true,
+                     bool check_date = true,
+                     bool exhaustive = false);
+
+  bool ExamineTitle(const std::wstring& title,
                     anime::Episode& episode,
                     bool examine_inside = true,
                     bool examine_outside = true,
@@ -60,18 +173,64 @@ public:
                     bool check_extras = true,
                     bool check_extension = true);
 
-  void ExamineToken(Token& token, anime::Episode& episode, bool compare_extras);
+  std::multimap<int, int, std::greater<int>> GetScores();
 
-  void CleanTitle(std::wstring& title);
-  void UpdateCleanTitles(int anime_id);
+  // These functions are reentrant, and may be called from any thread as long
+  // as each thread has its own context.
 
-  std::multimap<int, int, std::greater<int>> GetScores();
+  anime::Item* MatchDatabase(RecognitionContext& context,
+                             anime::Episode& episode,
+                             bool in_list = true,
+                             bool reverse = true,
+                             bool strict = true,
+                             bool check_episode = true,
+                             bool check_date = true,
+                             bool give_score = false) const;
 
-  // Mapped as <anime_id, score>
-  std::map<int, int> scores;
+  bool CompareEpisode(RecognitionContext& context,
+                      anime::Episode& episode,
+                      const anime::Item& anime_item,
+                      bool strict = true,
+                      bool check_episode = true,
+                      bool check_date = true,
+                      bool give_score = false) const;
 
-  std::map<int, std::vector<std::wstring>> clean_titles;
+  void ScoreDatabase(RecognitionContext& context,
+                     anime::Episode& episode,
+                     bool in_list = true,
+                     bool check_episode = true,
+                     bool check_date = true,
+                     bool exhaustive = false) const;
+
+  bool ExamineTitle(RecognitionContext& context,
+                    const std::wstring& title,
+                    anime::Episode& episode,
+                    bool examine_inside = true,
+                    bool examine_outside = true,
+                    bool examine_number = true,
+                    bool check_extras = true,
+                    bool check_extension = true) const;
+
+  void ExamineToken(RecognitionContext& context, Token& token,
+                    anime::Episode& episode, bool compare_extras) const;
 
+  void CleanTitle(std::wstring& title) const;
+
+  // Clean titles are updated on the main thread. Snapshots that are already in
+  // use are not affected by these functions.
+  std::shared_ptr<const TitleSnapshot> GetTitleSnapshot();
+  unsigned int GetTitleVersion() const;
+  void ClearCleanTitles();
+  void UpdateCleanTitles(int anime_id);
+  void UpdateTitleIndex();
+
+  // Clean titles are persisted between sessions, so that they do not have to
+  // be normalized again on startup. Entries of items that were modified since
+  // are ignored.
+  bool LoadTitleCache();
+  bool SaveTitleCache();
+
+  // Keywords are read-only after construction
   std::vector<std::wstring> audio_keywords;
   std::vector<std::wstring> video_keywords;
   std::vector<std::wstring> extra_keywords;
@@ -82,24 +241,35 @@ public:
   std::vector<std::wstring> episode_prefixes;
 
 private:
+  void AddKeywords(const std::vector<std::wstring>& keywords, int category);
+
   bool CompareTitle(const std::wstring& anime_title,
                     anime::Episode& episode,
                     const anime::Item& anime_item,
-                    bool strict = true);
-  bool ScoreTitle(const anime::Episode& episode,
-                  const anime::Item& anime_item);
-
-  void AppendKeyword(std::wstring& str, const std::wstring& keyword);
-  bool CompareKeys(const std::wstring& str, const std::vector<std::wstring>& keys);
-  void EraseUnnecessary(std::wstring& str);
-  void TransliterateSpecial(std::wstring& str);
-  bool IsEpisodeFormat(const std::wstring& str, anime::Episode& episode, const wchar_t separator = ' ');
-  bool IsResolution(const std::wstring& str);
-  bool IsCountingWord(const std::wstring& str);
-  bool IsTokenEnclosed(const Token& token);
+                    bool strict = true) const;
+  bool ScoreTitle(RecognitionContext& context,
+                  const anime::Episode& episode,
+                  const anime::Item& anime_item,
+                  const std::wstring& anime_title) const;
+
+  TitleSnapshot& GetMutableTitles();
+  void GetCleanTitles(const anime::Item& anime_item, std::vector<std::wstring>& titles) const;
+
+  void AppendKeyword(std::wstring& str, const std::wstring& keyword) const;
+  bool IsEpisodeFormat(const std::wstring& str, anime::Episode& episode, const wchar_t separator = ' ') const;
+  bool IsResolution(const std::wstring& str) const;
+  bool IsCountingWord(const std::wstring& str) const;
+  bool IsTokenEnclosed(const Token& token) const;
   void ReadKeyword(std::vector<std::wstring>& output, const std::wstring& input);
-  size_t TokenizeTitle(const std::wstring& str, const std::wstring& delimiters, std::vector<Token>& tokens);
-  bool ValidateEpisodeNumber(anime::Episode& episode);
+  size_t TokenizeTitle(const std::wstring& str, const wchar_t delimiters[], std::vector<Token>& tokens, StringArena& arena) const;
+  bool ValidateEpisodeNumber(anime::Episode& episode) const;
+
+  KeywordTable keywords_;
+  RecognitionContext context_;
+  std::shared_ptr<TitleSnapshot> titles_;
+  unsigned int titles_items_version_;
+  bool titles_modified_;
+  unsigned int titles_version_;
 };
 
 extern RecognitionEngine Meow;
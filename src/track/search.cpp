@@ -16,26 +16,33 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "base/binary.h"
 #include "base/file.h"
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
 #include "library/anime_db.h"
 #include "library/anime_util.h"
+#include "taiga/path.h"
 #include "taiga/settings.h"
 #include "taiga/taiga.h"
 #include "track/recognition.h"
 #include "track/search.h"
 #include "ui/ui.h"
 #include "win/win_taskbar.h"
+#include "win/win_thread.h"
 
 TaigaFileSearchHelper file_search_helper;
 
 TaigaFileSearchHelper::TaigaFileSearchHelper()
     : anime_id_(anime::ID_UNKNOWN),
-      episode_number_(0) {
+      episode_number_(0),
+      examined_files_modified_(false) {
   // Here we assume that anything less than 10 MiB can't be a valid episode.
   minimum_file_size_ = 1024 * 1024 * 10;
+
+  set_directory_cache(&directories_);
+  UpdateReadMode();
 }
 
 bool TaigaFileSearchHelper::OnDirectory(const std::wstring& root,
@@ -79,8 +86,37 @@ bool TaigaFileSearchHelper::OnDirectory(const std::wstring& root,
 
 bool TaigaFileSearchHelper::OnFile(const std::wstring& root,
                                    const std::wstring& name) {
-  if (!Meow.ExamineTitle(name, episode_, true, true, true, true, true))
+  // Use the result from OnFiles or a previous search, if available
+  auto examined_file = examined_files_.find(AddTrailingSlash(root) + name);
+  if (examined_file == examined_files_.end()) {
+    ExaminedFile file;
+    file.result = Meow.ExamineTitle(name, file.episode,
+                                    true, true, true, true, true);
+    examined_file = examined_files_.insert(
+        std::make_pair(AddTrailingSlash(root) + name, file)).first;
+    examined_files_modified_ = true;
+  }
+  if (!examined_file->second.result)
+    return false;
+  episode_ = examined_file->second.episode;
+
+  // When anime folders are searched at once, each file is compared with the
+  // anime of the folders that it is in, as if they were searched one by one
+  if (!anime_folders_.empty()) {
+    FindAnimeFolders(root);
+    foreach_c_(it, anime_folder_ids_) {
+      auto anime_item = AnimeDatabase.FindItem(*it);
+      if (!anime_item || completed_anime_ids_.count(*it))
+        continue;
+      episode_ = examined_file->second.episode;
+      if (!Meow.CompareEpisode(episode_, *anime_item))
+        continue;
+      if (SetEpisodeAvailable(*anime_item, AddTrailingSlash(root) + name) &&
+          IsAllEpisodesAvailable(*anime_item))
+        completed_anime_ids_.insert(*it);
+    }
     return false;
+  }
 
   foreach_r_(it, AnimeDatabase.items) {
     anime::Item& anime_item = it->second;
@@ -100,19 +136,11 @@ bool TaigaFileSearchHelper::OnFile(const std::wstring& root,
     if (!Meow.CompareEpisode(episode_, anime_item))
       continue;
 
-    int upper_bound = anime::GetEpisodeHigh(episode_.number);
-    int lower_bound = anime::GetEpisodeLow(episode_.number);
-
-    if (!anime::IsValidEpisode(upper_bound, anime_item.GetEpisodeCount()) ||
-        !anime::IsValidEpisode(lower_bound, anime_item.GetEpisodeCount())) {
-      LOG(LevelWarning, L"Invalid episode number: " + episode_.number);
-      LOG(LevelWarning, L"File: " + AddTrailingSlash(root) + name);
+    if (!SetEpisodeAvailable(anime_item, AddTrailingSlash(root) + name))
       continue;
-    }
 
-    for (int i = lower_bound; i <= upper_bound; i++)
-      anime_item.SetEpisodeAvailability(
-          i, true, AddTrailingSlash(root) + name);
+    int upper_bound = anime::GetEpisodeHigh(episode_.number);
+    int lower_bound = anime::GetEpisodeLow(episode_.number);
 
     // Check if we've found the episode we were looking for
     if (episode_number_ > 0 &&
@@ -134,6 +162,289 @@ bool TaigaFileSearchHelper::OnFile(const std::wstring& root,
   return false;
 }
 
+bool TaigaFileSearchHelper::SetEpisodeAvailable(anime::Item& anime_item,
+                                                const std::wstring& path) {
+  int upper_bound = anime::GetEpisodeHigh(episode_.number);
+  int lower_bound = anime::GetEpisodeLow(episode_.number);
+
+  if (!anime::IsValidEpisode(upper_bound, anime_item.GetEpisodeCount()) ||
+      !anime::IsValidEpisode(lower_bound, anime_item.GetEpisodeCount())) {
+    LOG(LevelWarning, L"Invalid episode number: " + episode_.number);
+    LOG(LevelWarning, L"File: " + path);
+    return false;
+  }
+
+  for (int i = lower_bound; i <= upper_bound; i++)
+    anime_item.SetEpisodeAvailability(i, true, path);
+
+  return true;
+}
+
+void TaigaFileSearchHelper::OnFiles(const std::vector<std::wstring>& paths) {
+  // Recognition only depends on the file name, so files that were examined
+  // before are skipped
+  std::vector<std::wstring> new_paths;
+  foreach_c_(it, paths)
+    if (examined_files_.find(*it) == examined_files_.end())
+      new_paths.push_back(*it);
+  if (new_paths.empty())
+    return;
+
+  // File names are examined in parallel, and the results are consumed by
+  // OnFile in the original order
+  std::vector<ExaminedFile> files(new_paths.size());
+  std::vector<RecognitionContext> contexts(win::GetWorkerCount());
+  auto titles = Meow.GetTitleSnapshot();
+  foreach_(context, contexts)
+    context->titles = titles;
+  win::ParallelFor(new_paths.size(), [&](size_t index, size_t worker) {
+    auto& file = files[index];
+    file.result = Meow.ExamineTitle(contexts[worker],
+                                    GetFileName(new_paths[index]), file.episode,
+                                    true, true, true, true, true);
+  });
+
+  for (size_t i = 0; i < new_paths.size(); i++)
+    examined_files_[new_paths[i]] = files[i];
+  examined_files_modified_ = true;
+}
+
+bool TaigaFileSearchHelper::IsCandidateFile(const std::wstring& name) const {
+  // Subtitles, images and such can't grow into an episode
+  return CheckFileExtension(GetFileExtension(name), Meow.valid_extensions);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::wstring GetAnimeFolderKey(const std::wstring& path) {
+  std::wstring key = path;
+  while (!key.empty() &&
+         (key[key.size() - 1] == L'\\' || key[key.size() - 1] == L'/'))
+    key.resize(key.size() - 1);
+  ToLower(key);
+  return key;
+}
+
+void TaigaFileSearchHelper::SearchAnimeFolders(bool index_only) {
+  anime_folders_.clear();
+  foreach_r_(it, AnimeDatabase.items) {
+    const std::wstring& folder = it->second.GetFolder();
+    if (folder.empty())
+      continue;
+    auto& anime_folder = anime_folders_[GetAnimeFolderKey(folder)];
+    if (anime_folder.path.empty())
+      anime_folder.path = folder;
+    anime_folder.anime_ids.push_back(it->second.GetId());
+  }
+
+  // Folders that are inside another anime folder are walked along with it
+  std::vector<std::wstring> roots;
+  foreach_c_(it, anime_folders_) {
+    std::wstring key = it->first;
+    bool nested = false;
+    for (size_t pos = key.rfind(L'\\'); pos != std::wstring::npos && !nested;
+         pos = key.rfind(L'\\')) {
+      key.resize(pos);
+      nested = anime_folders_.count(key) > 0;
+    }
+    if (!nested)
+      roots.push_back(it->second.path);
+  }
+
+  anime_id_ = anime::ID_UNKNOWN;
+  episode_number_ = 0;
+  UpdateReadMode();
+  skip_directories_ = true;
+  skip_files_ = false;
+  skip_subdirectories_ = false;
+
+  foreach_c_(root, roots) {
+    cache_only_ = index_only && IsIndexed(*root);
+    Search(*root);
+  }
+
+  anime_folders_.clear();
+  anime_folder_ids_.clear();
+  anime_folder_root_.clear();
+  cache_only_ = false;
+  completed_anime_ids_.clear();
+}
+
+void TaigaFileSearchHelper::FindAnimeFolders(const std::wstring& root) {
+  // Files of the same directory are visited one after another
+  if (root == anime_folder_root_)
+    return;
+
+  anime_folder_root_ = root;
+  anime_folder_ids_.clear();
+
+  std::wstring key = GetAnimeFolderKey(root);
+  while (true) {
+    auto it = anime_folders_.find(key);
+    if (it != anime_folders_.end())
+      anime_folder_ids_.insert(anime_folder_ids_.end(),
+                               it->second.anime_ids.begin(),
+                               it->second.anime_ids.end());
+    size_t pos = key.rfind(L'\\');
+    if (pos == std::wstring::npos)
+      break;
+    key.resize(pos);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bump the version whenever ExamineTitle output changes, so that stale results
+// are discarded as a whole.
+static const UINT32 kScanIndexMagic = 0x49534754;  // "TGSI"
+static const UINT32 kScanIndexVersion = 1;
+
+static void WriteEpisode(BinaryWriter& writer, const anime::Episode& episode) {
+  writer.Write(static_cast<INT32>(episode.anime_id));
+  writer.WriteString(episode.file);
+  writer.WriteString(episode.folder);
+  writer.WriteString(episode.format);
+  writer.WriteString(episode.title);
+  writer.WriteString(episode.clean_title);
+  writer.WriteString(episode.name);
+  writer.WriteString(episode.group);
+  writer.WriteString(episode.number);
+  writer.WriteString(episode.version);
+  writer.WriteString(episode.resolution);
+  writer.WriteString(episode.audio_type);
+  writer.WriteString(episode.video_type);
+  writer.WriteString(episode.checksum);
+  writer.WriteString(episode.extras);
+  writer.WriteString(episode.year);
+  writer.Write(static_cast<BYTE>(episode.processed ? 1 : 0));
+}
+
+static bool ReadEpisode(BinaryReader& reader, anime::Episode& episode) {
+  INT32 anime_id = 0;
+  BYTE processed = 0;
+  reader.Read(anime_id);
+  reader.ReadString(episode.file);
+  reader.ReadString(episode.folder);
+  reader.ReadString(episode.format);
+  reader.ReadString(episode.title);
+  reader.ReadString(episode.clean_title);
+  reader.ReadString(episode.name);
+  reader.ReadString(episode.group);
+  reader.ReadString(episode.number);
+  reader.ReadString(episode.version);
+  reader.ReadString(episode.resolution);
+  reader.ReadString(episode.audio_type);
+  reader.ReadString(episode.video_type);
+  reader.ReadString(episode.checksum);
+  reader.ReadString(episode.extras);
+  reader.ReadString(episode.year);
+  reader.Read(processed);
+  episode.anime_id = anime_id;
+  episode.processed = processed != 0;
+  return !reader.failed();
+}
+
+// Only a search for an anime or an episode can stop early, so that anything
+// else may as well read the whole tree in parallel first
+void TaigaFileSearchHelper::UpdateReadMode() {
+  set_read_whole_tree(anime_id_ == anime::ID_UNKNOWN && episode_number_ == 0);
+}
+
+bool TaigaFileSearchHelper::IsIndexed(const std::wstring& path) const {
+  return directories_.Find(path) != nullptr;
+}
+
+bool TaigaFileSearchHelper::LoadIndex() {
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseScanIndex);
+
+  FileMapping file;
+  if (!file.Open(path))
+    return false;
+
+  BinaryReader reader(file.data(), file.size());
+
+  UINT32 magic = 0, version = 0, count = 0;
+  if (!reader.Read(magic) || magic != kScanIndexMagic ||
+      !reader.Read(version) || version != kScanIndexVersion ||
+      !directories_.Read(reader) || !reader.Read(count)) {
+    LOG(LevelWarning, L"Discarding incompatible scan index: " + path);
+    directories_.Clear();
+    return false;
+  }
+
+  examined_files_.clear();
+
+  for (UINT32 i = 0; i < count; ++i) {
+    std::wstring file_path;
+    ExaminedFile examined_file;
+    BYTE result = 0;
+    if (!reader.ReadString(file_path) || !reader.Read(result) ||
+        !ReadEpisode(reader, examined_file.episode))
+      break;
+    examined_file.result = result != 0;
+    examined_files_[file_path] = examined_file;
+  }
+
+  if (reader.failed())
+    LOG(LevelWarning, L"Scan index is truncated: " + path);
+
+  directories_.set_modified(false);
+  examined_files_modified_ = reader.failed();
+
+  LOG(LevelDebug, L"Loaded " + ToWstr(static_cast<int>(examined_files_.size())) +
+                  L" files from the scan index");
+
+  return true;
+}
+
+bool TaigaFileSearchHelper::SaveIndex() {
+  if (!directories_.modified() && !examined_files_modified_)
+    return true;
+
+  // Files that are no longer listed in their directory are removed
+  for (auto it = examined_files_.begin(); it != examined_files_.end(); ) {
+    auto listing = directories_.Find(GetPathOnly(it->first));
+    std::wstring name = GetFileName(it->first);
+    bool found = false;
+    if (listing) {
+      foreach_c_(entry, listing->entries) {
+        if (entry->name == name) {
+          found = true;
+          break;
+        }
+      }
+    }
+    if (found) {
+      ++it;
+    } else {
+      it = examined_files_.erase(it);
+    }
+  }
+
+  BinaryWriter writer;
+  writer.Write(kScanIndexMagic);
+  writer.Write(kScanIndexVersion);
+  directories_.Write(writer);
+  writer.Write(static_cast<UINT32>(examined_files_.size()));
+
+  foreach_c_(it, examined_files_) {
+    writer.WriteString(it->first);
+    writer.Write(static_cast<BYTE>(it->second.result ? 1 : 0));
+    WriteEpisode(writer, it->second.episode);
+  }
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseScanIndex);
+  if (!SaveToFile(writer.buffer().data(),
+                  static_cast<DWORD>(writer.size()), path)) {
+    LOG(LevelError, L"Could not save scan index: " + path);
+    return false;
+  }
+
+  directories_.set_modified(false);
+  examined_files_modified_ = false;
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 const std::wstring& TaigaFileSearchHelper::path_found() const {
@@ -142,10 +453,12 @@ const std::wstring& TaigaFileSearchHelper::path_found() const {
 
 void TaigaFileSearchHelper::set_anime_id(int anime_id) {
   anime_id_ = anime_id;
+  UpdateReadMode();
 }
 
 void TaigaFileSearchHelper::set_episode_number(int episode_number) {
   episode_number_ = episode_number;
+  UpdateReadMode();
 }
 
 void TaigaFileSearchHelper::set_path_found(const std::wstring& path_found) {
@@ -233,7 +546,7 @@ void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number) {
 }
 
 void ScanAvailableEpisodesQuick() {
-  ScanAvailableEpisodesQuick(anime::ID_UNKNOWN);
+  file_search_helper.SearchAnimeFolders(false);
 }
 
 void ScanAvailableEpisodesQuick(int anime_id) {
@@ -253,4 +566,10 @@ void ScanAvailableEpisodesQuick(int anime_id) {
 
     file_search_helper.Search(anime_item.GetFolder());
   }
+}
+
+void RestoreAvailableEpisodes() {
+  // Folders that were scanned before are replayed from the index without
+  // accessing the disk. Changes are picked up by the next quick scan.
+  file_search_helper.SearchAnimeFolders(true);
 }
\ No newline at end of file
@@ -19,7 +19,11 @@
 #ifndef TAIGA_TRACK_SEARCH_H
 #define TAIGA_TRACK_SEARCH_H
 
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "base/file.h"
 #include "library/anime_episode.h"
@@ -31,6 +35,19 @@ public:
 
   bool OnDirectory(const std::wstring& root, const std::wstring& name);
   bool OnFile(const std::wstring& root, const std::wstring& name);
+  void OnFiles(const std::vector<std::wstring>& paths);
+  bool IsCandidateFile(const std::wstring& name) const;
+
+  // The scan index keeps directory listings along with the recognition results
+  // of their files, so that a rescan only has to read the directories that
+  // have changed, and examine the files that are new.
+  bool IsIndexed(const std::wstring& path) const;
+  bool LoadIndex();
+  bool SaveIndex();
+
+  // Walks the folders of all anime at once. Each folder is read only once,
+  // even if it is shared by several anime or nested in the folder of another.
+  void SearchAnimeFolders(bool index_only);
 
   const std::wstring& path_found() const;
 
@@ -39,9 +56,32 @@ public:
   void set_path_found(const std::wstring& path_found);
 
 private:
+  class AnimeFolder {
+  public:
+    std::wstring path;
+    std::vector<int> anime_ids;
+  };
+
+  class ExaminedFile {
+  public:
+    anime::Episode episode;
+    bool result;
+  };
+
+  void FindAnimeFolders(const std::wstring& root);
+  void UpdateReadMode();
+  bool SetEpisodeAvailable(anime::Item& anime_item, const std::wstring& path);
+
+  std::map<std::wstring, AnimeFolder> anime_folders_;
+  std::vector<int> anime_folder_ids_;
+  std::wstring anime_folder_root_;
   int anime_id_;
+  std::set<int> completed_anime_ids_;
+  DirectoryCache directories_;
   anime::Episode episode_;
   int episode_number_;
+  std::unordered_map<std::wstring, ExaminedFile> examined_files_;
+  bool examined_files_modified_;
   std::wstring path_found_;
 };
 
@@ -51,5 +91,6 @@ void ScanAvailableEpisodes(bool silent);
 void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number);
 void ScanAvailableEpisodesQuick();
 void ScanAvailableEpisodesQuick(int anime_id);
+void RestoreAvailableEpisodes();
 
 #endif  // TAIGA_TRACK_SEARCH_H
\ No newline at end of file
@@ -262,6 +262,7 @@ bool HistoryDialog::MoveItems(int pos) {
                    History.queue.items.begin() + j + pos);
     item_selected_new.at(j + pos) = true;
   }
+  History.queue.RebuildPendingValues();
 
   RefreshList();
   for (size_t i = 0; i < item_selected_new.size(); i++)
@@ -97,7 +97,7 @@ BOOL MainDialog::OnInitDialog() {
     sync::Synchronize();
   }
   if (Settings.GetBool(taiga::kApp_Behavior_ScanAvailableEpisodes)) {
-    ScanAvailableEpisodesQuick();
+    RestoreAvailableEpisodes();
   }
   if (!Settings.GetBool(taiga::kApp_Behavior_StartMinimized)) {
     Show(Settings.GetBool(taiga::kApp_Position_Remember) && Settings.GetBool(taiga::kApp_Position_Maximized) ?
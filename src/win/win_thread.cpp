@@ -16,6 +16,10 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <memory>
+
+#include "base/foreach.h"
 #include "win_main.h"
 #include "win_thread.h"
 
@@ -160,4 +164,187 @@ bool Mutex::Release() {
   return value != FALSE;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Worker threads are created on first use and kept alive, so that small batches
+// do not pay for thread creation. The calling thread is worker #0.
+class ThreadPool {
+public:
+  ThreadPool();
+  ~ThreadPool();
+
+  size_t GetWorkerCount();
+  void ParallelFor(size_t count,
+                   const std::function<void(size_t, size_t)>& function);
+
+private:
+  class Worker : public Thread {
+  public:
+    Worker(ThreadPool& pool, size_t index);
+    ~Worker();
+
+    DWORD ThreadProc();
+
+    HANDLE start_event;
+
+  private:
+    ThreadPool& pool_;
+    size_t index_;
+  };
+
+  void Initialize();
+  void Run(size_t worker);
+
+  CriticalSection critical_section_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  HANDLE done_event_;
+  bool initialized_;
+  bool stop_;
+
+  // Current job
+  const std::function<void(size_t, size_t)>* function_;
+  size_t count_;
+  volatile LONG next_index_;
+  volatile LONG busy_workers_;
+};
+
+static ThreadPool thread_pool;
+
+ThreadPool::ThreadPool()
+    : done_event_(nullptr),
+      initialized_(false),
+      stop_(false),
+      function_(nullptr),
+      count_(0),
+      next_index_(0),
+      busy_workers_(0) {
+}
+
+ThreadPool::~ThreadPool() {
+  stop_ = true;
+
+  foreach_(worker, workers_) {
+    if ((*worker)->GetThreadHandle()) {
+      ::SetEvent((*worker)->start_event);
+      ::WaitForSingleObject((*worker)->GetThreadHandle(), INFINITE);
+    }
+  }
+  workers_.clear();
+
+  if (done_event_)
+    ::CloseHandle(done_event_);
+}
+
+void ThreadPool::Initialize() {
+  if (initialized_)
+    return;
+  initialized_ = true;
+
+  SYSTEM_INFO system_info;
+  ::GetSystemInfo(&system_info);
+  size_t count = std::min<size_t>(system_info.dwNumberOfProcessors,
+                                  MAXIMUM_WAIT_OBJECTS);
+
+  done_event_ = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  if (!done_event_)
+    return;
+
+  for (size_t i = 1; i < count; i++) {
+    std::unique_ptr<Worker> worker(new Worker(*this, workers_.size() + 1));
+    if (!worker->start_event || !worker->CreateThread(nullptr, 0, 0))
+      break;
+    workers_.push_back(std::move(worker));
+  }
+}
+
+size_t ThreadPool::GetWorkerCount() {
+  // The pool is already initialized if it is busy
+  if (critical_section_.TryEnter()) {
+    Initialize();
+    critical_section_.Leave();
+  }
+
+  return workers_.size() + 1;
+}
+
+void ThreadPool::ParallelFor(
+    size_t count, const std::function<void(size_t, size_t)>& function) {
+  if (count == 0)
+    return;
+
+  // Jobs are run one at a time. If the pool is busy (e.g. ParallelFor is called
+  // from within a job), the work is done on the calling thread instead.
+  if (!critical_section_.TryEnter()) {
+    for (size_t i = 0; i < count; i++)
+      function(i, 0);
+    return;
+  } else if (function_) {
+    critical_section_.Leave();
+    for (size_t i = 0; i < count; i++)
+      function(i, 0);
+    return;
+  }
+
+  Initialize();
+
+  function_ = &function;
+  count_ = count;
+  next_index_ = 0;
+
+  size_t worker_count = std::min(workers_.size(), count - 1);
+  busy_workers_ = static_cast<LONG>(worker_count);
+  for (size_t i = 0; i < worker_count; i++)
+    ::SetEvent(workers_[i]->start_event);
+
+  Run(0);
+
+  if (worker_count > 0)
+    ::WaitForSingleObject(done_event_, INFINITE);
+
+  function_ = nullptr;
+  critical_section_.Leave();
+}
+
+void ThreadPool::Run(size_t worker) {
+  LONG index;
+  while ((index = ::InterlockedIncrement(&next_index_) - 1) <
+         static_cast<LONG>(count_)) {
+    (*function_)(static_cast<size_t>(index), worker);
+  }
+}
+
+ThreadPool::Worker::Worker(ThreadPool& pool, size_t index)
+    : pool_(pool), index_(index) {
+  start_event = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+}
+
+ThreadPool::Worker::~Worker() {
+  if (start_event)
+    ::CloseHandle(start_event);
+}
+
+DWORD ThreadPool::Worker::ThreadProc() {
+  while (true) {
+    ::WaitForSingleObject(start_event, INFINITE);
+    if (pool_.stop_)
+      break;
+
+    pool_.Run(index_);
+
+    if (::InterlockedDecrement(&pool_.busy_workers_) == 0)
+      ::SetEvent(pool_.done_event_);
+  }
+
+  return 0;
+}
+
+size_t GetWorkerCount() {
+  return thread_pool.GetWorkerCount();
+}
+
+void ParallelFor(size_t count,
+                 const std::function<void(size_t, size_t)>& function) {
+  thread_pool.ParallelFor(count, function);
+}
+
 }  // namespace win
\ No newline at end of file
@@ -19,6 +19,8 @@
 #ifndef TAIGA_WIN_THREAD_H
 #define TAIGA_WIN_THREAD_H
 
+#include <functional>
+
 #include "win_main.h"
 
 namespace win {
@@ -105,6 +107,16 @@ private:
   HANDLE mutex_;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Calls function(index, worker) for each index in [0, count) on worker threads,
+// one of which is the calling thread, and returns when all calls are complete.
+// Workers are numbered from 0 to GetWorkerCount() - 1, so that callers can
+// keep per-worker state for the duration of a call without locking.
+size_t GetWorkerCount();
+void ParallelFor(size_t count,
+                 const std::function<void(size_t, size_t)>& function);
+
 }  // namespace win
 
 #endif  // TAIGA_WIN_THREAD_H
\ No newline at end of file